@@ -3,6 +3,7 @@
 
 #include "GameGridGenerator.h"
 #include "M_LoAW_Terrain/Public/TerrainGenerator.h"
+#include "M_LoAW_Terrain/Public/ComponentLabelUtility.h"
 #include "M_LoAW_GridData/Public/Hex.h"
 #include "M_LoAW_GridData/Public/HexGridCreator.h"
 #include "M_LoAW_GridData/Public/GridDataGameInstance.h"
@@ -13,6 +14,7 @@
 #include <Kismet/GameplayStatics.h>
 #include <Kismet/KismetMathLibrary.h>
 #include <Math/UnrealMathUtility.h>
+#include <Async/ParallelFor.h>
 
 DEFINE_LOG_CATEGORY(GameGridGenerator);
 
@@ -49,6 +51,40 @@ void AGameGridGenerator::BeginPlay()
 	DoWorkFlow();
 }
 
+void AGameGridGenerator::SetupSweep(ATerrainGenerator* InTG)
+{
+	pTG = InTG;
+	TreeGenerator = nullptr;
+	bSweep = true;
+	bUseGrid = true;
+	bShowGrid = false;
+	bShowBlock = false;
+	bShowIsland = false;
+	bShowTree = false;
+}
+
+void AGameGridGenerator::GetSweepMetrics(int32& OutIslandNum, float& OutBuildableRatio)
+{
+	TArray<int32> Labels;
+	OutIslandNum = ComponentLabelUtility::LabelComponents(GameGridPointsData.Num(),
+		[this](int32 i) { return GameGridPointsData[i].InTerrainRange && GameGridPointsData[i].IsLand; },
+		[this](const int32& Current, int32& Next, int32& Index) { return NextPoint(Current, Next, Index); },
+		Labels);
+
+	int32 RangeNum = 0;
+	int32 BuildableNum = 0;
+	for (const FStructGameGridPointData& Data : GameGridPointsData)
+	{
+		if (Data.InTerrainRange) {
+			RangeNum++;
+			if (Data.BuildingBlockLevel > 0) {
+				BuildableNum++;
+			}
+		}
+	}
+	OutBuildableRatio = RangeNum > 0 ? (float)BuildableNum / (float)RangeNum : 0.0;
+}
+
 void AGameGridGenerator::BindDelegate()
 {
 	WorkflowDelegate.BindUFunction(Cast<UObject>(this), TEXT("DoWorkFlow"));
@@ -85,9 +121,6 @@ void AGameGridGenerator::DoWorkFlow()
 	case Enum_GameGridGeneratorState::SetGridAreaBlockLevel:
 		SetGridAreaBlockLevel();
 		break;
-	case Enum_GameGridGeneratorState::SetGridAreaBlockLevelEx:
-		SetGridAreaBlockLevelEx();
-		break;
 	case Enum_GameGridGeneratorState::CheckAreaConnection:
 	case Enum_GameGridGeneratorState::InitCheckAreaConnection:
 	case Enum_GameGridGeneratorState::BreakMABToChunk:
@@ -100,15 +133,9 @@ void AGameGridGenerator::DoWorkFlow()
 	case Enum_GameGridGeneratorState::SetGridBuildingBlockLevel:
 		SetGridBuildingBlockLevel();
 		break;
-	case Enum_GameGridGeneratorState::SetGridBuildingBlockLevelEx:
-		SetGridBuildingBlockLevelEx();
-		break;
 	case Enum_GameGridGeneratorState::SetGridFlyingBlockLevel:
 		SetGridFlyingBlockLevel();
 		break;
-	case Enum_GameGridGeneratorState::SetGridFlyingBlockLevelEx:
-		SetGridFlyingBlockLevelEx();
-		break;
 	case Enum_GameGridGeneratorState::FindGridFlyingIsland:
 		FindGridFlyingIsland();
 		break;
@@ -158,6 +185,9 @@ bool AGameGridGenerator::GetGameInstance()
 
 bool AGameGridGenerator::InitTree()
 {
+	if (bSweep) {
+		return true;
+	}
 	if (TreeGenerator) {
 		TreeGenerator->CreateTerrainTypeTrees();
 		return true;
@@ -176,62 +206,19 @@ void AGameGridGenerator::InitProgress()
 void AGameGridGenerator::InitLoopData()
 {
 	FlowControlUtility::InitLoopData(CreateGridPointsLoopData);
-	FlowControlUtility::InitLoopData(SetGridPosZLoopData);
 	FlowControlUtility::InitLoopData(CalGridNormalLoopData);
 
 	FlowControlUtility::InitLoopData(SetGridTTLoopData);
 	FlowControlUtility::InitLoopData(SetGridTTEdgeLoopData);
 	FlowControlUtility::InitLoopData(AddTreeInstancesLoopData);
 
-	FlowControlUtility::InitLoopData(SetGridAreaBlockLevelLoopData);
-	FlowControlUtility::InitLoopData(SetGridAreaBlockLevelExLoopData);
-	InitExLoopDatas(AreaBlockExTimes, SetGridAreaBlockLevelExLoopData, AreaBlockLevelExLoopDatas);
-
-	FlowControlUtility::InitLoopData(BreakMABToChunkLoopData);
-
 	FlowControlUtility::InitLoopData(FindGridIsLandLoopData);
 
-	FlowControlUtility::InitLoopData(SetGridBuildingBlockLevelLoopData);
-	FlowControlUtility::InitLoopData(SetGridBuildingBlockLevelExLoopData);
-	InitExLoopDatas(BuildingBlockExTimes, SetGridBuildingBlockLevelExLoopData, BuildingBlockLevelExLoopDatas);
-
-	FlowControlUtility::InitLoopData(SetGridFlyingBlockLevelLoopData);
-	FlowControlUtility::InitLoopData(SetGridFlyingBlockLevelExLoopData);
-	InitExLoopDatas(FlyingBlockExTimes, SetGridFlyingBlockLevelExLoopData, FlyingBlockLevelExLoopDatas);
-
 	FlowControlUtility::InitLoopData(FindGridFlyingIsLandLoopData);
 
 	FlowControlUtility::InitLoopData(AddGridInstancesLoopData);
 }
 
-void AGameGridGenerator::InitExLoopDatas(int32 ExTimes, const FStructLoopData& Data, 
-	TArray<FStructLoopData>& Datas)
-{
-	for (int32 i = 0; i < ExTimes; i++)
-	{
-		FStructLoopData LoopData(Data);
-		Datas.Add(LoopData);
-	}
-}
-
-void AGameGridGenerator::InitAreaBlockLevelExLoopDatas()
-{
-	for (int32 i = 0; i < AreaBlockExTimes; i++)
-	{
-		FStructLoopData LoopData(SetGridAreaBlockLevelExLoopData);
-		AreaBlockLevelExLoopDatas.Add(LoopData);
-	}
-}
-
-void AGameGridGenerator::InitBulidingBlockLevelExLoopDatas()
-{
-	for (int32 i = 0; i < BuildingBlockExTimes; i++)
-	{
-		FStructLoopData LoopData(SetGridBuildingBlockLevelExLoopData);
-		BuildingBlockLevelExLoopDatas.Add(LoopData);
-	}
-}
-
 bool AGameGridGenerator::GameGridPointsLoopFunction(TFunction<void()> InitFunc, 
 	TFunction<void(int32 LoopIndex)> LoopFunc, 
 	FStructLoopData& LoopData, 
@@ -319,10 +306,16 @@ void AGameGridGenerator::WaitTerrain()
 {
 	FTimerHandle TimerHandle;
 	TArray<AActor*> Out_Actors;
-	UGameplayStatics::GetAllActorsOfClass(GetWorld(), ATerrainGenerator::StaticClass(), Out_Actors);
+	if (bSweep) {
+		Out_Actors.Add(pTG);
+	}
+	else {
+		UGameplayStatics::GetAllActorsOfClass(GetWorld(), ATerrainGenerator::StaticClass(), Out_Actors);
+	}
 	if (Out_Actors.Num() == 1) {
 		pTG = Cast<ATerrainGenerator>(Out_Actors[0]);
 		if (pTG && pTG->IsLoadingCompleted()) {
+			pTG->OnTerrainModified.AddUniqueDynamic(this, &AGameGridGenerator::UpdateModifiedTiles);
 			WorkflowState = Enum_GameGridGeneratorState::SetGridPosZ;
 			GetWorldTimerManager().SetTimer(TimerHandle, WorkflowDelegate, DefaultTimerRate, false);
 			UE_LOG(GameGridGenerator, Log, TEXT("Wait terrain done!"));
@@ -335,12 +328,16 @@ void AGameGridGenerator::WaitTerrain()
 
 void AGameGridGenerator::SetGridPosZ()
 {
-	if (GameGridPointsLoopFunction(nullptr, [this](int32 i) { SetTilePosZ(i); },
-		SetGridPosZLoopData, 
-		Enum_GameGridGeneratorState::CalGridNormal,
-		true, ProgressWeight_SetGridPosZ)) {
-		UE_LOG(GameGridGenerator, Log, TEXT("Set grid pos z done!"));
-	}
+	//Heights come from the terrain heightfield, each tile only writes its own data
+	ParallelFor(GameGridPointsData.Num(), [this](int32 i) { SetTilePosZ(i); });
+
+	ProgressPassed += ProgressWeight_SetGridPosZ;
+	Progress = ProgressPassed;
+
+	FTimerHandle TimerHandle;
+	WorkflowState = Enum_GameGridGeneratorState::CalGridNormal;
+	GetWorldTimerManager().SetTimer(TimerHandle, WorkflowDelegate, DefaultTimerRate, false);
+	UE_LOG(GameGridGenerator, Log, TEXT("Set grid pos z done!"));
 }
 
 void AGameGridGenerator::SetTilePosZ(int32 Index)
@@ -357,11 +354,13 @@ void AGameGridGenerator::SetTileCenterPosZ(int32 Index)
 		FStructGameGridPointData& Data = GameGridPointsData[Index];
 		Data.PositionZ = Loc.Z;
 		Data.InTerrainRange = true;
+		pTG->GetWaterDistancesAt(Pos2D, Data.RiverDistance, Data.LakeDistance, Data.CoastDistance);
 	}
 }
 
 void AGameGridGenerator::SetTileVerticesPosZ(int32 Index)
 {
+	GameGridPointsData[Index].VerticesPositionZ.Reset();
 	float Sum = 0.0;
 	float WaterBase = pTG->GetWaterBase();
 	for (int32 i = 0; i < HEX_SIDE_NUM; i++)
@@ -576,145 +575,63 @@ void AGameGridGenerator::AddTreeInstanceData(int32 PointIndex, int32 InstanceInd
 
 void AGameGridGenerator::SetGridAreaBlockLevel()
 {
-	if (GameGridPointsLoopFunction([this]() { InitSetGridAreaBlockLevel(); },
-		[this](int32 i) { SetTileAreaBlockLevelByNeighbors(i); },
-		SetGridAreaBlockLevelLoopData, 
-		Enum_GameGridGeneratorState::SetGridAreaBlockLevelEx,
-		true, ProgressWeight_SetGridAreaBlockLevel)) {
-		UE_LOG(GameGridGenerator, Log, TEXT("SetGridAreaBlockLevel done!"));
-	}
-}
-
-void AGameGridGenerator::InitSetGridAreaBlockLevel()
-{
-	AreaBlockLevelMax = pGI->GameGridParam.NeighborRange + 1;
-}
+	AreaBlockLevelMax = GetBlockLevelMax(AreaBlockExTimes);
+	TArray<int32> BlockLevels;
+	CalGridBlockLevel([this](int32 Index) { return IsTileAreaBlock(Index); },
+		AreaBlockLevelMax, BlockLevels);
 
-bool AGameGridGenerator::CheckTileBlock(int32 CheckIndex, float UpperRatio, float LowerRatio, float SlopeRatio)
-{
-	FStructGameGridPointData CheckData = GameGridPointsData[CheckIndex];
-	if (!CheckData.InTerrainRange
-		|| CheckData.PositionZ > UpperRatio * pTG->GetTileAltitudeMultiplier()
-		|| CheckData.PositionZ < LowerRatio * pTG->GetTileAltitudeMultiplier()
-		|| CheckData.AngleToUp >(PI * SlopeRatio / 2.0)) {
-		return true;
+	MaxAreaBlockTileIndices.Empty();
+	for (int32 i = 0; i < GameGridPointsData.Num(); i++)
+	{
+		GameGridPointsData[i].AreaBlockLevel = BlockLevels[i];
+		if (BlockLevels[i] == AreaBlockLevelMax) {
+			MaxAreaBlockTileIndices.Add(i);
+		}
 	}
-	return false;
+	SetBlockLevelStageDone(ProgressWeight_SetGridAreaBlockLevel, Enum_GameGridGeneratorState::CheckAreaConnection);
+	UE_LOG(GameGridGenerator, Log, TEXT("SetGridAreaBlockLevel done!"));
 }
 
-bool AGameGridGenerator::SetTileAreaBlock(int32 Index, int32 CheckIndex, int32 BlockLevel)
+int32 AGameGridGenerator::GetBlockLevelMax(int32 ExTimes)
 {
-	bool flag = CheckTileBlock(CheckIndex,
-		AreaBlockAltitudeUpperRatio, pTG->GetShallowWaterRatio(), AreaBlockSlopeRatio);
-	if (flag) {
-		FStructGameGridPointData& Data = GameGridPointsData[Index];
-		Data.AreaBlockLevel = BlockLevel;
-	}
-	return flag;
+	return pGI->GameGridParam.NeighborRange * (ExTimes + 1) + 1;
 }
 
-void AGameGridGenerator::SetTileAreaBlockLevelByNeighbors(int32 Index)
+void AGameGridGenerator::CalGridBlockLevel(TFunctionRef<bool(int32 Index)> IsBlockFunc,
+	int32 BlockLevelMax, TArray<int32>& OutBlockLevels)
 {
-	FStructGameGridPointData& Data = GameGridPointsData[Index];
-	if (SetTileAreaBlock(Index, Index, 0)) {
-		return;
-	}
-
-	for (int32 i = 0; i < GetPointNeighborNum(Index); i++)
-	{
-		if (SetTileAreaBlockLevelByNeighbor(Index, i)) {
-			return;
-		}
-	}
-	Data.AreaBlockLevel = AreaBlockLevelMax;
-	if (Data.AreaBlockLevel == (pGI->GameGridParam.NeighborRange * (AreaBlockExTimes + 1) + 1)) {
-		MaxAreaBlockTileIndices.Add(Index);
-	}
+	AStarUtility::DistanceTransformFunction(GameGridPointsData.Num(),
+		IsBlockFunc,
+		[this](const int32& Current, int32& Next, int32& Index) { return NextPoint(Current, Next, Index); },
+		BlockLevelMax, OutBlockLevels);
 }
 
-bool AGameGridGenerator::SetTileAreaBlockLevelByNeighbor(int32 Index, int32 NeighborRangeIndex)
+void AGameGridGenerator::SetBlockLevelStageDone(float ProgressWeight, Enum_GameGridGeneratorState NextState)
 {
-	FStructGameGridPointData& Data = GameGridPointsData[Index];
-	FStructGridDataNeighbors& Neighbors = pGI->GameGridPoints[Data.GridDataIndex].Neighbors[NeighborRangeIndex];
-
-	int32 TileIndex;
-	for (int32 i = 0; i < Neighbors.Points.Num(); i++)
-	{
-		FIntPoint key = Neighbors.Points[i];
-		if (!GameGridPointsIndices.Contains(key)) {
-			continue;
-		}
+	ProgressPassed += ProgressWeight;
+	Progress = ProgressPassed;
 
-		TileIndex = GameGridPointsIndices[key];
-		if (SetTileAreaBlock(Index, TileIndex, Neighbors.Radius))
-		{
-			return true;
-		}
-	}
-	return false;
+	FTimerHandle TimerHandle;
+	WorkflowState = NextState;
+	GetWorldTimerManager().SetTimer(TimerHandle, WorkflowDelegate, DefaultTimerRate, false);
 }
 
-void AGameGridGenerator::SetGridAreaBlockLevelEx()
+bool AGameGridGenerator::CheckTileBlock(int32 CheckIndex, float UpperRatio, float LowerRatio, float SlopeRatio)
 {
-	if (AreaBlockExTimes == 0) {
-		ProgressPassed += ProgressWeight_SetGridAreaBlockLevelEx;
-		FTimerHandle TimerHandle;
-		WorkflowState = Enum_GameGridGeneratorState::CheckAreaConnection;
-		GetWorldTimerManager().SetTimer(TimerHandle, WorkflowDelegate, DefaultTimerRate, false);
-		UE_LOG(GameGridGenerator, Log, TEXT("Set grid area block level extension done!"));
-		return;
-	}
-
-	int32 i = SetGridAreaBlockLevelExLoopData.IndexSaved[0];
-	Enum_GameGridGeneratorState state = Enum_GameGridGeneratorState::SetGridAreaBlockLevelEx;
-	for (; i < AreaBlockExTimes;)
-	{
-		SetGridAreaBlockLevelExLoopData.IndexSaved[0] = i;
-		if (i == (AreaBlockExTimes - 1)) {
-			state = Enum_GameGridGeneratorState::CheckAreaConnection;
-		}
-		if (GameGridPointsLoopFunction([this]() { InitSetGridAreaBlockLevelEx(); },
-			[this](int32 i) { SetTileAreaBlockLevelByNeighborsEx(i); },
-			AreaBlockLevelExLoopDatas[i], state)) {
-			Progress = ProgressPassed + (float)(i + 1) / (float)AreaBlockExTimes * ProgressWeight_SetGridAreaBlockLevelEx;
-			UE_LOG(GameGridGenerator, Log, TEXT("Set grid area block level extension %d done!"), i + 1);
-			i++;
-			SetGridAreaBlockLevelExLoopData.IndexSaved[0] = i;
-			if (i == (AreaBlockExTimes - 1)) {
-				ProgressPassed += ProgressWeight_SetGridAreaBlockLevelEx;
-				break;
-			}
-		}
-		return;
+	const FStructGameGridPointData& CheckData = GameGridPointsData[CheckIndex];
+	if (!CheckData.InTerrainRange
+		|| CheckData.PositionZ > UpperRatio * pTG->GetTileAltitudeMultiplier()
+		|| CheckData.PositionZ < LowerRatio * pTG->GetTileAltitudeMultiplier()
+		|| CheckData.AngleToUp >(PI * SlopeRatio / 2.0)) {
+		return true;
 	}
-	UE_LOG(GameGridGenerator, Log, TEXT("Set grid area block level extension done!"));
-}
-
-void AGameGridGenerator::InitSetGridAreaBlockLevelEx()
-{
-	AreaBlockLevelMax += pGI->GameGridParam.NeighborRange;
+	return false;
 }
 
-void AGameGridGenerator::SetTileAreaBlockLevelByNeighborsEx(int32 Index)
+bool AGameGridGenerator::IsTileAreaBlock(int32 CheckIndex)
 {
-	FStructGameGridPointData& Data = GameGridPointsData[Index];
-	if (Data.AreaBlockLevel == (AreaBlockLevelMax - pGI->GameGridParam.NeighborRange))
-	{
-		FStructGridDataNeighbors& OutSideNeighbors = pGI->GameGridPoints[Data.GridDataIndex].Neighbors[GetPointNeighborNum(Index) - 1];
-		int32 BlockLvMin = AreaBlockLevelMax;
-		int32 CurrentBlockLv = Data.AreaBlockLevel;
-		for (int32 i = 0; i < OutSideNeighbors.Count; i++)
-		{
-			CurrentBlockLv = pGI->GameGridParam.NeighborRange + GameGridPointsData[GameGridPointsIndices[OutSideNeighbors.Points[i]]].AreaBlockLevel;
-			if (CurrentBlockLv < BlockLvMin) {
-				BlockLvMin = CurrentBlockLv;
-			}
-		}
-		Data.AreaBlockLevel = BlockLvMin;
-		if (Data.AreaBlockLevel == (pGI->GameGridParam.NeighborRange * (AreaBlockExTimes + 1) + 1)) {
-			MaxAreaBlockTileIndices.Add(Index);
-		}
-	}
+	return CheckTileBlock(CheckIndex,
+		AreaBlockAltitudeUpperRatio, pTG->GetShallowWaterRatio(), AreaBlockSlopeRatio);
 }
 
 void AGameGridGenerator::CheckAreaConnection()
@@ -744,28 +661,29 @@ void AGameGridGenerator::InitCheckAreaConnection()
 
 void AGameGridGenerator::BreakMABToChunk()
 {
-	FTimerHandle TimerHandle;
-	auto InitFunc = [&]() {
-		BreakMABToChunkData.Seed = MaxAreaBlockTileIndices;
-		};
-	TArray<int32> Indices = {};
-	if (AStarUtility::BFSFCLoopFunction<int32>(this,
-		BreakMABToChunkData,
-		Indices,
-		BreakMABToChunkLoopData,
-		WorkflowDelegate,
-		InitFunc,
+	TArray<int32> Labels;
+	int32 ChunkNum = ComponentLabelUtility::LabelComponents(GameGridPointsData.Num(),
+		[this](int32 i) { return MaxAreaBlockTileIndices.Contains(i); },
 		[this](const int32& Current, int32& Next, int32& Index) { return NextPoint(Current, Next, Index); },
-		[this]() { AddMABChunk(); })) {
-		WorkflowState = Enum_GameGridGeneratorState::CheckChunksAreaConnection;
-		GetWorldTimerManager().SetTimer(TimerHandle, WorkflowDelegate, BreakMABToChunkLoopData.Rate, false);
-		UE_LOG(GameGridGenerator, Log, TEXT("BreakMABToChunk done."));
+		Labels);
+
+	MaxAreaBlockTileChunks.SetNum(ChunkNum);
+	for (int32 i = 0; i < Labels.Num(); i++)
+	{
+		if (Labels[i] != INDEX_NONE) {
+			MaxAreaBlockTileChunks[Labels[i]].Add(i);
+		}
 	}
+
+	FTimerHandle TimerHandle;
+	WorkflowState = Enum_GameGridGeneratorState::CheckChunksAreaConnection;
+	GetWorldTimerManager().SetTimer(TimerHandle, WorkflowDelegate, DefaultTimerRate, false);
+	UE_LOG(GameGridGenerator, Log, TEXT("BreakMABToChunk done."));
 }
 
 bool AGameGridGenerator::NextPoint(const int32& Current, int32& Next, int32& Index)
 {
-	FStructGridDataNeighbors Neighbors = pGI->GameGridPoints[GameGridPointsData[Current].GridDataIndex].Neighbors[0];
+	const FStructGridDataNeighbors& Neighbors = pGI->GameGridPoints[GameGridPointsData[Current].GridDataIndex].Neighbors[0];
 	if (Index < Neighbors.Points.Num()) {
 		FIntPoint key = Neighbors.Points[Index];
 		if (GameGridPointsIndices.Contains(key)) {
@@ -777,11 +695,6 @@ bool AGameGridGenerator::NextPoint(const int32& Current, int32& Next, int32& Ind
 	return false;
 }
 
-void AGameGridGenerator::AddMABChunk()
-{
-	MaxAreaBlockTileChunks.Add(BreakMABToChunkData.Reached);
-}
-
 void AGameGridGenerator::CheckChunksAreaConnection()
 {
 	FTimerHandle TimerHandle;
@@ -929,255 +842,48 @@ bool AGameGridGenerator::Find_ABLM_By_ABL3(int32 Index)
 
 void AGameGridGenerator::SetGridBuildingBlockLevel()
 {
-	if (GameGridPointsLoopFunction([this]() { InitSetGridBuildingBlockLevel(); },
-		[this](int32 i) { SetTileBuildingBlockLevelByNeighbors(i); },
-		SetGridBuildingBlockLevelLoopData, 
-		Enum_GameGridGeneratorState::SetGridBuildingBlockLevelEx,
-		true, ProgressWeight_SetGridBuildingBlockLevel)) {
-		UE_LOG(GameGridGenerator, Log, TEXT("SetGridBuildingBlockLevel done!"));
-	}
-}
-
-void AGameGridGenerator::InitSetGridBuildingBlockLevel()
-{
-	BuildingBlockLevelMax = pGI->GameGridParam.NeighborRange + 1;
-}
+	BuildingBlockLevelMax = GetBlockLevelMax(BuildingBlockExTimes);
+	TArray<int32> BlockLevels;
+	CalGridBlockLevel([this](int32 Index) { return IsTileBuildingBlock(Index); },
+		BuildingBlockLevelMax, BlockLevels);
 
-bool AGameGridGenerator::SetTileBuildingBlock(int32 Index, int32 CheckIndex, int32 BlockLevel)
-{
-	bool flag = CheckTileBlock(CheckIndex,
-		BuildingBlockAltitudeUpperRatio, BuildingBlockAltitudeLowerRatio, BuildingBlockSlopeRatio);
-	FStructGameGridPointData CheckData = GameGridPointsData[CheckIndex];
-	if (CheckData.TreeRecords.Num() > 0) {
-		flag = true;
-	}
-	if (flag) {
-		FStructGameGridPointData& Data = GameGridPointsData[Index];
-		Data.BuildingBlockLevel = BlockLevel;
-	}
-	return flag;
-}
-
-void AGameGridGenerator::SetTileBuildingBlockLevelByNeighbors(int32 Index)
-{
-	FStructGameGridPointData& Data = GameGridPointsData[Index];
-	if (SetTileBuildingBlock(Index, Index, 0)) {
-		return;
-	}
-
-	for (int32 i = 0; i < GetPointNeighborNum(Index); i++)
-	{
-		if (SetTileBuildingBlockLevelByNeighbor(Index, i)) {
-			return;
-		}
-	}
-	Data.BuildingBlockLevel = BuildingBlockLevelMax;
-}
-
-bool AGameGridGenerator::SetTileBuildingBlockLevelByNeighbor(int32 Index, int32 NeighborRangeIndex)
-{
-	FStructGameGridPointData& Data = GameGridPointsData[Index];
-	FStructGridDataNeighbors& Neighbors = pGI->GameGridPoints[Data.GridDataIndex].Neighbors[NeighborRangeIndex];
-
-	int32 TileIndex;
-	for (int32 i = 0; i < Neighbors.Points.Num(); i++)
-	{
-		FIntPoint key = Neighbors.Points[i];
-		if (!GameGridPointsIndices.Contains(key)) {
-			continue;
-		}
-
-		TileIndex = GameGridPointsIndices[key];
-		if (SetTileBuildingBlock(Index, TileIndex, Neighbors.Radius))
-		{
-			return true;
-		}
-	}
-	return false;
-}
-
-void AGameGridGenerator::SetGridBuildingBlockLevelEx()
-{
-	if (BuildingBlockExTimes == 0) {
-		ProgressPassed += ProgressWeight_SetGridBuildingBlockLevelEx;
-		FTimerHandle TimerHandle;
-		WorkflowState = Enum_GameGridGeneratorState::SetGridFlyingBlockLevel;
-		GetWorldTimerManager().SetTimer(TimerHandle, WorkflowDelegate, DefaultTimerRate, false);
-		UE_LOG(GameGridGenerator, Log, TEXT("Set grid building block level extension done!"));
-		return;
-	}
-	int32 i = SetGridBuildingBlockLevelExLoopData.IndexSaved[0];
-	Enum_GameGridGeneratorState state = Enum_GameGridGeneratorState::SetGridBuildingBlockLevelEx;
-	for (; i < BuildingBlockExTimes; )
+	for (int32 i = 0; i < GameGridPointsData.Num(); i++)
 	{
-		SetGridBuildingBlockLevelExLoopData.IndexSaved[0] = i;
-		if (i == (BuildingBlockExTimes - 1)) {
-			state = Enum_GameGridGeneratorState::SetGridFlyingBlockLevel;
-		}
-		if (GameGridPointsLoopFunction([this]() { InitSetGridBuildingBlockLevelEx(); },
-			[this](int32 i) { SetTileBuildingBlockLevelByNeighborsEx(i); },
-			BuildingBlockLevelExLoopDatas[i], state)) {
-			Progress = ProgressPassed + (float)(i + 1) / (float)BuildingBlockExTimes * ProgressWeight_SetGridBuildingBlockLevelEx;
-			UE_LOG(GameGridGenerator, Log, TEXT("Set grid building block level extension %d done!"), i + 1);
-			i++;
-			SetGridBuildingBlockLevelExLoopData.IndexSaved[0] = i;
-			if (i == BuildingBlockExTimes) {
-				ProgressPassed += ProgressWeight_SetGridBuildingBlockLevelEx;
-				break;
-			}
-		}
-		return;
+		GameGridPointsData[i].BuildingBlockLevel = BlockLevels[i];
 	}
-	UE_LOG(GameGridGenerator, Log, TEXT("Set grid building block level extension done!"));
+	SetBlockLevelStageDone(ProgressWeight_SetGridBuildingBlockLevel, Enum_GameGridGeneratorState::SetGridFlyingBlockLevel);
+	UE_LOG(GameGridGenerator, Log, TEXT("SetGridBuildingBlockLevel done!"));
 }
 
-void AGameGridGenerator::InitSetGridBuildingBlockLevelEx()
+bool AGameGridGenerator::IsTileBuildingBlock(int32 CheckIndex)
 {
-	BuildingBlockLevelMax += pGI->GameGridParam.NeighborRange;
-}
-
-void AGameGridGenerator::SetTileBuildingBlockLevelByNeighborsEx(int32 Index)
-{
-	FStructGameGridPointData& Data = GameGridPointsData[Index];
-	if (Data.BuildingBlockLevel == (BuildingBlockLevelMax - pGI->GameGridParam.NeighborRange))
-	{
-		FStructGridDataNeighbors& OutSideNeighbors = pGI->GameGridPoints[Data.GridDataIndex].Neighbors[GetPointNeighborNum(Index) - 1];
-		int32 BlockLvMin = BuildingBlockLevelMax;
-		int32 CurrentBlockLv = Data.BuildingBlockLevel;
-		for (int32 i = 0; i < OutSideNeighbors.Count; i++)
-		{
-			CurrentBlockLv = pGI->GameGridParam.NeighborRange + GameGridPointsData[GameGridPointsIndices[OutSideNeighbors.Points[i]]].BuildingBlockLevel;
-			if (CurrentBlockLv < BlockLvMin) {
-				BlockLvMin = CurrentBlockLv;
-			}
-		}
-		Data.BuildingBlockLevel = BlockLvMin;
-	}
-}
-
-void AGameGridGenerator::SetGridFlyingBlockLevel()
-{
-	if (GameGridPointsLoopFunction([this]() { InitSetGridFlyingBlockLevel(); },
-		[this](int32 i) { SetTileFlyingBlockLevelByNeighbors(i); },
-		SetGridFlyingBlockLevelLoopData, Enum_GameGridGeneratorState::SetGridFlyingBlockLevelEx,
-		true, ProgressWeight_SetGridFlyingBlockLevel)) {
-		UE_LOG(GameGridGenerator, Log, TEXT("SetGridFlyingBlockLevel done!"));
-	}
-}
-
-void AGameGridGenerator::InitSetGridFlyingBlockLevel()
-{
-	FlyingBlockLevelMax = pGI->GameGridParam.NeighborRange + 1;
-}
-
-bool AGameGridGenerator::SetTileFlyingBlock(int32 Index, int32 CheckIndex, int32 BlockLevel)
-{
-	FStructGameGridPointData& Data = GameGridPointsData[Index];
-	FStructGameGridPointData CheckData = GameGridPointsData[CheckIndex];
-	if (!CheckData.InTerrainRange
-		|| CheckData.PositionZ > FlyingBlockAltitudeRatio * pTG->GetTileAltitudeMultiplier()) {
-		Data.FlyingBlockLevel = BlockLevel;
+	if (GameGridPointsData[CheckIndex].TreeRecords.Num() > 0) {
 		return true;
 	}
-	return false;
-}
-
-void AGameGridGenerator::SetTileFlyingBlockLevelByNeighbors(int32 Index)
-{
-	FStructGameGridPointData& Data = GameGridPointsData[Index];
-	if (SetTileFlyingBlock(Index, Index, 0)) {
-		return;
-	}
-
-	for (int32 i = 0; i < GetPointNeighborNum(Index); i++)
-	{
-		if (SetTileFlyingBlockLevelByNeighbor(Index, i)) {
-			return;
-		}
-	}
-	Data.FlyingBlockLevel = FlyingBlockLevelMax;
+	return CheckTileBlock(CheckIndex,
+		BuildingBlockAltitudeUpperRatio, BuildingBlockAltitudeLowerRatio, BuildingBlockSlopeRatio);
 }
 
-bool AGameGridGenerator::SetTileFlyingBlockLevelByNeighbor(int32 Index, int32 NeighborRangeIndex)
+void AGameGridGenerator::SetGridFlyingBlockLevel()
 {
-	FStructGameGridPointData& Data = GameGridPointsData[Index];
-	FStructGridDataNeighbors& Neighbors = pGI->GameGridPoints[Data.GridDataIndex].Neighbors[NeighborRangeIndex];
+	FlyingBlockLevelMax = GetBlockLevelMax(FlyingBlockExTimes);
+	TArray<int32> BlockLevels;
+	CalGridBlockLevel([this](int32 Index) { return IsTileFlyingBlock(Index); },
+		FlyingBlockLevelMax, BlockLevels);
 
-	int32 TileIndex;
-	for (int32 i = 0; i < Neighbors.Points.Num(); i++)
-	{
-		FIntPoint key = Neighbors.Points[i];
-		if (!GameGridPointsIndices.Contains(key)) {
-			continue;
-		}
-
-		TileIndex = GameGridPointsIndices[key];
-		if (SetTileFlyingBlock(Index, TileIndex, Neighbors.Radius))
-		{
-			return true;
-		}
-	}
-	return false;
-}
-
-void AGameGridGenerator::SetGridFlyingBlockLevelEx()
-{
-	if (FlyingBlockExTimes == 0) {
-		ProgressPassed += ProgressWeight_SetGridFlyingBlockLevelEx;
-		FTimerHandle TimerHandle;
-		WorkflowState = Enum_GameGridGeneratorState::FindGridFlyingIsland;
-		GetWorldTimerManager().SetTimer(TimerHandle, WorkflowDelegate, DefaultTimerRate, false);
-		UE_LOG(GameGridGenerator, Log, TEXT("Set grid flying block level extension done!"));
-		return;
-	}
-	int32 i = SetGridFlyingBlockLevelExLoopData.IndexSaved[0];
-	Enum_GameGridGeneratorState state = Enum_GameGridGeneratorState::SetGridFlyingBlockLevelEx;
-	for (; i < FlyingBlockExTimes;)
+	for (int32 i = 0; i < GameGridPointsData.Num(); i++)
 	{
-		SetGridFlyingBlockLevelExLoopData.IndexSaved[0] = i;
-		if (i == (FlyingBlockExTimes - 1)) {
-			state = Enum_GameGridGeneratorState::FindGridFlyingIsland;
-		}
-		if (GameGridPointsLoopFunction([this]() { InitSetGridFlyingBlockLevelEx(); },
-			[this](int32 i) { SetTileFlyingBlockLevelByNeighborsEx(i); },
-			FlyingBlockLevelExLoopDatas[i], state)) {
-			Progress = ProgressPassed + (float)(i + 1) / (float)FlyingBlockExTimes * ProgressWeight_SetGridFlyingBlockLevelEx;
-			UE_LOG(GameGridGenerator, Log, TEXT("Set grid flying block level extension %d done!"), i + 1);
-			i++;
-			SetGridFlyingBlockLevelExLoopData.IndexSaved[0] = i;
-			if (i == (FlyingBlockExTimes - 1)) {
-				ProgressPassed += ProgressWeight_SetGridFlyingBlockLevelEx;
-				break;
-			}
-			
-		}
-		return;
+		GameGridPointsData[i].FlyingBlockLevel = BlockLevels[i];
 	}
-	UE_LOG(GameGridGenerator, Log, TEXT("Set grid flying block level extension done!"));
+	SetBlockLevelStageDone(ProgressWeight_SetGridFlyingBlockLevel, Enum_GameGridGeneratorState::FindGridFlyingIsland);
+	UE_LOG(GameGridGenerator, Log, TEXT("SetGridFlyingBlockLevel done!"));
 }
 
-void AGameGridGenerator::InitSetGridFlyingBlockLevelEx()
+bool AGameGridGenerator::IsTileFlyingBlock(int32 CheckIndex)
 {
-	FlyingBlockLevelMax += pGI->GameGridParam.NeighborRange;
-}
-
-void AGameGridGenerator::SetTileFlyingBlockLevelByNeighborsEx(int32 Index)
-{
-	FStructGameGridPointData& Data = GameGridPointsData[Index];
-	if (Data.FlyingBlockLevel == (FlyingBlockLevelMax - pGI->GameGridParam.NeighborRange))
-	{
-		FStructGridDataNeighbors& OutSideNeighbors = pGI->GameGridPoints[Data.GridDataIndex].Neighbors[GetPointNeighborNum(Index) - 1];
-		int32 BlockLvMin = FlyingBlockLevelMax;
-		int32 CurrentBlockLv = Data.FlyingBlockLevel;
-		for (int32 i = 0; i < OutSideNeighbors.Count; i++)
-		{
-			CurrentBlockLv = pGI->GameGridParam.NeighborRange + GameGridPointsData[GameGridPointsIndices[OutSideNeighbors.Points[i]]].FlyingBlockLevel;
-			if (CurrentBlockLv < BlockLvMin) {
-				BlockLvMin = CurrentBlockLv;
-			}
-		}
-		Data.FlyingBlockLevel = BlockLvMin;
-	}
+	const FStructGameGridPointData& CheckData = GameGridPointsData[CheckIndex];
+	return !CheckData.InTerrainRange
+		|| CheckData.PositionZ > FlyingBlockAltitudeRatio * pTG->GetTileAltitudeMultiplier();
 }
 
 void AGameGridGenerator::FindGridFlyingIsland()
@@ -1490,6 +1196,31 @@ void AGameGridGenerator::DoWorkflowDone()
 	Progress = 1.0;
 }
 
+void AGameGridGenerator::UpdateModifiedTiles(FBox2D Bounds)
+{
+	if (GameGridPointsData.IsEmpty()) {
+		return;
+	}
+	//Tiles sample the terrain at their center and corners
+	float TileRadius = FVector2D::Distance(GetTileVertexPosition2D(0, 0), GetPointPosition2D(0));
+	FBox2D TileBounds = Bounds.ExpandBy(TileRadius);
+	TArray<int32> TileIndices;
+	for (int32 i = 0; i < GameGridPointsData.Num(); i++)
+	{
+		if (TileBounds.IsInside(GetPointPosition2D(i))) {
+			TileIndices.Add(i);
+		}
+	}
+
+	ParallelFor(TileIndices.Num(), [&](int32 i) { SetTilePosZ(TileIndices[i]); });
+	for (int32 Index : TileIndices)
+	{
+		CalTileNormal(Index);
+		SetTileTT(Index);
+	}
+	UE_LOG(GameGridGenerator, Log, TEXT("Update %d modified tiles done."), TileIndices.Num());
+}
+
 void AGameGridGenerator::FindNeighborTilesByRadius(TArray<FIntPoint>& NeighborTiles, 
 	int32 CenterIndex, int32 Radius)
 {
@@ -1516,6 +1247,19 @@ void AGameGridGenerator::Tick(float DeltaTime)
 
 }
 
+bool AGameGridGenerator::GetTileWaterDistances(FIntPoint AxialCoord, float& OutRiver, float& OutLake, float& OutCoast)
+{
+	const int32* Index = GameGridPointsIndices.Find(AxialCoord);
+	if (Index == nullptr || !GameGridPointsData[*Index].InTerrainRange) {
+		return false;
+	}
+	const FStructGameGridPointData& Data = GameGridPointsData[*Index];
+	OutRiver = Data.RiverDistance;
+	OutLake = Data.LakeDistance;
+	OutCoast = Data.CoastDistance;
+	return true;
+}
+
 void AGameGridGenerator::AddMouseOverGrid(Hex& MouseOverHex)
 {
 	int32 Index = GameGridPointsIndices[MouseOverHex.ToIntPoint()];
@@ -0,0 +1,164 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "GameGridSeedSweep.h"
+#include "M_LoAW_Terrain/Public/TerrainGenerator.h"
+#include "M_LoAW_GridData/Public/GridDataGameInstance.h"
+#include "M_LoAW_GameGrid/Public/GameGridGenerator.h"
+
+#include <ImageUtils.h>
+#include <Misc/FileHelper.h>
+#include <Misc/Paths.h>
+
+DEFINE_LOG_CATEGORY(GameGridSeedSweep);
+
+// Sets default values
+AGameGridSeedSweep::AGameGridSeedSweep() : pGI(nullptr), Noise(nullptr)
+{
+ 	// Set this actor to call Tick() every frame.  You can turn this off to improve performance if you don't need it.
+	PrimaryActorTick.bCanEverTick = false;
+	PrimaryActorTick.bStartWithTickEnabled = false;
+
+	SweepDelegate.BindUFunction(Cast<UObject>(this), TEXT("DoSweep"));
+}
+
+// Called when the game starts or when spawned
+void AGameGridSeedSweep::BeginPlay()
+{
+	Super::BeginPlay();
+
+	DoSweep();
+}
+
+// Called every frame
+void AGameGridSeedSweep::Tick(float DeltaTime)
+{
+	Super::Tick(DeltaTime);
+
+}
+
+void AGameGridSeedSweep::DoSweep()
+{
+	if (pGI == nullptr) {
+		if (!InitSweep()) {
+			SetSweepTimer();
+			return;
+		}
+	}
+
+	for (int32 i = RunningJobs.Num() - 1; i >= 0; i--)
+	{
+		FStructSeedSweepJob& Job = RunningJobs[i];
+		if (Job.Terrain->IsWorkFlowStepDone(Enum_TerrainGeneratorState::Done)) {
+			UE_LOG(GameGridSeedSweep, Warning, TEXT("Terrain error, parameter set %d seed %d!"), Job.ParameterSetIndex, Job.Seed);
+		}
+		else if (!Job.GameGrid->IsLoadingCompleted()) {
+			continue;
+		}
+		else {
+			FinishJob(Job);
+		}
+		Job.GameGrid->Destroy();
+		Job.Terrain->Destroy();
+		RunningJobs.RemoveAt(i);
+		FinishedNum++;
+	}
+
+	while (RunningJobs.Num() < MaxParallel && !PendingJobs.IsEmpty()) {
+		StartJob(PendingJobs[0]);
+		PendingJobs.RemoveAt(0);
+	}
+
+	if (RunningJobs.IsEmpty()) {
+		UE_LOG(GameGridSeedSweep, Log, TEXT("Seed sweep done, %d runs written to %s."), FinishedNum, *CsvPath);
+		if (bQuitWhenDone) {
+			FPlatformMisc::RequestExit(false);
+		}
+		return;
+	}
+	SetSweepTimer();
+}
+
+bool AGameGridSeedSweep::InitSweep()
+{
+	UWorld* world = GetWorld();
+	if (world == nullptr) {
+		return false;
+	}
+	UGridDataGameInstance* GI = Cast<UGridDataGameInstance>(world->GetGameInstance());
+	if (GI == nullptr || !GI->hasTerrainGridLoaded || !GI->hasGameGridLoaded) {
+		return false;
+	}
+	pGI = GI;
+
+	if (GameGridGeneratorClass == nullptr) {
+		GameGridGeneratorClass = AGameGridGenerator::StaticClass();
+	}
+	for (int32 i = 0; i < ParameterSets.Num(); i++)
+	{
+		if (ParameterSets[i] == nullptr) {
+			continue;
+		}
+		for (int32 Seed = SeedStart; Seed < SeedStart + SeedNum; Seed++)
+		{
+			FStructSeedSweepJob Job;
+			Job.ParameterSetIndex = i;
+			Job.Seed = Seed;
+			PendingJobs.Add(Job);
+		}
+	}
+
+	CsvPath = FPaths::ProjectSavedDir() / OutputFolder / TEXT("SeedSweep.csv");
+	CsvText = TEXT("ParameterSet,Seed,LandRatio,RiverNum,RiverLength,IslandNum,BuildableRatio,BlockLevelMax,BlockLevelMean\n");
+	FFileHelper::SaveStringToFile(CsvText, *CsvPath);
+	UE_LOG(GameGridSeedSweep, Log, TEXT("Seed sweep start, %d runs."), PendingJobs.Num());
+	return true;
+}
+
+void AGameGridSeedSweep::StartJob(const FStructSeedSweepJob& InJob)
+{
+	FStructSeedSweepJob Job = InJob;
+	UWorld* world = GetWorld();
+
+	Job.Terrain = world->SpawnActorDeferred<ATerrainGenerator>(ParameterSets[Job.ParameterSetIndex], GetActorTransform());
+	Job.Terrain->SetupSweep(Noise, Job.Seed);
+	Job.Terrain->FinishSpawning(GetActorTransform());
+
+	Job.GameGrid = world->SpawnActorDeferred<AGameGridGenerator>(GameGridGeneratorClass, GetActorTransform());
+	Job.GameGrid->SetupSweep(Job.Terrain);
+	Job.GameGrid->FinishSpawning(GetActorTransform());
+
+	RunningJobs.Add(Job);
+}
+
+void AGameGridSeedSweep::FinishJob(FStructSeedSweepJob& Job)
+{
+	float LandRatio, RiverLength, BlockLevelMean, BuildableRatio;
+	int32 RiverNum, BlockLevelMax, IslandNum;
+	Job.Terrain->GetSweepMetrics(LandRatio, RiverNum, RiverLength, BlockLevelMax, BlockLevelMean);
+	Job.GameGrid->GetSweepMetrics(IslandNum, BuildableRatio);
+
+	FString SetName = ParameterSets[Job.ParameterSetIndex]->GetName();
+	CsvText += FString::Printf(TEXT("%s,%d,%f,%d,%f,%d,%f,%d,%f\n"), *SetName, Job.Seed,
+		LandRatio, RiverNum, RiverLength, IslandNum, BuildableRatio, BlockLevelMax, BlockLevelMean);
+	//Rewrite every run so an interrupted sweep keeps its rows
+	FFileHelper::SaveStringToFile(CsvText, *CsvPath);
+
+	SaveThumbnail(Job.Terrain, FString::Printf(TEXT("%s_%d.png"), *SetName, Job.Seed));
+	UE_LOG(GameGridSeedSweep, Log, TEXT("Seed sweep %s seed %d done."), *SetName, Job.Seed);
+}
+
+void AGameGridSeedSweep::SaveThumbnail(ATerrainGenerator* Terrain, const FString& Name)
+{
+	TArray<FColor> Pixels;
+	Terrain->GetHeightThumbnail(ThumbnailSize, Pixels);
+	TArray64<uint8> Png;
+	FImageUtils::PNGCompressImageArray(ThumbnailSize, ThumbnailSize, Pixels, Png);
+	FFileHelper::SaveArrayToFile(Png, *(FPaths::ProjectSavedDir() / OutputFolder / Name));
+}
+
+void AGameGridSeedSweep::SetSweepTimer()
+{
+	FTimerHandle TimerHandle;
+	GetWorldTimerManager().SetTimer(TimerHandle, SweepDelegate, PollTimerRate, false);
+}
@@ -28,7 +28,6 @@ enum class Enum_GameGridGeneratorState : uint8
 	AddTreeInstances,
 
 	SetGridAreaBlockLevel,
-	SetGridAreaBlockLevelEx,
 
 	CheckAreaConnection,
 	InitCheckAreaConnection,
@@ -38,10 +37,8 @@ enum class Enum_GameGridGeneratorState : uint8
 	FindGridIsland,
 
 	SetGridBuildingBlockLevel,
-	SetGridBuildingBlockLevelEx,
 
 	SetGridFlyingBlockLevel,
-	SetGridFlyingBlockLevelEx,
 
 	FindGridFlyingIsland,
 
@@ -87,24 +84,23 @@ private:
 	//Area Block data
 	int32 AreaBlockLevelMax = 0;
 	TSet<int32> MaxAreaBlockTileIndices;
-	TArray<FStructLoopData> AreaBlockLevelExLoopDatas;
 
 	//Check area connection data
-	TArray<TSet<int32>> MaxAreaBlockTileChunks;
-	TStructBFSData<int32> BreakMABToChunkData = {};// MAB=MaxAreaBlock
+	TArray<TSet<int32>> MaxAreaBlockTileChunks;// MAB=MaxAreaBlock
 
 	//Building Block data
 	int32 BuildingBlockLevelMax = 0;
-	TArray<FStructLoopData> BuildingBlockLevelExLoopDatas;
 
 	//Flying Block data
 	int32 FlyingBlockLevelMax = 0;
-	TArray<FStructLoopData> FlyingBlockLevelExLoopDatas;
 
 	float GridTileInstanceScale = 1.0;
 
 	int32 MouseOverShowRadius = 2;
 
+	//Batch seed sweep: fixed terrain, no trees and no instances
+	bool bSweep = false;
+
 protected:
 	//Mesh
 	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Custom|InstMesh")
@@ -121,8 +117,6 @@ protected:
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Loop")
 	FStructLoopData CreateGridPointsLoopData;
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Loop")
-	FStructLoopData SetGridPosZLoopData;
-	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Loop")
 	FStructLoopData CalGridNormalLoopData;
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Loop")
 	FStructLoopData SetGridTTLoopData;
@@ -131,23 +125,9 @@ protected:
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Loop")
 	FStructLoopData AddTreeInstancesLoopData;
 
-	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Loop")
-	FStructLoopData SetGridAreaBlockLevelLoopData;
-	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Loop")
-	FStructLoopData SetGridAreaBlockLevelExLoopData;
-	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Loop")
-	FStructLoopData BreakMABToChunkLoopData;
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Loop")
 	FStructLoopData FindGridIsLandLoopData;
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Loop")
-	FStructLoopData SetGridBuildingBlockLevelLoopData;
-	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Loop")
-	FStructLoopData SetGridBuildingBlockLevelExLoopData;
-	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Loop")
-	FStructLoopData SetGridFlyingBlockLevelLoopData;
-	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Loop")
-	FStructLoopData SetGridFlyingBlockLevelExLoopData;
-	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Loop")
 	FStructLoopData FindGridFlyingIsLandLoopData;
 
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Loop")
@@ -241,19 +221,13 @@ protected:
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Progress", meta = (ClampMin = "0.0", ClampMax = "1.0"))
 	float ProgressWeight_AddTreeInstances = 0.01f;
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Progress", meta = (ClampMin = "0.0", ClampMax = "1.0"))
-	float ProgressWeight_SetGridAreaBlockLevel = 0.1f;
-	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Progress", meta = (ClampMin = "0.0", ClampMax = "1.0"))
-	float ProgressWeight_SetGridAreaBlockLevelEx = 0.05f;
+	float ProgressWeight_SetGridAreaBlockLevel = 0.15f;
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Progress", meta = (ClampMin = "0.0", ClampMax = "1.0"))
 	float ProgressWeight_FindGridIsland = 0.05f;
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Progress", meta = (ClampMin = "0.0", ClampMax = "1.0"))
-	float ProgressWeight_SetGridBuildingBlockLevel = 0.1f;
+	float ProgressWeight_SetGridBuildingBlockLevel = 0.2f;
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Progress", meta = (ClampMin = "0.0", ClampMax = "1.0"))
-	float ProgressWeight_SetGridBuildingBlockLevelEx = 0.1f;
-	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Progress", meta = (ClampMin = "0.0", ClampMax = "1.0"))
-	float ProgressWeight_SetGridFlyingBlockLevel = 0.1f;
-	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Progress", meta = (ClampMin = "0.0", ClampMax = "1.0"))
-	float ProgressWeight_SetGridFlyingBlockLevelEx = 0.05f;
+	float ProgressWeight_SetGridFlyingBlockLevel = 0.15f;
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Progress", meta = (ClampMin = "0.0", ClampMax = "1.0"))
 	float ProgressWeight_FindGridFlyingIsland = 0.05f;
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Progress", meta = (ClampMin = "0.0", ClampMax = "1.0"))
@@ -281,6 +255,10 @@ public:
 		return bUseGrid;
 	}
 
+	//Call before BeginPlay
+	void SetupSweep(class ATerrainGenerator* InTG);
+	void GetSweepMetrics(int32& OutIslandNum, float& OutBuildableRatio);
+
 protected:
 	// Called when the game starts or when spawned
 	virtual void BeginPlay() override;
@@ -299,10 +277,6 @@ private:
 
 	void InitProgress();
 	void InitLoopData();
-	void InitExLoopDatas(int32 ExTimes, const FStructLoopData& Data, 
-		TArray<FStructLoopData>& Datas);
-	void InitAreaBlockLevelExLoopDatas();
-	void InitBulidingBlockLevelExLoopDatas();
 
 	bool GameGridPointsLoopFunction(TFunction<void()> InitFunc,
 		TFunction<void(int32 LoopIndex)> LoopFunc,
@@ -341,22 +315,17 @@ private:
 	void AddTreeInstanceData(int32 PointIndex, int32 InstanceIndex, const struct FStructTreeRecord& Record);
 
 	void SetGridAreaBlockLevel();
-	void InitSetGridAreaBlockLevel();
+	int32 GetBlockLevelMax(int32 ExTimes);
+	void CalGridBlockLevel(TFunctionRef<bool(int32 Index)> IsBlockFunc,
+		int32 BlockLevelMax, TArray<int32>& OutBlockLevels);
+	void SetBlockLevelStageDone(float ProgressWeight, Enum_GameGridGeneratorState NextState);
 	bool CheckTileBlock(int32 CheckIndex, float UpperRatio, float LowerRatio, float SlopeRatio);
-	bool SetTileAreaBlock(int32 Index, int32 CheckIndex, int32 BlockLevel);
-	void SetTileAreaBlockLevelByNeighbors(int32 Index);
-	bool SetTileAreaBlockLevelByNeighbor(int32 Index, int32 NeighborRangeIndex);
-
-	//Set Area block level extension
-	void SetGridAreaBlockLevelEx();
-	void InitSetGridAreaBlockLevelEx();
-	void SetTileAreaBlockLevelByNeighborsEx(int32 Index);
+	bool IsTileAreaBlock(int32 CheckIndex);
 
 	void CheckAreaConnection();
 	void InitCheckAreaConnection();
 	void BreakMABToChunk();
 	bool NextPoint(const int32& Current, int32& Next, int32& Index);
-	void AddMABChunk();
 	void CheckChunksAreaConnection();
 	bool FindTwoChunksAreaConnection(int32 StartChunkIndex, int32 ObjChunkIndex);
 	bool NextPoint3Pass(const int32& Current, int32& Next, int32& Index, TSet<int32>& Reached);
@@ -367,24 +336,10 @@ private:
 	bool Find_ABLM_By_ABL3(int32 Index);
 
 	void SetGridBuildingBlockLevel();
-	void InitSetGridBuildingBlockLevel();
-	bool SetTileBuildingBlock(int32 Index, int32 CheckIndex, int32 BlockLevel);
-	void SetTileBuildingBlockLevelByNeighbors(int32 Index);
-	bool SetTileBuildingBlockLevelByNeighbor(int32 Index, int32 NeighborRangeIndex);
-
-	void SetGridBuildingBlockLevelEx();
-	void InitSetGridBuildingBlockLevelEx();
-	void SetTileBuildingBlockLevelByNeighborsEx(int32 Index);
+	bool IsTileBuildingBlock(int32 CheckIndex);
 
 	void SetGridFlyingBlockLevel();
-	void InitSetGridFlyingBlockLevel();
-	bool SetTileFlyingBlock(int32 Index, int32 CheckIndex, int32 BlockLevel);
-	void SetTileFlyingBlockLevelByNeighbors(int32 Index);
-	bool SetTileFlyingBlockLevelByNeighbor(int32 Index, int32 NeighborRangeIndex);
-
-	void SetGridFlyingBlockLevelEx();
-	void InitSetGridFlyingBlockLevelEx();
-	void SetTileFlyingBlockLevelByNeighborsEx(int32 Index);
+	bool IsTileFlyingBlock(int32 CheckIndex);
 
 	void FindGridFlyingIsland();
 	void FindTileFlyingIsLand(int32 Index);
@@ -410,6 +365,10 @@ private:
 
 	void DoWorkflowDone();
 
+	//Terraform
+	UFUNCTION()
+	void UpdateModifiedTiles(FBox2D Bounds);
+
 	void FindNeighborTilesByRadius(TArray<FIntPoint>& NeighborTiles, 
 		int32 CenterIndex, int32 Radius);
 
@@ -432,6 +391,9 @@ public:
 		MouseOverShowRadius = Value;
 	}
 
+	UFUNCTION(BlueprintCallable)
+	bool GetTileWaterDistances(FIntPoint AxialCoord, float& OutRiver, float& OutLake, float& OutCoast);
+
 	void AddMouseOverGrid(Hex& MouseOverHex);
 
 	void RemoveMouseOverGrid();
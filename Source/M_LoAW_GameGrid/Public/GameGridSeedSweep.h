@@ -0,0 +1,87 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "GameGridStructDefine.h"
+
+#include "CoreMinimal.h"
+#include "GameFramework/Actor.h"
+#include "GameGridSeedSweep.generated.h"
+
+DECLARE_LOG_CATEGORY_EXTERN(GameGridSeedSweep, Log, All);
+
+/**
+ * Runs terrain and game grid generation for every seed of every parameter set without drawing anything,
+ * writes one csv row and one height thumbnail per run.
+ * Headless run: UnrealEditor-Cmd <project> <map with this actor> -game -nullrhi -unattended
+ */
+UCLASS()
+class M_LOAW_GAMEGRID_API AGameGridSeedSweep : public AActor
+{
+	GENERATED_BODY()
+
+private:
+	FTimerDynamicDelegate SweepDelegate;
+
+	class UGridDataGameInstance* pGI;
+
+	TArray<FStructSeedSweepJob> PendingJobs = {};
+	UPROPERTY()
+	TArray<FStructSeedSweepJob> RunningJobs = {};
+
+	FString CsvPath;
+	FString CsvText;
+	int32 FinishedNum = 0;
+
+protected:
+	//Terrain blueprints to sweep, each one is a parameter set
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Sweep")
+	TArray<TSubclassOf<class ATerrainGenerator>> ParameterSets;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Sweep")
+	TSubclassOf<class AGameGridGenerator> GameGridGeneratorClass;
+	//Seed source, every layer seed is shifted by the sweep seed
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Sweep")
+	class ATerrainNoise* Noise;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Sweep")
+	int32 SeedStart = 0;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Sweep", meta = (ClampMin = "1"))
+	int32 SeedNum = 16;
+	//Runs in flight at once, terrain data stages of each run use their own worker thread
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Sweep", meta = (ClampMin = "1"))
+	int32 MaxParallel = 4;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Output", meta = (ClampMin = "1"))
+	int32 ThumbnailSize = 256;
+	//Relative to the project saved dir
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Output")
+	FString OutputFolder = TEXT("SeedSweep");
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Output")
+	bool bQuitWhenDone = true;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Timer")
+	float PollTimerRate = 0.1f;
+
+public:
+	// Sets default values for this actor's properties
+	AGameGridSeedSweep();
+
+protected:
+	// Called when the game starts or when spawned
+	virtual void BeginPlay() override;
+
+public:
+	// Called every frame
+	virtual void Tick(float DeltaTime) override;
+
+private:
+	UFUNCTION()
+	void DoSweep();
+
+	bool InitSweep();
+	void StartJob(const FStructSeedSweepJob& InJob);
+	void FinishJob(FStructSeedSweepJob& Job);
+	void SaveThumbnail(ATerrainGenerator* Terrain, const FString& Name);
+	void SetSweepTimer();
+
+};
@@ -80,8 +80,36 @@ struct FStructGameGridPointData
 	UPROPERTY(BlueprintReadOnly)
 	float TerrainTypeEdgeRatio = 1.0;
 
+	//Euclidean distance from the tile center, TNumericLimits<float>::Max() when there is no such water
+	UPROPERTY(BlueprintReadOnly)
+	float RiverDistance = TNumericLimits<float>::Max();
+
+	UPROPERTY(BlueprintReadOnly)
+	float LakeDistance = TNumericLimits<float>::Max();
+
+	UPROPERTY(BlueprintReadOnly)
+	float CoastDistance = TNumericLimits<float>::Max();
+
 	UPROPERTY(BlueprintReadOnly)
 	TArray<FStructTreeRecord> TreeRecords = {};
 
 };
 
+USTRUCT()
+struct FStructSeedSweepJob
+{
+	GENERATED_BODY()
+
+	UPROPERTY()
+	int32 ParameterSetIndex = 0;
+
+	UPROPERTY()
+	int32 Seed = 0;
+
+	UPROPERTY()
+	class ATerrainGenerator* Terrain = nullptr;
+
+	UPROPERTY()
+	class AGameGridGenerator* GameGrid = nullptr;
+
+};
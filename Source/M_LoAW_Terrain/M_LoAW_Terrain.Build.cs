@@ -8,9 +8,9 @@ public class M_LoAW_Terrain : ModuleRules
 	{
 		PCHUsage = PCHUsageMode.UseExplicitOrSharedPCHs;
 	
-		PublicDependencyModuleNames.AddRange(new string[] { "Core", "CoreUObject", "Engine", "InputCore", "EnhancedInput" });
+		PublicDependencyModuleNames.AddRange(new string[] { "Core", "CoreUObject", "Engine", "InputCore", "EnhancedInput", "ProceduralMeshComponent" });
 
-		PrivateDependencyModuleNames.AddRange(new string[] { "M_LoAW_GridData", "FastNoiseGenerator", "FastNoise", "ProceduralMeshComponent", "Niagara" });
+		PrivateDependencyModuleNames.AddRange(new string[] { "M_LoAW_GridData", "FastNoiseGenerator", "FastNoise", "Niagara" });
 
 		// Uncomment if you are using Slate UI
 		// PrivateDependencyModuleNames.AddRange(new string[] { "Slate", "SlateCore" });
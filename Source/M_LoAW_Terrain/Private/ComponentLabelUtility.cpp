@@ -0,0 +1,140 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "ComponentLabelUtility.h"
+
+ComponentLabelUtility::ComponentLabelUtility()
+{
+}
+
+ComponentLabelUtility::~ComponentLabelUtility()
+{
+}
+
+int32 ComponentLabelUtility::LabelComponents(int32 Num,
+	TFunctionRef<bool(int32 Index)> InComponent,
+	TFunctionRef<bool(const int32& Current, int32& Next, int32& Index)> NextFunc,
+	TArray<int32>& OutLabels)
+{
+	OutLabels.Init(INDEX_NONE, Num);
+
+	TArray<bool> Inside;
+	Inside.SetNumUninitialized(Num);
+	TArray<int32> Parents;
+	Parents.SetNumUninitialized(Num);
+	TArray<int32> Sizes;
+	Sizes.Init(1, Num);
+	for (int32 i = 0; i < Num; i++)
+	{
+		Inside[i] = InComponent(i);
+		Parents[i] = i;
+	}
+
+	for (int32 i = 0; i < Num; i++)
+	{
+		if (!Inside[i]) {
+			continue;
+		}
+		int32 Next = INDEX_NONE;
+		int32 Index = 0;
+		while (NextFunc(i, Next, Index)) {
+			//Each edge is seen from both ends, join it once
+			if (Next != INDEX_NONE && Next > i && Inside[Next]) {
+				Union(Parents, Sizes, i, Next);
+			}
+			Next = INDEX_NONE;
+		}
+	}
+
+	//Roots get dense ids in scan order
+	int32 ComponentNum = 0;
+	for (int32 i = 0; i < Num; i++)
+	{
+		if (!Inside[i]) {
+			continue;
+		}
+		int32 Root = FindRoot(Parents, i);
+		if (OutLabels[Root] == INDEX_NONE) {
+			OutLabels[Root] = ComponentNum++;
+		}
+		OutLabels[i] = OutLabels[Root];
+	}
+	return ComponentNum;
+}
+
+void ComponentLabelUtility::CalComponentStats(const TArray<int32>& Labels, int32 ComponentNum,
+	TFunctionRef<FIntPoint(int32 Index)> GetCoord,
+	TFunctionRef<float(int32 Index)> GetScore,
+	TArray<FStructComponentStats>& OutStats)
+{
+	OutStats.Reset();
+	OutStats.SetNum(ComponentNum);
+	for (int32 i = 0; i < Labels.Num(); i++)
+	{
+		if (Labels[i] == INDEX_NONE) {
+			continue;
+		}
+		FStructComponentStats& Stats = OutStats[Labels[i]];
+		FIntPoint Coord = GetCoord(i);
+		float Score = GetScore(i);
+
+		Stats.Size++;
+		Stats.Centroid += FVector2D(Coord);
+		Stats.BoundsMin.X = FMath::Min(Stats.BoundsMin.X, Coord.X);
+		Stats.BoundsMin.Y = FMath::Min(Stats.BoundsMin.Y, Coord.Y);
+		Stats.BoundsMax.X = FMath::Max(Stats.BoundsMax.X, Coord.X);
+		Stats.BoundsMax.Y = FMath::Max(Stats.BoundsMax.Y, Coord.Y);
+		if (Stats.Representative == INDEX_NONE || Score > Stats.RepresentativeScore) {
+			Stats.Representative = i;
+			Stats.RepresentativeScore = Score;
+		}
+	}
+	for (FStructComponentStats& Stats : OutStats)
+	{
+		if (Stats.Size > 0) {
+			Stats.Centroid /= (double)Stats.Size;
+		}
+	}
+}
+
+int32 ComponentLabelUtility::FindComponents(int32 Num,
+	TFunctionRef<bool(int32 Index)> InComponent,
+	TFunctionRef<bool(const int32& Current, int32& Next, int32& Index)> NextFunc,
+	TFunctionRef<FIntPoint(int32 Index)> GetCoord,
+	TFunctionRef<float(int32 Index)> GetScore,
+	TArray<int32>& OutLabels,
+	TArray<FStructComponentStats>& OutStats)
+{
+	int32 ComponentNum = LabelComponents(Num, InComponent, NextFunc, OutLabels);
+	CalComponentStats(OutLabels, ComponentNum, GetCoord, GetScore, OutStats);
+	return ComponentNum;
+}
+
+void ComponentLabelUtility::SortComponentsBySize(const TArray<FStructComponentStats>& Stats, TArray<int32>& OutOrder)
+{
+	OutOrder.Reset(Stats.Num());
+	for (int32 i = 0; i < Stats.Num(); i++)
+	{
+		OutOrder.Add(i);
+	}
+	OutOrder.Sort([&Stats](int32 A, int32 B) {
+		if (Stats[A].Size != Stats[B].Size) {
+			return Stats[A].Size > Stats[B].Size;
+		}
+		return A < B;
+		});
+}
+
+void ComponentLabelUtility::Union(TArray<int32>& Parents, TArray<int32>& Sizes, int32 A, int32 B)
+{
+	int32 RootA = FindRoot(Parents, A);
+	int32 RootB = FindRoot(Parents, B);
+	if (RootA == RootB) {
+		return;
+	}
+	if (Sizes[RootA] < Sizes[RootB]) {
+		Swap(RootA, RootB);
+	}
+	Parents[RootB] = RootA;
+	Sizes[RootA] += Sizes[RootB];
+}
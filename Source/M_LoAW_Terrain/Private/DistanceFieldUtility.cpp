@@ -0,0 +1,94 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "DistanceFieldUtility.h"
+#include "Async/ParallelFor.h"
+
+namespace
+{
+	//Large enough to never win against a real seed, small enough to keep the envelope math finite
+	constexpr double DistanceFieldInf = 1e20;
+}
+
+DistanceFieldUtility::DistanceFieldUtility()
+{
+}
+
+DistanceFieldUtility::~DistanceFieldUtility()
+{
+}
+
+void DistanceFieldUtility::DistanceTransform(int32 SizeX, int32 SizeY, const TBitArray<>& Seeds, TArray<float>& OutDistances)
+{
+	int32 Total = SizeX * SizeY;
+	OutDistances.Init(TNumericLimits<float>::Max(), Total);
+	if (Total <= 0 || Seeds.Find(true) == INDEX_NONE) {
+		return;
+	}
+
+	TArray<double> Squared;
+	Squared.SetNumUninitialized(Total);
+	for (int32 i = 0; i < Total; i++)
+	{
+		Squared[i] = Seeds[i] ? 0.0 : DistanceFieldInf;
+	}
+
+	//Columns then rows, every line only touches its own cells
+	auto TransformLines = [&Squared](int32 LineNum, int32 LineLength, int32 LineStep, int32 Stride) {
+		ParallelFor(LineNum, [&](int32 Line) {
+			TArray<double> F;
+			TArray<int32> V;
+			TArray<double> Z;
+			F.SetNumUninitialized(LineLength);
+			V.SetNumUninitialized(LineLength);
+			Z.SetNumUninitialized(LineLength + 1);
+			DistanceTransform1D(Squared.GetData() + Line * LineStep, LineLength, Stride, F.GetData(), V.GetData(), Z.GetData());
+			});
+		};
+	TransformLines(SizeX, SizeY, 1, SizeX);
+	TransformLines(SizeY, SizeX, SizeX, 1);
+
+	for (int32 i = 0; i < Total; i++)
+	{
+		if (Squared[i] < DistanceFieldInf * 0.5) {
+			OutDistances[i] = FMath::Sqrt(Squared[i]);
+		}
+	}
+}
+
+void DistanceFieldUtility::DistanceTransform1D(double* Data, int32 Num, int32 Stride, double* F, int32* V, double* Z)
+{
+	for (int32 q = 0; q < Num; q++)
+	{
+		F[q] = Data[q * Stride];
+	}
+
+	//Lower envelope of the parabolas rooted at every cell
+	int32 k = 0;
+	V[0] = 0;
+	Z[0] = -DistanceFieldInf;
+	Z[1] = DistanceFieldInf;
+	for (int32 q = 1; q < Num; q++)
+	{
+		//Z[0] is below any crossing, so k never drops under 0
+		double s = Intersect(F, q, V[k]);
+		while (s <= Z[k]) {
+			k--;
+			s = Intersect(F, q, V[k]);
+		}
+		k++;
+		V[k] = q;
+		Z[k] = s;
+		Z[k + 1] = DistanceFieldInf;
+	}
+
+	k = 0;
+	for (int32 q = 0; q < Num; q++)
+	{
+		while (Z[k + 1] < q) {
+			k++;
+		}
+		double Dist = q - V[k];
+		Data[q * Stride] = Dist * Dist + F[V[k]];
+	}
+}
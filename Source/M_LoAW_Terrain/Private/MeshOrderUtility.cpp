@@ -0,0 +1,157 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "MeshOrderUtility.h"
+
+MeshOrderUtility::MeshOrderUtility()
+{
+}
+
+MeshOrderUtility::~MeshOrderUtility()
+{
+}
+
+void MeshOrderUtility::SortByMortonCode(const TArray<FIntPoint>& Coords, TArray<int32>& OutOrder)
+{
+	FIntPoint CoordMin(MAX_int32, MAX_int32);
+	for (const FIntPoint& Coord : Coords)
+	{
+		CoordMin = CoordMin.ComponentMin(Coord);
+	}
+
+	TArray<uint32> Codes;
+	Codes.SetNumUninitialized(Coords.Num());
+	OutOrder.SetNumUninitialized(Coords.Num());
+	for (int32 i = 0; i < Coords.Num(); i++)
+	{
+		FIntPoint Coord = Coords[i] - CoordMin;
+		Codes[i] = MortonCode(Coord.X, Coord.Y);
+		OutOrder[i] = i;
+	}
+	OutOrder.Sort([&Codes](int32 A, int32 B) {
+		return Codes[A] < Codes[B] || (Codes[A] == Codes[B] && A < B);
+		});
+}
+
+void MeshOrderUtility::OptimizeTriangleOrder(TArray<int32>& InOutTriangles, int32 VertexNum)
+{
+	int32 TriangleNum = InOutTriangles.Num() / 3;
+	if (TriangleNum < 2) {
+		return;
+	}
+
+	//Triangles of each vertex packed by Offsets, the first RemainingNums[v] are not drawn yet
+	TArray<int32> Offsets;
+	Offsets.Init(0, VertexNum + 1);
+	for (int32 i = 0; i < TriangleNum * 3; i++)
+	{
+		Offsets[InOutTriangles[i] + 1]++;
+	}
+	for (int32 v = 0; v < VertexNum; v++)
+	{
+		Offsets[v + 1] += Offsets[v];
+	}
+	TArray<int32> RemainingNums;
+	RemainingNums.Init(0, VertexNum);
+	TArray<int32> VertexTriangles;
+	VertexTriangles.SetNumUninitialized(TriangleNum * 3);
+	for (int32 i = 0; i < TriangleNum * 3; i++)
+	{
+		int32 v = InOutTriangles[i];
+		VertexTriangles[Offsets[v] + RemainingNums[v]++] = i / 3;
+	}
+
+	TArray<float> VertexScores;
+	VertexScores.SetNumUninitialized(VertexNum);
+	for (int32 v = 0; v < VertexNum; v++)
+	{
+		VertexScores[v] = GetVertexScore(INDEX_NONE, RemainingNums[v]);
+	}
+	auto GetTriangleScore = [&](int32 t) {
+		return VertexScores[InOutTriangles[t * 3]] + VertexScores[InOutTriangles[t * 3 + 1]]
+			+ VertexScores[InOutTriangles[t * 3 + 2]];
+		};
+
+	TBitArray<> Drawn(false, TriangleNum);
+	TArray<int32> Output;
+	Output.Reserve(TriangleNum * 3);
+	TArray<int32> Cache;
+	Cache.Reserve(CacheSize + 3);
+	TArray<int32> NewCache;
+	NewCache.Reserve(CacheSize + 3);
+	int32 BestTriangle = INDEX_NONE;
+	int32 ScanIndex = 0;
+	for (int32 DrawnNum = 0; DrawnNum < TriangleNum; DrawnNum++)
+	{
+		//Nothing around the cache is left, restart from the next triangle not drawn
+		if (BestTriangle == INDEX_NONE) {
+			while (Drawn[ScanIndex]) {
+				ScanIndex++;
+			}
+			BestTriangle = ScanIndex;
+		}
+		Drawn[BestTriangle] = true;
+
+		NewCache.Reset();
+		for (int32 k = 0; k < 3; k++)
+		{
+			int32 v = InOutTriangles[BestTriangle * 3 + k];
+			Output.Add(v);
+			NewCache.AddUnique(v);
+			int32* Triangles = &VertexTriangles[Offsets[v]];
+			for (int32 i = 0; i < RemainingNums[v]; i++)
+			{
+				if (Triangles[i] == BestTriangle) {
+					Swap(Triangles[i], Triangles[--RemainingNums[v]]);
+					break;
+				}
+			}
+		}
+		for (int32 v : Cache)
+		{
+			if (!NewCache.Contains(v)) {
+				NewCache.Add(v);
+			}
+		}
+		for (int32 i = 0; i < NewCache.Num(); i++)
+		{
+			int32 v = NewCache[i];
+			VertexScores[v] = GetVertexScore(i < CacheSize ? i : INDEX_NONE, RemainingNums[v]);
+		}
+		NewCache.SetNum(FMath::Min(NewCache.Num(), CacheSize), EAllowShrinking::No);
+		Swap(Cache, NewCache);
+
+		BestTriangle = INDEX_NONE;
+		float BestScore = -1.0;
+		for (int32 v : Cache)
+		{
+			for (int32 i = 0; i < RemainingNums[v]; i++)
+			{
+				int32 t = VertexTriangles[Offsets[v] + i];
+				float Score = GetTriangleScore(t);
+				if (Score > BestScore) {
+					BestScore = Score;
+					BestTriangle = t;
+				}
+			}
+		}
+	}
+
+	InOutTriangles = MoveTemp(Output);
+}
+
+float MeshOrderUtility::GetVertexScore(int32 CachePosition, int32 RemainingNum)
+{
+	if (RemainingNum == 0) {
+		return -1.0;
+	}
+	float Score = 0.0;
+	//The last triangle's vertices get a fixed score so the same triangle is not favored twice
+	if (CachePosition >= 0 && CachePosition < 3) {
+		Score = 0.75;
+	}
+	else if (CachePosition >= 3) {
+		Score = FMath::Pow(1.0 - (float)(CachePosition - 3) / (float)(CacheSize - 3), 1.5);
+	}
+	return Score + 2.0 * FMath::InvSqrt((float)RemainingNum);
+}
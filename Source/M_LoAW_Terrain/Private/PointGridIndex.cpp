@@ -0,0 +1,149 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "PointGridIndex.h"
+
+PointGridIndex::PointGridIndex()
+{
+}
+
+PointGridIndex::PointGridIndex(int32 InCellSize)
+{
+	CellSize = FMath::Max(1, InCellSize);
+}
+
+PointGridIndex::~PointGridIndex()
+{
+}
+
+void PointGridIndex::Add(int32 Id, const FIntPoint& Coord)
+{
+	FIntPoint Cell = GetCell(Coord);
+	FEntry Entry;
+	Entry.Id = Id;
+	Entry.Coord = Coord;
+	Cells.FindOrAdd(Cell).Add(Entry);
+	Num++;
+
+	CellMin.X = FMath::Min(CellMin.X, Cell.X);
+	CellMin.Y = FMath::Min(CellMin.Y, Cell.Y);
+	CellMax.X = FMath::Max(CellMax.X, Cell.X);
+	CellMax.Y = FMath::Max(CellMax.Y, Cell.Y);
+}
+
+bool PointGridIndex::Remove(int32 Id, const FIntPoint& Coord)
+{
+	TArray<FEntry>* Cell = Cells.Find(GetCell(Coord));
+	if (Cell == nullptr) {
+		return false;
+	}
+	int32 Removed = Cell->RemoveAll([Id](const FEntry& Entry) { return Entry.Id == Id; });
+	Num -= Removed;
+	return Removed > 0;
+}
+
+void PointGridIndex::QueryRadius(const FIntPoint& Center, int32 Radius, TArray<int32>& OutIds) const
+{
+	OutIds.Reset();
+	if (Radius < 0) {
+		return;
+	}
+	FIntPoint Low = GetCell(Center - FIntPoint(Radius, Radius));
+	FIntPoint High = GetCell(Center + FIntPoint(Radius, Radius));
+	for (int32 X = Low.X; X <= High.X; X++)
+	{
+		for (int32 Y = Low.Y; Y <= High.Y; Y++)
+		{
+			const TArray<FEntry>* Cell = Cells.Find(FIntPoint(X, Y));
+			if (Cell == nullptr) {
+				continue;
+			}
+			for (const FEntry& Entry : *Cell)
+			{
+				if (Distance(Center, Entry.Coord) <= Radius) {
+					OutIds.Add(Entry.Id);
+				}
+			}
+		}
+	}
+	OutIds.Sort();
+}
+
+bool PointGridIndex::HasPointInRadius(const FIntPoint& Center, int32 Radius) const
+{
+	TArray<int32> Ids;
+	QueryRadius(Center, Radius, Ids);
+	return !Ids.IsEmpty();
+}
+
+void PointGridIndex::FindNearest(const FIntPoint& Center, int32 K, int32 MinDistance, TArray<int32>& OutIds) const
+{
+	OutIds.Reset();
+	if (K <= 0 || Num == 0) {
+		return;
+	}
+
+	//Best candidates as (distance, id), kept sorted
+	TArray<FIntPoint> Best;
+	auto TryAdd = [&](const TArray<FEntry>& Cell) {
+		for (const FEntry& Entry : Cell)
+		{
+			int32 D = Distance(Center, Entry.Coord);
+			if (D < MinDistance) {
+				continue;
+			}
+			FIntPoint Candidate(D, Entry.Id);
+			if (Best.Num() == K) {
+				const FIntPoint& Worst = Best.Last();
+				if (D > Worst.X || (D == Worst.X && Entry.Id > Worst.Y)) {
+					continue;
+				}
+				Best.Pop(EAllowShrinking::No);
+			}
+			int32 i = 0;
+			while (i < Best.Num() && (Best[i].X < D || (Best[i].X == D && Best[i].Y < Entry.Id))) {
+				i++;
+			}
+			Best.Insert(Candidate, i);
+		}
+		};
+
+	FIntPoint CenterCell = GetCell(Center);
+	int32 MaxRing = GetMaxRing(CenterCell);
+
+	//Rings whose farthest point is still closer than MinDistance can be skipped
+	int32 Ring = 0;
+	while (Ring < MaxRing && 2 * ((Ring + 1) * CellSize - 1) < MinDistance) {
+		Ring++;
+	}
+
+	for (; Ring <= MaxRing; Ring++)
+	{
+		//Every point in this ring is at least (Ring - 1) * CellSize + 1 away
+		int32 RingLowerBound = Ring == 0 ? 0 : (Ring - 1) * CellSize + 1;
+		if (Best.Num() == K && RingLowerBound > Best.Last().X) {
+			break;
+		}
+		ForEachCellInRing(CenterCell, Ring, TryAdd);
+	}
+
+	for (const FIntPoint& Candidate : Best)
+	{
+		OutIds.Add(Candidate.Y);
+	}
+}
+
+FIntPoint PointGridIndex::GetCell(const FIntPoint& Coord) const
+{
+	return FIntPoint(FloorDiv(Coord.X, CellSize), FloorDiv(Coord.Y, CellSize));
+}
+
+int32 PointGridIndex::GetMaxRing(const FIntPoint& CenterCell) const
+{
+	if (Num == 0) {
+		return 0;
+	}
+	int32 RingX = FMath::Max(FMath::Abs(CellMin.X - CenterCell.X), FMath::Abs(CellMax.X - CenterCell.X));
+	int32 RingY = FMath::Max(FMath::Abs(CellMin.Y - CenterCell.Y), FMath::Abs(CellMax.Y - CenterCell.Y));
+	return FMath::Max(RingX, RingY);
+}
@@ -0,0 +1,90 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "TerrainCacheUtility.h"
+#include "Curves/CurveFloat.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Misc/SecureHash.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+#include "UObject/UnrealType.h"
+
+TerrainCacheUtility::TerrainCacheUtility()
+{
+}
+
+TerrainCacheUtility::~TerrainCacheUtility()
+{
+}
+
+void TerrainCacheUtility::AppendProperties(const UStruct* Struct, const void* Container, bool EditableOnly, FString& OutText,
+	TFunction<bool(const FProperty* Property)> Filter)
+{
+	for (TFieldIterator<FProperty> It(Struct); It; ++It)
+	{
+		const FProperty* Property = *It;
+		if (EditableOnly && (!Property->HasAnyPropertyFlags(CPF_Edit) || Property->HasAnyPropertyFlags(CPF_EditConst))) {
+			continue;
+		}
+		if (Filter && !Filter(Property)) {
+			continue;
+		}
+
+		OutText.Append(Property->GetName()).AppendChar(TEXT('='));
+		if (const FObjectPropertyBase* ObjectProperty = CastField<FObjectPropertyBase>(Property)) {
+			const UCurveFloat* Curve = Cast<UCurveFloat>(ObjectProperty->GetObjectPropertyValue_InContainer(Container));
+			if (Curve) {
+				for (const FRichCurveKey& Key : Curve->FloatCurve.GetConstRefOfKeys())
+				{
+					OutText.Appendf(TEXT("(%d,%.9g,%.9g,%.9g,%.9g)"), (int32)Key.InterpMode,
+						Key.Time, Key.Value, Key.ArriveTangent, Key.LeaveTangent);
+				}
+			}
+		}
+		else {
+			FString Value;
+			Property->ExportText_InContainer(0, Value, Container, nullptr, nullptr, PPF_None);
+			OutText.Append(Value);
+		}
+		OutText.AppendChar(TEXT(';'));
+	}
+}
+
+FString TerrainCacheUtility::HashText(const FString& Text)
+{
+	FTCHARToUTF8 Utf8(*Text);
+	FSHA1 Sha;
+	Sha.Update((const uint8*)Utf8.Get(), Utf8.Length());
+	Sha.Final();
+	uint8 Hash[FSHA1::DigestSize];
+	Sha.GetHash(Hash);
+	return BytesToHex(Hash, FSHA1::DigestSize);
+}
+
+FString TerrainCacheUtility::GetCachePath(const FString& Folder, const FString& Key)
+{
+	return FPaths::Combine(FPaths::ProjectSavedDir(), Folder, Key + TEXT(".bin"));
+}
+
+bool TerrainCacheUtility::SaveStruct(const FString& Path, const UScriptStruct* Struct, void* Data)
+{
+	TArray<uint8> Bytes;
+	FMemoryWriter Writer(Bytes, true);
+	Struct->SerializeBin(Writer, Data);
+	if (Writer.IsError()) {
+		return false;
+	}
+	return FFileHelper::SaveArrayToFile(Bytes, *Path);
+}
+
+bool TerrainCacheUtility::LoadStruct(const FString& Path, const UScriptStruct* Struct, void* Data)
+{
+	TArray<uint8> Bytes;
+	if (!FFileHelper::LoadFileToArray(Bytes, *Path, FILEREAD_Silent)) {
+		return false;
+	}
+	FMemoryReader Reader(Bytes, true);
+	Struct->SerializeBin(Reader, Data);
+	return !Reader.IsError() && Reader.AtEnd();
+}
@@ -4,15 +4,30 @@
 #include "TerrainGenerator.h"
 #include "TerrainNoise.h"
 #include "ProceduralMeshComponent.h"
+#include "Async/Async.h"
+#include "Async/ParallelFor.h"
+#include "Curves/CurveFloat.h"
 #include "M_LoAW_GridData/Public/FlowControlUtility.h"
 #include "Kismet/KismetMaterialLibrary.h"
 #include "Kismet/GameplayStatics.h"
+#include "Camera/PlayerCameraManager.h"
+#include "PhysicsEngine/BodySetup.h"
 #include "M_LoAW_GridData/Public/Quad.h"
 #include "AStarUtility.h"
+#include "PointGridIndex.h"
+#include "ComponentLabelUtility.h"
+#include "TerrainHydrology.h"
+#include "DistanceFieldUtility.h"
+#include "TerrainLODSelector.h"
+#include "MeshOrderUtility.h"
+#include "TerrainCacheUtility.h"
 #include "M_LoAW_GridData/Public/GridDataGameInstance.h"
 
 DEFINE_LOG_CATEGORY(TerrainGenerator);
 
+//Bump whenever a change to the generation code changes its output
+#define TERRAIN_CACHE_VERSION 4
+
 // Sets default values
 ATerrainGenerator::ATerrainGenerator()
 {
@@ -44,15 +59,22 @@ void ATerrainGenerator::BeginPlay()
 void ATerrainGenerator::BindDelegate()
 {
 	WorkflowDelegate.BindUFunction(Cast<UObject>(this), TEXT("DoWorkFlow"));
+	LandLODDelegate.BindUFunction(Cast<UObject>(this), TEXT("UpdateLandLOD"));
+	CollisionDelegate.BindUFunction(Cast<UObject>(this), TEXT("UpdateCollisionReady"));
 }
 
 void ATerrainGenerator::DoWorkFlow()
 {
+	UpdateStageCache();
+
 	switch (WorkflowState)
 	{
 	case Enum_TerrainGeneratorState::InitWorkflow:
 		InitWorkflow();
 		break;
+	case Enum_TerrainGeneratorState::CreatePreview:
+		CreatePreview();
+		break;
 	case Enum_TerrainGeneratorState::CreateVertices:
 		CreateVertices();
 		break;
@@ -62,14 +84,9 @@ void ATerrainGenerator::DoWorkFlow()
 	case Enum_TerrainGeneratorState::SetBlockLevel:
 		SetBlockLevel();
 		break;
-	case Enum_TerrainGeneratorState::SetBlockLevelEx:
-		SetBlockLevelEx();
-		break;
 	case Enum_TerrainGeneratorState::CreateRiver:
-	case Enum_TerrainGeneratorState::AddRiverEndPoints:
-	case Enum_TerrainGeneratorState::DivideUpperRiver:
-	case Enum_TerrainGeneratorState::DivideLowerRiver:
-	case Enum_TerrainGeneratorState::ChunkToOnePoint:
+	case Enum_TerrainGeneratorState::DivideRiverEndPoints:
+	case Enum_TerrainGeneratorState::CreateFlowRiverLines:
 	case Enum_TerrainGeneratorState::CreateRiverLine:
 	case Enum_TerrainGeneratorState::FindRiverLines:
 	case Enum_TerrainGeneratorState::DigRiverLine:
@@ -83,17 +100,29 @@ void ATerrainGenerator::DoWorkFlow()
 	case Enum_TerrainGeneratorState::CreateTriangles:
 		CreateTriangles();
 		break;
-	case Enum_TerrainGeneratorState::CalNormalsInit:
-	case Enum_TerrainGeneratorState::CalNormalsAcc:
-	case Enum_TerrainGeneratorState::NormalizeNormals:
-		CreateNormals();
+	case Enum_TerrainGeneratorState::CalNormals:
+		CalNormals();
+		break;
+	case Enum_TerrainGeneratorState::FindLakes:
+		FindLakes();
+		break;
+	case Enum_TerrainGeneratorState::SaveTerrainCache:
+		SaveTerrainCache();
 		break;
 	case Enum_TerrainGeneratorState::DrawLandMesh:
+		BuildHeightfield();
+		BuildWaterDistances();
+		if (IsHeadless) {
+			WorkflowState = Enum_TerrainGeneratorState::Done;
+			SetWorkflowTimer(DefaultTimerRate);
+			break;
+		}
 		CreateTerrainMesh();
 		SetTerrainMaterial();
 		WorkflowState = Enum_TerrainGeneratorState::CreateWater;
 	case Enum_TerrainGeneratorState::CreateWater:
 		CreateWater();
+		WaitCollision();
 		WorkflowState = Enum_TerrainGeneratorState::CreateWaterfall;
 	case Enum_TerrainGeneratorState::CreateWaterfall:
 		CreateWaterfall();
@@ -112,13 +141,15 @@ void ATerrainGenerator::DoWorkFlow()
 
 void ATerrainGenerator::InitWorkflow()
 {
-	FTimerHandle TimerHandle;
 	if (!GetGameInstance() || !InitNoise() || !CheckMaterialSetting()) {
 		WorkflowState = Enum_TerrainGeneratorState::Error;
-		GetWorldTimerManager().SetTimer(TimerHandle, WorkflowDelegate, DefaultTimerRate, false);
+		SetWorkflowTimer(DefaultTimerRate);
 		return;
 	}
 
+	//Key first, InitLoopData may change loop limits for the background workflow
+	InitTerrainCacheKey();
+	InitStageCacheKeys();
 	InitTileParameter();
 	InitLoopData();
 	InitReceiveDecal();
@@ -126,8 +157,81 @@ void ATerrainGenerator::InitWorkflow()
 	InitWater();
 	InitProgress();
 
-	WorkflowState = Enum_TerrainGeneratorState::CreateVertices;
-	GetWorldTimerManager().SetTimer(TimerHandle, WorkflowDelegate, DefaultTimerRate, false);
+	if (LoadTerrainCache()) {
+		ProgressPassed = 1.f;
+		Progress = ProgressPassed;
+		WorkflowState = Enum_TerrainGeneratorState::DrawLandMesh;
+	}
+	else if (UseProgressivePreview) {
+		PreviewPassIndex = 0;
+		WorkflowState = Enum_TerrainGeneratorState::CreatePreview;
+	}
+	else {
+		WorkflowState = Enum_TerrainGeneratorState::CreateVertices;
+	}
+
+	if (UseBackgroundWorkflow && WorkflowState < Enum_TerrainGeneratorState::DrawLandMesh) {
+		StartBackgroundWorkflow();
+		return;
+	}
+	SetWorkflowTimer(DefaultTimerRate);
+}
+
+void ATerrainGenerator::SetWorkflowTimer(float Rate)
+{
+	//The background workflow runs its stages back to back
+	if (IsRunningInBackground) {
+		return;
+	}
+	FTimerHandle TimerHandle;
+	GetWorldTimerManager().SetTimer(TimerHandle, WorkflowDelegate, Rate, false);
+}
+
+void ATerrainGenerator::StartBackgroundWorkflow()
+{
+	IsRunningInBackground = true;
+	StopBackgroundWorkflow = false;
+	BackgroundWorkflow = Async(EAsyncExecution::Thread, [this]() { RunBackgroundWorkflow(); });
+	UE_LOG(TerrainGenerator, Log, TEXT("Start background workflow."));
+}
+
+void ATerrainGenerator::RunBackgroundWorkflow()
+{
+	//Data stages only touch plain arrays, everything from DrawLandMesh on needs the game thread
+	while (!StopBackgroundWorkflow && WorkflowState < Enum_TerrainGeneratorState::DrawLandMesh) {
+		DoWorkFlow();
+	}
+	if (StopBackgroundWorkflow) {
+		return;
+	}
+
+	TWeakObjectPtr<ATerrainGenerator> WeakThis(this);
+	AsyncTask(ENamedThreads::GameThread, [WeakThis]() {
+		if (WeakThis.IsValid()) {
+			WeakThis->CommitBackgroundWorkflow();
+		}
+		});
+}
+
+void ATerrainGenerator::CommitBackgroundWorkflow()
+{
+	IsRunningInBackground = false;
+	UE_LOG(TerrainGenerator, Log, TEXT("Background workflow done."));
+	DoWorkFlow();
+}
+
+void ATerrainGenerator::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	if (BackgroundWorkflow.IsValid()) {
+		StopBackgroundWorkflow = true;
+		BackgroundWorkflow.Wait();
+	}
+	//The sweep noise copy belongs to this generator
+	if (IsHeadless && Noise) {
+		Noise->Destroy();
+		Noise = nullptr;
+	}
+	Super::EndPlay(EndPlayReason);
 }
 
 bool ATerrainGenerator::GetGameInstance()
@@ -179,31 +283,16 @@ void ATerrainGenerator::InitLoopData()
 	FlowControlUtility::InitLoopData(CreateVerticesLoopData);
 	FlowControlUtility::InitLoopData(ReMappingZLoopData);
 
-	FlowControlUtility::InitLoopData(SetBlockLevelLoopData);
-	FlowControlUtility::InitLoopData(SetBlockLevelExLoopData);
-	InitBlockLevelExLoopDatas();
-
-	FlowControlUtility::InitLoopData(AddRiverEndPointsLoopData);
-	FlowControlUtility::InitLoopData(UpperRiverDivideLoopData);
-	FlowControlUtility::InitLoopData(LowerRiverDivideLoopData);
-	FlowControlUtility::InitLoopData(FindRiverLinesLoopData);
-	FlowControlUtility::InitLoopData(DigRiverLineLoopData);
-	FlowControlUtility::InitLoopData(DigRiverPoolLoopData);
-	
 	FlowControlUtility::InitLoopData(CreateVertexColorsForAMTBLoopData);
 
 	FlowControlUtility::InitLoopData(CreateTrianglesLoopData);
-	FlowControlUtility::InitLoopData(CalNormalsInitLoopData);
-	FlowControlUtility::InitLoopData(CalNormalsAccLoopData);
-	FlowControlUtility::InitLoopData(NormalizeNormalsLoopData);
-}
 
-void ATerrainGenerator::InitBlockLevelExLoopDatas()
-{
-	for (int32 i = 0; i < BlockExTimes; i++)
-	{
-		FStructLoopData LoopData(SetBlockLevelExLoopData);
-		BlockLevelExLoopDatas.Add(LoopData);
+	//Off the game thread there is no frame to yield to, loops run in one go
+	if (UseBackgroundWorkflow) {
+		CreateVerticesLoopData.LoopCountLimit = MAX_int32;
+		ReMappingZLoopData.LoopCountLimit = MAX_int32;
+		CreateVertexColorsForAMTBLoopData.LoopCountLimit = MAX_int32;
+		CreateTrianglesLoopData.LoopCountLimit = MAX_int32;
 	}
 }
 
@@ -250,6 +339,595 @@ void ATerrainGenerator::InitProgress()
 	StepTotalCount = MAX_int32;
 }
 
+void ATerrainGenerator::InitTerrainCacheKey()
+{
+	//Every input of the generated data: editable generator and noise properties, grid params and code version
+	FString Text = FString::Printf(TEXT("Version=%d;"), TERRAIN_CACHE_VERSION);
+	TerrainCacheUtility::AppendProperties(GetClass(), this, true, Text);
+	TerrainCacheUtility::AppendProperties(Noise->GetClass(), Noise, true, Text);
+	TerrainCacheUtility::AppendProperties(FStructGridDataParam::StaticStruct(), &pGI->TerrainGridParam, false, Text);
+	TerrainCacheKey = TerrainCacheUtility::HashText(Text);
+}
+
+bool ATerrainGenerator::LoadTerrainCache()
+{
+	if (!UseTerrainCache) {
+		return false;
+	}
+	FString Path = TerrainCacheUtility::GetCachePath(TEXT("TerrainCache"), TerrainCacheKey);
+	FStructTerrainCacheData Data;
+	if (!TerrainCacheUtility::LoadStruct(Path, FStructTerrainCacheData::StaticStruct(), &Data)
+		|| Data.Key != TerrainCacheKey) {
+		return false;
+	}
+
+	GridRange = Data.GridRange;
+	TerrainMeshPointsData = MoveTemp(Data.TerrainMeshPointsData);
+	InitTerrainMeshPointsIndices();
+	RiverLinePointDatas = MoveTemp(Data.RiverLinePointDatas);
+	LakeDatas = MoveTemp(Data.LakeDatas);
+	BlockLevelMax = Data.BlockLevelMax;
+
+	Vertices = MoveTemp(Data.Vertices);
+	Triangles = MoveTemp(Data.Triangles);
+	VertexColors = MoveTemp(Data.VertexColors);
+
+	UE_LOG(TerrainGenerator, Log, TEXT("Load terrain cache %s done."), *TerrainCacheKey);
+	return true;
+}
+
+void ATerrainGenerator::SaveTerrainCache()
+{
+	if (UseTerrainCache) {
+		FStructTerrainCacheData Data;
+		Data.Key = TerrainCacheKey;
+		Data.GridRange = GridRange;
+		Data.TerrainMeshPointsData = TerrainMeshPointsData;
+		Data.RiverLinePointDatas = RiverLinePointDatas;
+		Data.LakeDatas = LakeDatas;
+		Data.BlockLevelMax = BlockLevelMax;
+
+		Data.Vertices = Vertices;
+		Data.Triangles = Triangles;
+		Data.VertexColors = VertexColors;
+
+		FString Path = TerrainCacheUtility::GetCachePath(TEXT("TerrainCache"), TerrainCacheKey);
+		if (TerrainCacheUtility::SaveStruct(Path, FStructTerrainCacheData::StaticStruct(), &Data)) {
+			UE_LOG(TerrainGenerator, Log, TEXT("Save terrain cache %s done."), *TerrainCacheKey);
+		}
+		else {
+			UE_LOG(TerrainGenerator, Warning, TEXT("Save terrain cache %s failed!"), *TerrainCacheKey);
+		}
+	}
+
+	WorkflowState = Enum_TerrainGeneratorState::DrawLandMesh;
+	SetWorkflowTimer(DefaultTimerRate);
+}
+
+void ATerrainGenerator::InitTerrainMeshPointsIndices()
+{
+	TerrainMeshPointsIndices.Empty(TerrainMeshPointsData.Num());
+	for (int32 i = 0; i < TerrainMeshPointsData.Num(); i++)
+	{
+		TerrainMeshPointsIndices.Add(GetPointAxialCoord(i), i);
+	}
+}
+
+void ATerrainGenerator::InitStageCacheKeys()
+{
+	int32 StageNum = (int32)Enum_TerrainStage::None;
+	TArray<FString> Texts;
+	Texts.SetNum(StageNum);
+	Texts[(int32)Enum_TerrainStage::Height] = FString::Printf(TEXT("Version=%d;"), TERRAIN_CACHE_VERSION);
+	TerrainCacheUtility::AppendProperties(FStructGridDataParam::StaticStruct(), &pGI->TerrainGridParam, false, 
+		Texts[(int32)Enum_TerrainStage::Height]);
+	for (int32 i = 0; i < StageNum; i++)
+	{
+		auto Filter = [i](const FProperty* Property) { return (int32)GetPropertyStage(Property) == i; };
+		TerrainCacheUtility::AppendProperties(GetClass(), this, true, Texts[i], Filter);
+		TerrainCacheUtility::AppendProperties(Noise->GetClass(), Noise, true, Texts[i], Filter);
+	}
+
+	//A stage key covers its own properties and the key of the stage whose output it reads
+	StageCacheKeys.SetNum(StageNum);
+	for (int32 i = 0; i < StageNum; i++)
+	{
+		Enum_TerrainStage Upstream = GetUpstreamStage((Enum_TerrainStage)i);
+		FString UpstreamKey = Upstream == Enum_TerrainStage::None ? FString() : StageCacheKeys[(int32)Upstream];
+		StageCacheKeys[i] = TerrainCacheUtility::HashText(UpstreamKey + Texts[i]);
+	}
+}
+
+//Checked member names, so a renamed property breaks the build instead of silently leaving its stage.
+//Unlisted properties fall to Height so a new property can only cause extra work
+Enum_TerrainStage ATerrainGenerator::GetPropertyStage(const FProperty* Property)
+{
+	static const TMap<FName, Enum_TerrainStage> Stages = []() {
+		TMap<FName, Enum_TerrainStage> Map;
+		auto Add = [&Map](Enum_TerrainStage Stage, std::initializer_list<FName> Names) {
+			for (const FName& Name : Names)
+			{
+				Map.Add(Name, Stage);
+			}
+			};
+		Add(Enum_TerrainStage::None, {
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, WaterfallClass),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, WaterfallMistClass),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, DefaultTimerRate),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, WaitCollisionTimerRate),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, UseBackgroundWorkflow),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, UseTerrainCache),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, UseStageCache),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, UseProgressivePreview),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, PreviewSteps),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, TrimAfterGeneration),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, AllowTerraform),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, CreateVerticesLoopData),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, ReMappingZLoopData),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, CreateVertexColorsForAMTBLoopData),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, CreateTrianglesLoopData),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, TerrainTypeDetailWavelength),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, HasCaustics),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, WaterNumRows),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, WaterNumColumns),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, WaterRange),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, HasWaterfall),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, WaterfallPoolUnderWaterCountLimit),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, WaterfallHeightRatio),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, WaterfallTraceDeltaAngle),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, WaterfallTraceStep),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, WaterfallToleranceAngle),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, WaterfallOriDirection),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, WaterfallFreefallTimeOffset),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, WaterfallPlainOverTerrain),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, WaterfallRadiusMin),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, WaterfallRadiusMax),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, WaterfallRadiusStep),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, TerrainMPC),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, TerrainMaterialIns),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, WaterMaterialIns),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, CausticsMaterialIns),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, LandChunkSize),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, LandLODNum),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, LandLODRange),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, LandSkirtDepth),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, LandLODTimerRate),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, OptimizeLandIndexOrder),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, UseAsyncCollisionCooking),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, LandCollisionLOD),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, WaterfallMaterialIns),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, LakeMaterialIns),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, ProgressWeight_CreateVertices),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, ProgressWeight_ReMappingZ),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, ProgressWeight_SetBlockLevel),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, ProgressWeight_DivideRiverEndPoints),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, ProgressWeight_FindRiverLines),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, ProgressWeight_DigRiverLine),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, ProgressWeight_DigRiverPool),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, ProgressWeight_CreateVertexColorsForAMTB),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, ProgressWeight_CreateTriangles),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, ProgressWeight_CalNormals)
+			});
+		Add(Enum_TerrainStage::River, {
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, HasRiver),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, RiverMode),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, MaxRiverNum),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, UpperRiverLimitZRatio),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, LowerRiverLimitZRatio),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, MinRiverLength),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, MinRiverSpacing),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, RiverDirectionSampleScale),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, RiverDirectionNoiseCostScale),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, RiverDirectionAltitudeCostScale),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, RiverDirectionMapping),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, RiverDirectionAltitudeBlockRatio),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, RiverDirectionHeuristicRatio),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, RiverDepthRatioStart),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, RiverDepthRatioMax),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, RiverDepthRatioMin),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, RiverDepthChangeStep),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, RiverDepthRisingStep),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, RiverDepthSampleScale),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, RiverProfileCurve),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, RiverFlowAccumulationThreshold),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, RiverFlowFillEpsilon),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, HasRiverPool),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, RiverPoolDepthRatioMax),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, RiverPoolDepthRatioMin),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, RiverPoolDepthRisingStep),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, RiverPoolCombineRatio),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, RiverPoolCombineUpper),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, RiverPoolCombineLower),
+			GET_MEMBER_NAME_CHECKED(ATerrainNoise, NWRiverDirection_NoiseSeed),
+			GET_MEMBER_NAME_CHECKED(ATerrainNoise, NWRiverDirection_NoiseFrequency),
+			GET_MEMBER_NAME_CHECKED(ATerrainNoise, NWRiverDepth_NoiseSeed),
+			GET_MEMBER_NAME_CHECKED(ATerrainNoise, NWRiverDepth_NoiseFrequency)
+			});
+		Add(Enum_TerrainStage::VertexColors, {
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, MoistureSampleScale),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, MoistureValueScale),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, MoistureZRatioScale),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, TemperatureSampleScale),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, TemperatureValueScale),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, MoistureBlendThresholdLow),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, MoistureBlendThresholdHigh),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, TempratureBlendThresholdLow),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, TempratureBlendThresholdHigh),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, TreeRange),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, TreeSampleScale),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, TreeValueScale),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, TypeToTreeDensity),
+			GET_MEMBER_NAME_CHECKED(ATerrainNoise, NWMoisture_NoiseSeed),
+			GET_MEMBER_NAME_CHECKED(ATerrainNoise, NWMoisture_NoiseFrequency),
+			GET_MEMBER_NAME_CHECKED(ATerrainNoise, NWTemperature_NoiseSeed),
+			GET_MEMBER_NAME_CHECKED(ATerrainNoise, NWTemperature_NoiseFrequency),
+			GET_MEMBER_NAME_CHECKED(ATerrainNoise, NWTree_NoiseSeed),
+			GET_MEMBER_NAME_CHECKED(ATerrainNoise, NWTree_NoiseFrequency)
+			});
+		Add(Enum_TerrainStage::Normals, {
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, UseAnalyticNormals)
+			});
+		Add(Enum_TerrainStage::Lakes, {
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, HasLake),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, LakeMinPointNum),
+			GET_MEMBER_NAME_CHECKED(ATerrainGenerator, LakeMinDepthRatio)
+			});
+		return Map;
+		}();
+
+	const Enum_TerrainStage* pStage = Stages.Find(Property->GetFName());
+	return pStage ? *pStage : Enum_TerrainStage::Height;
+}
+
+Enum_TerrainStage ATerrainGenerator::GetUpstreamStage(Enum_TerrainStage Stage)
+{
+	switch (Stage)
+	{
+	case Enum_TerrainStage::River:
+	case Enum_TerrainStage::Triangles:
+		return Enum_TerrainStage::Height;
+	case Enum_TerrainStage::VertexColors:
+	case Enum_TerrainStage::Normals:
+	case Enum_TerrainStage::Lakes:
+		return Enum_TerrainStage::River;
+	default:
+		return Enum_TerrainStage::None;
+	}
+}
+
+bool ATerrainGenerator::IsStageCacheEnabled()
+{
+	//Snapshots hold full copies of the point data, only worth it while iterating in the editor
+	return UseStageCache && GIsEditor;
+}
+
+bool ATerrainGenerator::GetStageByStartState(Enum_TerrainGeneratorState State, Enum_TerrainStage& OutStage)
+{
+	switch (State)
+	{
+	case Enum_TerrainGeneratorState::CreateVertices:
+		OutStage = Enum_TerrainStage::Height;
+		return true;
+	case Enum_TerrainGeneratorState::CreateRiver:
+		OutStage = Enum_TerrainStage::River;
+		return true;
+	case Enum_TerrainGeneratorState::CreateVertexColorsForAMTB:
+		OutStage = Enum_TerrainStage::VertexColors;
+		return true;
+	case Enum_TerrainGeneratorState::CreateTriangles:
+		OutStage = Enum_TerrainStage::Triangles;
+		return true;
+	case Enum_TerrainGeneratorState::CalNormals:
+		OutStage = Enum_TerrainStage::Normals;
+		return true;
+	case Enum_TerrainGeneratorState::FindLakes:
+		OutStage = Enum_TerrainStage::Lakes;
+		return true;
+	default:
+		return false;
+	}
+}
+
+Enum_TerrainGeneratorState ATerrainGenerator::GetStageEndState(Enum_TerrainStage Stage)
+{
+	switch (Stage)
+	{
+	case Enum_TerrainStage::Height:
+		return Enum_TerrainGeneratorState::CreateRiver;
+	case Enum_TerrainStage::River:
+		return Enum_TerrainGeneratorState::CreateVertexColorsForAMTB;
+	case Enum_TerrainStage::VertexColors:
+		return Enum_TerrainGeneratorState::CreateTriangles;
+	case Enum_TerrainStage::Triangles:
+		return Enum_TerrainGeneratorState::CalNormals;
+	case Enum_TerrainStage::Normals:
+		return Enum_TerrainGeneratorState::FindLakes;
+	default:
+		return Enum_TerrainGeneratorState::SaveTerrainCache;
+	}
+}
+
+float ATerrainGenerator::GetStageProgressWeight(Enum_TerrainStage Stage)
+{
+	switch (Stage)
+	{
+	case Enum_TerrainStage::Height:
+		return ProgressWeight_CreateVertices + ProgressWeight_ReMappingZ + ProgressWeight_SetBlockLevel;
+	case Enum_TerrainStage::River:
+		return ProgressWeight_DivideRiverEndPoints + ProgressWeight_FindRiverLines
+			+ ProgressWeight_DigRiverLine + ProgressWeight_DigRiverPool;
+	case Enum_TerrainStage::VertexColors:
+		return ProgressWeight_CreateVertexColorsForAMTB;
+	case Enum_TerrainStage::Triangles:
+		return ProgressWeight_CreateTriangles;
+	case Enum_TerrainStage::Normals:
+		return ProgressWeight_CalNormals;
+	default:
+		return 0.f;
+	}
+}
+
+FString ATerrainGenerator::GetStageCacheName(Enum_TerrainStage Stage)
+{
+	return FString::Printf(TEXT("%s|%d"), *GetPathName(), (int32)Stage);
+}
+
+//Runs once per state change: stores the stage that just finished, 
+//then skips every following stage whose cached output is still valid
+void ATerrainGenerator::UpdateStageCache()
+{
+	while (WorkflowState != StageCacheState) {
+		StageCacheState = WorkflowState;
+		if (!IsStageCacheEnabled()) {
+			return;
+		}
+
+		Enum_TerrainStage Stage = Enum_TerrainStage::None;
+		bool IsStageStart = GetStageByStartState(WorkflowState, Stage);
+		if (!IsStageStart && WorkflowState != Enum_TerrainGeneratorState::SaveTerrainCache) {
+			return;
+		}
+		if (RunningStage != Enum_TerrainStage::None) {
+			SaveStageCache(RunningStage);
+			RunningStage = Enum_TerrainStage::None;
+		}
+		if (!IsStageStart) {
+			return;
+		}
+
+		if (LoadStageCache(Stage)) {
+			ProgressPassed += GetStageProgressWeight(Stage);
+			Progress = ProgressPassed;
+			WorkflowState = GetStageEndState(Stage);
+			UE_LOG(TerrainGenerator, Log, TEXT("Reuse stage %d from the session cache."), (int32)Stage);
+		}
+		else {
+			RunningStage = Stage;
+		}
+	}
+}
+
+//Session wide, keyed by generator and stage, the value key tells if the inputs still match
+static TMap<FString, FStructTerrainCacheData> TerrainStageCache;
+static FCriticalSection TerrainStageCacheLock;
+
+void ATerrainGenerator::SaveStageCache(Enum_TerrainStage Stage)
+{
+	FStructTerrainCacheData Data;
+	Data.Key = StageCacheKeys[(int32)Stage];
+	//Without rivers the River snapshot would only repeat Height
+	if (Stage == Enum_TerrainStage::River && !HasRiver) {
+		return;
+	}
+	switch (Stage)
+	{
+	case Enum_TerrainStage::River:
+	case Enum_TerrainStage::Height:
+		Data.GridRange = GridRange;
+		Data.TerrainMeshPointsData = TerrainMeshPointsData;
+		Data.RiverLinePointDatas = RiverLinePointDatas;
+		Data.BlockLevelMax = BlockLevelMax;
+		Data.Vertices = Vertices;
+		break;
+	case Enum_TerrainStage::VertexColors:
+		Data.VertexColors = VertexColors;
+		break;
+	case Enum_TerrainStage::Triangles:
+		Data.Triangles = Triangles;
+		break;
+	case Enum_TerrainStage::Normals:
+		Data.Normals.SetNumUninitialized(TerrainMeshPointsData.Num());
+		for (int32 i = 0; i < TerrainMeshPointsData.Num(); i++)
+		{
+			Data.Normals[i] = TerrainMeshPointsData[i].Normal;
+		}
+		break;
+	case Enum_TerrainStage::Lakes:
+		Data.LakeDatas = LakeDatas;
+		break;
+	default:
+		return;
+	}
+
+	FScopeLock Lock(&TerrainStageCacheLock);
+	TerrainStageCache.Add(GetStageCacheName(Stage), MoveTemp(Data));
+}
+
+bool ATerrainGenerator::LoadStageCache(Enum_TerrainStage Stage)
+{
+	if (Stage == Enum_TerrainStage::River && !HasRiver) {
+		return false;
+	}
+
+	FScopeLock Lock(&TerrainStageCacheLock);
+	const FStructTerrainCacheData* pData = TerrainStageCache.Find(GetStageCacheName(Stage));
+	if (pData == nullptr || pData->Key != StageCacheKeys[(int32)Stage]) {
+		return false;
+	}
+
+	switch (Stage)
+	{
+	case Enum_TerrainStage::Height:
+	case Enum_TerrainStage::River:
+		GridRange = pData->GridRange;
+		TerrainMeshPointsData = pData->TerrainMeshPointsData;
+		InitTerrainMeshPointsIndices();
+		RiverLinePointDatas = pData->RiverLinePointDatas;
+		BlockLevelMax = pData->BlockLevelMax;
+		Vertices = pData->Vertices;
+		break;
+	case Enum_TerrainStage::VertexColors:
+		VertexColors = pData->VertexColors;
+		break;
+	case Enum_TerrainStage::Triangles:
+		Triangles = pData->Triangles;
+		break;
+	case Enum_TerrainStage::Normals:
+		for (int32 i = 0; i < TerrainMeshPointsData.Num(); i++)
+		{
+			TerrainMeshPointsData[i].Normal = pData->Normals[i];
+			TerrainMeshPointsData[i].AngleToUp = AngleBetweenVectors(FVector::UpVector, pData->Normals[i]);
+		}
+		break;
+	case Enum_TerrainStage::Lakes:
+		LakeDatas = pData->LakeDatas;
+		for (int32 i = 0; i < LakeDatas.Num(); i++)
+		{
+			for (int32 PointIndex : LakeDatas[i].PointIndices)
+			{
+				TerrainMeshPointsData[PointIndex].LakeIndex = i;
+			}
+		}
+		break;
+	default:
+		return false;
+	}
+	return true;
+}
+
+void ATerrainGenerator::CreatePreview()
+{
+	//One pass per call so the timer workflow can draw a frame between passes
+	if (PreviewPassIndex < PreviewSteps.Num()) {
+		int32 Step = PreviewSteps[PreviewPassIndex];
+		PreviewPassIndex++;
+		if (Step > 1) {
+			FStructTerrainPreviewData Data;
+			CreatePreviewData(Step, Data);
+			UE_LOG(TerrainGenerator, Log, TEXT("Create preview step %d with %d vertices done."), Step, Data.Vertices.Num());
+			CommitPreviewData(MoveTemp(Data));
+		}
+		SetWorkflowTimer(DefaultTimerRate);
+		return;
+	}
+
+	WorkflowState = Enum_TerrainGeneratorState::CreateVertices;
+	SetWorkflowTimer(DefaultTimerRate);
+}
+
+//Same noise, remap and color functions as the full mesh, sampled on every Step-th axial coord
+void ATerrainGenerator::CreatePreviewData(int32 Step, FStructTerrainPreviewData& OutData)
+{
+	OutData.Step = Step;
+	int32 Range = FMath::Min(GridRange, pGI->TerrainGridParam.GridRange);
+	int32 CoordMax = Range / Step * Step;
+
+	TArray<FStructTerrainMeshPointData> Points;
+	TArray<FIntPoint> Coords;
+	TMap<FIntPoint, int32> Indices;
+	float PreviewZRatioMax = 0.0;
+	//Detail finer than two sample steps can't show in this pass
+	float DetailWavelength = Step * 2.0;
+	float RatioStd;
+	float Ratio;
+	for (int32 X = -CoordMax; X <= CoordMax; X += Step)
+	{
+		for (int32 Y = -CoordMax; Y <= CoordMax; Y += Step)
+		{
+			FIntPoint Key(X, Y);
+			const int32* pGridIndex = pGI->TerrainGridPointIndices.Find(Key);
+			if (FMath::Abs(X) + FMath::Abs(Y) > Range || pGridIndex == nullptr) {
+				continue;
+			}
+			FStructTerrainMeshPointData Data;
+			Data.GridDataIndex = *pGridIndex;
+			Data.PositionZ = GetAltitude(X, Y, RatioStd, Ratio, Data.ZRatioGradient, DetailWavelength);
+			Data.PositionZRatio = Ratio;
+			PreviewZRatioMax = FMath::Max(PreviewZRatioMax, Ratio);
+			Indices.Add(Key, Points.Add(Data));
+			Coords.Add(Key);
+		}
+	}
+
+	//The coarse max is close to the full one, so the remapped heights match the final mesh
+	FStructHeightMapping Mapping;
+	InitZRatioMapping(PreviewZRatioMax, Mapping);
+	float SlopeScale = TileAltitudeMultiplier / TileSizeMultiplier;
+	for (int32 i = 0; i < Points.Num(); i++)
+	{
+		FStructTerrainMeshPointData& Data = Points[i];
+		ReMappingPointZ(Data, Mapping);
+		int32 X = Coords[i].X;
+		int32 Y = Coords[i].Y;
+		FVector2D Position2D = pGI->TerrainGridPoints[Data.GridDataIndex].Position2D;
+		OutData.Vertices.Add(FVector(Position2D.X, Position2D.Y, Data.PositionZ));
+		OutData.UVs.Add(FVector2D(X * UVScale, Y * UVScale));
+		OutData.UV1.Add(FVector2D(1.0, 0.0));
+		OutData.VertexColors.Add(FLinearColor(Data.PositionZRatio * 0.5 + 0.5,
+			CalMoisture(X, Y, Data.PositionZRatio, DetailWavelength), CalTemperature(X, Y, DetailWavelength),
+			CalTree(X, Y, DetailWavelength)));
+
+		FVector Normal(-Data.ZRatioGradient.X * SlopeScale, -Data.ZRatioGradient.Y * SlopeScale, 1.0);
+		Normal.Normalize();
+		FVector TangentX(1.0, 0.0, Data.ZRatioGradient.X * SlopeScale);
+		TangentX.Normalize();
+		OutData.Normals.Add(Normal);
+		OutData.Tangents.Add(FProcMeshTangent(TangentX, false));
+	}
+
+	//Same corner order as FindTopRightSquareVertices, one coarse cell per point
+	TArray<int32> SqVArr = {};
+	TArray<FIntPoint> Corners = { FIntPoint(Step, 0), FIntPoint(Step, Step), FIntPoint(0, Step) };
+	for (int32 i = 0; i < Coords.Num(); i++)
+	{
+		SqVArr.Add(i);
+		for (const FIntPoint& Corner : Corners)
+		{
+			if (const int32* pIndex = Indices.Find(Coords[i] + Corner)) {
+				SqVArr.Add(*pIndex);
+			}
+		}
+		CreatePairTriangles(SqVArr, OutData.Triangles);
+	}
+}
+
+void ATerrainGenerator::CommitPreviewData(FStructTerrainPreviewData&& Data)
+{
+	if (!IsRunningInBackground) {
+		CreatePreviewMesh(Data);
+		return;
+	}
+
+	TWeakObjectPtr<ATerrainGenerator> WeakThis(this);
+	AsyncTask(ENamedThreads::GameThread, [WeakThis, Data = MoveTemp(Data)]() {
+		if (WeakThis.IsValid()) {
+			WeakThis->CreatePreviewMesh(Data);
+		}
+		});
+}
+
+//Game thread only, the full mesh replaces section 0 in CreateTerrainMesh
+void ATerrainGenerator::CreatePreviewMesh(const FStructTerrainPreviewData& Data)
+{
+	if (IsWorkFlowStepDone(Enum_TerrainGeneratorState::DrawLandMesh)) {
+		return;
+	}
+	TerrainMesh->CreateMeshSection_LinearColor(0, Data.Vertices, Data.Triangles, Data.Normals, Data.UVs, 
+		Data.UV1, TArray<FVector2D>(), TArray<FVector2D>(), Data.VertexColors, Data.Tangents, false);
+	SetTerrainMaterial();
+	UE_LOG(TerrainGenerator, Log, TEXT("Create preview mesh step %d done."), Data.Step);
+}
+
 void ATerrainGenerator::CreateVertices()
 {
 	int32 Count = 0;
@@ -265,6 +943,7 @@ void ATerrainGenerator::CreateVertices()
 			GridRange = pGI->TerrainGridParam.GridRange;
 		}
 		StepTotalCount = 1 + (QUAD_SIDE_NUM + GridRange * QUAD_SIDE_NUM) * GridRange / 2;
+		InitMeshPointOrder();
 	}
 
 	int32 i = CreateVerticesLoopData.IndexSaved[0];
@@ -278,24 +957,40 @@ void ATerrainGenerator::CreateVertices()
 			return;
 		}
 
-		X = pGI->TerrainGridPoints[i].AxialCoord.X;
-		Y = pGI->TerrainGridPoints[i].AxialCoord.Y;
+		int32 GridIndex = MeshPointOrder.IsEmpty() ? i : MeshPointOrder[i];
+		X = pGI->TerrainGridPoints[GridIndex].AxialCoord.X;
+		Y = pGI->TerrainGridPoints[GridIndex].AxialCoord.Y;
 		TerrainMeshPointsIndices.Add(FIntPoint(X, Y), i);
 		CreateVertex(X, Y, RatioStd, Ratio);
-		CreateUV(X, Y);
 
 		Progress = ProgressPassed + (float)CreateVerticesLoopData.Count / (float)StepTotalCount * ProgressWeight_CreateVertices;
 		Count++;
 	}
 
 	ProgressPassed += ProgressWeight_CreateVertices;
+	MeshPointOrder.Empty();
 
 	WorkflowState = Enum_TerrainGeneratorState::ReMappingZ;
-	FTimerHandle TimerHandle;
-	GetWorldTimerManager().SetTimer(TimerHandle, WorkflowDelegate, CreateVerticesLoopData.Rate, false);
+	SetWorkflowTimer(CreateVerticesLoopData.Rate);
 	UE_LOG(TerrainGenerator, Log, TEXT("Create vertices done."));
 }
 
+void ATerrainGenerator::InitMeshPointOrder()
+{
+	MeshPointOrder.Empty();
+	if (!UseMortonPointOrder) {
+		return;
+	}
+	//The first StepTotalCount grid points are the ones inside GridRange
+	TArray<FIntPoint> Coords;
+	Coords.SetNumUninitialized(StepTotalCount);
+	for (int32 i = 0; i < StepTotalCount; i++)
+	{
+		Coords[i] = pGI->TerrainGridPoints[i].AxialCoord;
+	}
+	MeshOrderUtility::SortByMortonCode(Coords, MeshPointOrder);
+}
+
 bool ATerrainGenerator::CreateVertex(int32 X, int32 Y, float& OutRatioStd, float& OutRatio)
 {
 	FStructTerrainMeshPointData Data;
@@ -317,10 +1012,11 @@ void ATerrainGenerator::AddVertex(FStructTerrainMeshPointData& Data, float& OutR
 	float VX = GridPoint.Position2D.X;
 	float VY = GridPoint.Position2D.Y;
 	float VZ = GetAltitude(GridPoint.AxialCoord.X, GridPoint.AxialCoord.Y, 
-		OutRatioStd, OutRatio);
+		OutRatioStd, OutRatio, Data.ZRatioGradient);
 	Data.PositionZ = VZ;
 	Data.PositionZRatio = OutRatio;
-	Vertices.Add(FVector(VX, VY, VZ));
+	Data.HasAnalyticGradient = true;
+	Vertices.Add(FVector3f(VX, VY, VZ));
 }
 
 void ATerrainGenerator::GetZRatioInfo(const FStructTerrainMeshPointData& Data)
@@ -340,16 +1036,29 @@ void ATerrainGenerator::GetZRatioInfo(const FStructTerrainMeshPointData& Data)
 
 float ATerrainGenerator::GetAltitude(float X, float Y, float& OutRatioStd, float& OutRatio)
 {
-	float k = 0.5;
+	FVector2D Gradient;
+	return GetAltitude(X, Y, OutRatioStd, OutRatio, Gradient);
+}
+
+//OutGradient is d(ZRatio) per axial unit
+float ATerrainGenerator::GetAltitude(float X, float Y, float& OutRatioStd, float& OutRatio, FVector2D& OutGradient,
+	float DetailWavelength)
+{
 	FVector2D slope0;
-	OutRatio = GetGradientRatioZ(Noise->NWLandLayer0, X, Y, 
-		[this](float X, float Y) { return GetLandLayer0Ratio(X, Y); },
+	FVector2D Layer1Gradient;
+	OutRatio = GetGradientRatioZ(X, Y, 
+		[this, DetailWavelength](float X, float Y, FVector2D& OutGradient) { return GetLandLayer0Ratio(X, Y, OutGradient, DetailWavelength); },
 		0.0, 0.2,
-		FVector2d(0.0, 0.0), slope0) + GetLandLayer1Ratio(X, Y);
+		FVector2d(0.0, 0.0), slope0, OutGradient) + GetLandLayer1Ratio(X, Y, Layer1Gradient, DetailWavelength);
+	OutGradient += Layer1Gradient;
 
 	if (HasWater) {
-		float wRatio = GetWaterRatio(X, Y);
-		OutRatio = CombineWaterLandRatio(wRatio, OutRatio);
+		FVector2D WaterGradient;
+		float wRatio = GetWaterRatio(X, Y, WaterGradient, DetailWavelength);
+		OutRatio = CombineWaterLandRatio(wRatio, OutRatio, WaterGradient, OutGradient);
+	}
+	if (OutRatio < -1.0 || OutRatio > 1.0) {
+		OutGradient = FVector2D::ZeroVector;
 	}
 	OutRatio = FMath::Clamp<float>(OutRatio, -1.0, 1.0);
 	OutRatioStd = OutRatio * 0.5 + 0.5;
@@ -357,69 +1066,89 @@ float ATerrainGenerator::GetAltitude(float X, float Y, float& OutRatioStd, float
 	return z;
 }
 
-float ATerrainGenerator::GetGradientRatioZ(UFastNoiseWrapper* NWP, float X, float Y, 
-	TFunction<float(float X, float Y)> GetRatioFunc,
+//Slope is taken from the analytic derivative of the same sample instead of extra taps.
+//The attenuation 1/(1+m*k) is treated as locally constant for OutGradient.
+float ATerrainGenerator::GetGradientRatioZ(float X, float Y, 
+	TFunctionRef<float(float X, float Y, FVector2D& OutGradient)> GetRatioFunc,
 	float BaseRatio, float k, 
-	const FVector2d& BaseSlope, FVector2d& OutSlope)
+	const FVector2d& BaseSlope, FVector2d& OutSlope, FVector2D& OutGradient)
 {
-	float value = GetRatioFunc(X, Y);
-	float valueX = GetRatioFunc(X + 1, Y);
-	float valueY = GetRatioFunc(X, Y + 1);
+	float value = GetRatioFunc(X, Y, OutGradient);
 
-	float slopeX = (valueX - value) * TileAltitudeMultiplier / pGI->TerrainGridParam.TileSize;
-	float slopeY = (valueY - value) * TileAltitudeMultiplier / pGI->TerrainGridParam.TileSize;
-	OutSlope.Set(slopeX + BaseSlope.X, slopeY + BaseSlope.Y);
+	float SlopeScale = TileAltitudeMultiplier / pGI->TerrainGridParam.TileSize;
+	OutSlope.Set(OutGradient.X * SlopeScale + BaseSlope.X, OutGradient.Y * SlopeScale + BaseSlope.Y);
 
 	float m = OutSlope.Length();
 	float Ratio = value / (1.0 + m * k);
+	OutGradient /= (1.0 + m * k);
 	return BaseRatio + Ratio;
 }
 
 
 float ATerrainGenerator::CombineWaterLandRatio(float wRatio, float lRatio)
+{
+	FVector2D wGradient;
+	FVector2D lGradient;
+	return CombineWaterLandRatio(wRatio, lRatio, wGradient, lGradient);
+}
+
+float ATerrainGenerator::CombineWaterLandRatio(float wRatio, float lRatio, 
+	const FVector2D& wGradient, FVector2D& InOutGradient)
 {
 	/*float alpha = lRatio / WaterLandCombineRatio;
 	alpha = FMath::Clamp<float>(alpha, 0.0, 1.0);
 	float outRatio = FMath::Lerp<float>(wRatio, lRatio, alpha);*/
 
 	float outRatio = wRatio + lRatio;
+	InOutGradient += wGradient;
+	if (outRatio < -1.0 || outRatio > 1.0) {
+		InOutGradient = FVector2D::ZeroVector;
+	}
 	outRatio = FMath::Clamp<float>(outRatio, -1.0, 1.0);
 
 	return outRatio;
 }
 
-float ATerrainGenerator::GetLandLayer0Ratio(float X, float Y)
+float ATerrainGenerator::GetLandLayer0Ratio(float X, float Y, FVector2D& OutGradient, float DetailWavelength)
 {
 	FStructHeightMapping mapping;
 	MappingByLevel(LandLayer0Level, LandLayer0RangeMapping, mapping);
-	return GetMappingHeightRatio(Noise->NWLandLayer0, mapping, X, Y, LandLayer0SampleScale);
+	return GetMappingHeightRatio(Noise->GNLandLayer0, mapping, X, Y, LandLayer0SampleScale, OutGradient, DetailWavelength);
 }
 
-float ATerrainGenerator::GetLandLayer1Ratio(float X, float Y)
+float ATerrainGenerator::GetLandLayer1Ratio(float X, float Y, FVector2D& OutGradient, float DetailWavelength)
 {
 	FStructHeightMapping mapping;
 	MappingByLevel(LandLayer1Level, LandLayer1RangeMapping, mapping);
-	return GetMappingHeightRatio(Noise->NWLandLayer1, mapping, X, Y, LandLayer1SampleScale);
+	return GetMappingHeightRatio(Noise->GNLandLayer1, mapping, X, Y, LandLayer1SampleScale, OutGradient, DetailWavelength);
 }
 
-float ATerrainGenerator::GetWaterRatio(float X, float Y)
+float ATerrainGenerator::GetWaterRatio(float X, float Y, FVector2D& OutGradient, float DetailWavelength)
 {
 	FStructHeightMapping mapping;
 	MappingByLevel(WaterLevel, WaterRangeMapping, mapping);
-	float ratio = GetMappingHeightRatio(Noise->NWWater, mapping, X, Y, WaterSampleScale);
-	ratio = CalWaterBank(ratio);
+	float ratio = GetMappingHeightRatio(Noise->GNWater, mapping, X, Y, WaterSampleScale, OutGradient, DetailWavelength);
+	float Derivative = 0.0;
+	ratio = CalWaterBank(ratio, Derivative);
+	OutGradient *= Derivative;
 	return ratio;
 }
 
-float ATerrainGenerator::CalWaterBank(float Ratio)
+float ATerrainGenerator::CalWaterBank(float Ratio, float& OutDerivative)
 {
+	OutDerivative = 0.0;
 	Ratio = Ratio > 0.0 ? 0.0 : Ratio;
 	Ratio = FMath::Abs<float>(Ratio);
 	float alpha = Ratio * WaterBankSharpness;
+	float dExp = alpha > 0.0 && alpha < 1.0 ? -2.0 * WaterBankSharpness : 0.0;
 	alpha = FMath::Clamp<float>(alpha, 0.0, 1.0);
 	float exp = FMath::Lerp<float>(3.0, 1.0, alpha);
-	Ratio = -FMath::Pow(Ratio, exp);
-	return Ratio;
+	float Result = -FMath::Pow(Ratio, exp);
+	if (Ratio > 0.0) {
+		//d/dRatio of -Ratio^exp(Ratio), then flipped because Ratio = -InputRatio
+		OutDerivative = -Result * (dExp * FMath::Loge(Ratio) + exp / Ratio);
+	}
+	return Result;
 }
 
 void ATerrainGenerator::MappingByLevel(float level, const FStructHeightMapping& InMapping, FStructHeightMapping& OutMapping)
@@ -432,15 +1161,20 @@ void ATerrainGenerator::MappingByLevel(float level, const FStructHeightMapping&
 	OutMapping.RangeMaxOffset = InMapping.RangeMaxOffset;
 }
 
-float ATerrainGenerator::GetMappingHeightRatio(UFastNoiseWrapper* NWP, 
-	const FStructHeightMapping& Mapping, float X, float Y, float SampleScale)
+float ATerrainGenerator::GetMappingHeightRatio(const TerrainGradientNoise& GN, 
+	const FStructHeightMapping& Mapping, float X, float Y, float SampleScale, FVector2D& OutGradient,
+	float DetailWavelength)
 {
-	float value = 0.0;
-	if (NWP != nullptr) {
-		value = NWP->GetNoise2D(X * SampleScale, Y * SampleScale);
-		return MappingFromRangeToRange(value, Mapping);
+	int32 MaxOctaves = GN.GetOctavesForWavelength(DetailWavelength * SampleScale);
+	float value = GN.GetNoise2D(X * SampleScale, Y * SampleScale, OutGradient, MaxOctaves);
+	OutGradient *= SampleScale;
+	if (value > Mapping.RangeMin && value < Mapping.RangeMax) {
+		OutGradient *= (Mapping.MappingMax - Mapping.MappingMin) / (Mapping.RangeMax - Mapping.RangeMin);
+	}
+	else {
+		OutGradient = FVector2D::ZeroVector;
 	}
-	return 0.0f;
+	return MappingFromRangeToRange(value, Mapping);
 }
 
 float ATerrainGenerator::MappingFromRangeToRange(float InputValue, 
@@ -457,26 +1191,28 @@ float ATerrainGenerator::MappingFromRangeToRange(float InputValue, float RangeMa
 	return FMath::Lerp<float>(MappingMax, MappingMin, alpha);
 }
 
-void ATerrainGenerator::CreateUV(float X, float Y)
-{
-	float UVx = X * UVScale;
-	float UVy = Y * UVScale;
-	UVs.Add(FVector2D(UVx, UVy));
-	UV1.Add(FVector2D(1.0, 0.0));
-}
-
-float ATerrainGenerator::GetNoise2DStd(UFastNoiseWrapper* NWP, float X, float Y, 
-	float SampleScale, float ValueScale)
+float ATerrainGenerator::GetNoise2DStd(UFastNoiseWrapper* NWP, const TerrainGradientNoise& GN, float X, float Y, 
+	float SampleScale, float ValueScale, float DetailWavelength)
 {
 	float value = 0.0;
 	if (NWP != nullptr) {
-		value = NWP->GetNoise2D(X * SampleScale, Y * SampleScale);
+		value = GetBudgetedNoise2D(NWP, GN, X * SampleScale, Y * SampleScale, DetailWavelength * SampleScale);
 		value = FMath::Clamp<float>(value * ValueScale, -1.0, 1.0);
 		value = (value + 1) * 0.5;
 	}
 	return value;
 }
 
+float ATerrainGenerator::GetBudgetedNoise2D(UFastNoiseWrapper* NWP, const TerrainGradientNoise& GN, float X, float Y,
+	float DetailWavelength)
+{
+	if (DetailWavelength > 0.0) {
+		FVector2D Gradient;
+		return GN.GetNoise2D(X, Y, Gradient, GN.GetOctavesForWavelength(DetailWavelength));
+	}
+	return NWP->GetNoise2D(X, Y);
+}
+
 bool ATerrainGenerator::TerrainMeshPointsLoopFunction(TFunction<void()> InitFunc, 
 	TFunction<void(int32 LoopIndex)> LoopFunc, 
 	FStructLoopData& LoopData, 
@@ -512,9 +1248,8 @@ bool ATerrainGenerator::TerrainMeshPointsLoopFunction(TFunction<void()> InitFunc
 		ProgressPassed += ProgressWeight;
 	}
 
-	FTimerHandle TimerHandle;
 	WorkflowState = State;
-	GetWorldTimerManager().SetTimer(TimerHandle, WorkflowDelegate, LoopData.Rate, false);
+	SetWorkflowTimer(LoopData.Rate);
 	return true;
 }
 
@@ -531,150 +1266,61 @@ void ATerrainGenerator::ReMappingZ()
 
 void ATerrainGenerator::InitReMappingZ()
 {
-	ZRatioMapping.RangeMin = 0.0;
-	ZRatioMapping.RangeMax = ZRatioMax;
-	ZRatioMapping.MappingMin = 0.0;
-	ZRatioMapping.MappingMax = 1.0;
-}
-
-void ATerrainGenerator::ReMappingPointZ(int32 Index)
-{
-	FStructTerrainMeshPointData& Data = TerrainMeshPointsData[Index];
-	if (Data.PositionZRatio > 0) {
-		Data.PositionZRatio = MappingFromRangeToRange(Data.PositionZRatio, ZRatioMapping);
-		Data.PositionZ = Data.PositionZRatio * TileAltitudeMultiplier;
-		Vertices[Index].Z = Data.PositionZ;
-	}
-}
-
-void ATerrainGenerator::SetBlockLevel()
-{
-	if (TerrainMeshPointsLoopFunction([this]() { InitSetBlockLevel(); },
-		[this](int32 i) { SetBlockLevelByNeighbors(i); },
-		SetBlockLevelLoopData,
-		Enum_TerrainGeneratorState::SetBlockLevelEx,
-		true, ProgressWeight_SetBlockLevel)) {
-		UE_LOG(TerrainGenerator, Log, TEXT("SetBlockLevel done."));
-	}
-}
-
-void ATerrainGenerator::InitSetBlockLevel()
-{
-	BlockLevelMax = pGI->TerrainGridParam.NeighborRange + 1;
+	InitZRatioMapping(ZRatioMax, ZRatioMapping);
 }
 
-bool ATerrainGenerator::SetBlock(FStructTerrainMeshPointData& OutData, 
-	const FStructTerrainMeshPointData& InData, int32 BlockLevel)
+void ATerrainGenerator::InitZRatioMapping(float InZRatioMax, FStructHeightMapping& OutMapping)
 {
-	if (InData.PositionZRatio > AltitudeBlockRatio)
-	{
-		OutData.BlockLevel = BlockLevel;
-		return true;
-	}
-	return false;
+	OutMapping.RangeMin = 0.0;
+	OutMapping.RangeMax = InZRatioMax;
+	OutMapping.MappingMin = 0.0;
+	OutMapping.MappingMax = 1.0;
 }
 
-void ATerrainGenerator::SetBlockLevelByNeighbors(int32 Index)
+void ATerrainGenerator::ReMappingPointZ(int32 Index)
 {
 	FStructTerrainMeshPointData& Data = TerrainMeshPointsData[Index];
-	if (SetBlock(Data, Data, 0)) {
-		return;
-	}
-	for (int32 i = 0; i < pGI->TerrainGridPoints[Data.GridDataIndex].Neighbors.Num(); i++)
-	{
-		if (SetBlockLevelByNeighbor(Data, i)) {
-			return;
-		}
-	}
-	Data.BlockLevel = BlockLevelMax;
+	ReMappingPointZ(Data, ZRatioMapping);
+	Vertices[Index].Z = Data.PositionZ;
 }
 
-bool ATerrainGenerator::SetBlockLevelByNeighbor(FStructTerrainMeshPointData& Data, int32 Index)
+void ATerrainGenerator::ReMappingPointZ(FStructTerrainMeshPointData& Data, const FStructHeightMapping& Mapping)
 {
-	FStructGridDataNeighbors Neighbors = pGI->TerrainGridPoints[Data.GridDataIndex].Neighbors[Index];
-	int32 NIndex = 0;
-	for (int32 i = 0; i < Neighbors.Points.Num(); i++)
-	{
-		FIntPoint key = Neighbors.Points[i];
-		if (!TerrainMeshPointsIndices.Contains(key)) {
-			continue;
-		}
-		NIndex = TerrainMeshPointsIndices[key];
-		if (SetBlock(Data, TerrainMeshPointsData[NIndex], Neighbors.Radius))
-		{
-			return true;
+	if (Data.PositionZRatio > 0) {
+		if (Data.PositionZRatio < Mapping.RangeMax) {
+			Data.ZRatioGradient /= Mapping.RangeMax;
 		}
+		Data.PositionZRatio = MappingFromRangeToRange(Data.PositionZRatio, Mapping);
+		Data.PositionZ = Data.PositionZRatio * TileAltitudeMultiplier;
 	}
-	return false;
 }
 
-void ATerrainGenerator::SetBlockLevelEx()
+void ATerrainGenerator::SetBlockLevel()
 {
-	if (BlockExTimes == 0) {
-		FTimerHandle TimerHandle;
-		WorkflowState = Enum_TerrainGeneratorState::CreateRiver;
-		GetWorldTimerManager().SetTimer(TimerHandle, WorkflowDelegate, DefaultTimerRate, false);
-		UE_LOG(TerrainGenerator, Log, TEXT("Set block level extension done!"));
-		return;
-	}
+	//Block level is the grid distance to the nearest blocked point, capped at BlockLevelMax
+	BlockLevelMax = pGI->TerrainGridParam.NeighborRange * (BlockExTimes + 1) + 1;
+	TArray<int32> BlockLevels;
+	AStarUtility::DistanceTransformFunction(TerrainMeshPointsData.Num(),
+		[this](int32 Index) { return IsBlock(TerrainMeshPointsData[Index]); },
+		[this](const int32& Current, int32& Next, int32& Index) { return NextPoint(Current, Next, Index); },
+		BlockLevelMax, BlockLevels);
 
-	int32 i = SetBlockLevelExLoopData.IndexSaved[0];
-	Enum_TerrainGeneratorState state = Enum_TerrainGeneratorState::SetBlockLevelEx;
-	for (; i < BlockExTimes; )
+	for (int32 i = 0; i < TerrainMeshPointsData.Num(); i++)
 	{
-		SetBlockLevelExLoopData.IndexSaved[0] = i;
-		if (i == (BlockExTimes - 1)) {
-			state = Enum_TerrainGeneratorState::CreateRiver;
-		}
-
-		if (TerrainMeshPointsLoopFunction([this]() { InitSetBlockLevelEx(); },
-			[this](int32 Index) { SetBlockLevelExByNeighbors(Index); },
-			BlockLevelExLoopDatas[i],
-			state)) {
-			Progress = ProgressPassed + (float)(i + 1) / (float)BlockExTimes * ProgressWeight_SetBlockLevelEx;
-			UE_LOG(TerrainGenerator, Log, TEXT("Set block level extension %d done!"), i + 1);
-			i++;
-			SetBlockLevelExLoopData.IndexSaved[0] = i;
-			if (i == BlockExTimes) {
-				ProgressPassed += ProgressWeight_SetBlockLevelEx;
-				break;
-			}
-		}
-		return;
+		TerrainMeshPointsData[i].BlockLevel = BlockLevels[i];
 	}
-	UE_LOG(TerrainGenerator, Log, TEXT("Set block level extension done!"));
-}
 
-void ATerrainGenerator::InitSetBlockLevelEx()
-{
-	BlockLevelMax += pGI->TerrainGridParam.NeighborRange;
+	ProgressPassed += ProgressWeight_SetBlockLevel;
+	Progress = ProgressPassed;
+
+	WorkflowState = Enum_TerrainGeneratorState::CreateRiver;
+	SetWorkflowTimer(DefaultTimerRate);
+	UE_LOG(TerrainGenerator, Log, TEXT("SetBlockLevel done."));
 }
 
-void ATerrainGenerator::SetBlockLevelExByNeighbors(int32 Index)
+bool ATerrainGenerator::IsBlock(const FStructTerrainMeshPointData& Data)
 {
-	FStructTerrainMeshPointData& Data = TerrainMeshPointsData[Index];
-	int32 NeighborRange = pGI->TerrainGridParam.NeighborRange;
-	if (Data.BlockLevel == (BlockLevelMax - NeighborRange))
-	{
-		FStructGridData GridData = pGI->TerrainGridPoints[Data.GridDataIndex];
-		FStructGridDataNeighbors OutSideNeighbors = GridData.Neighbors[GridData.Neighbors.Num() - 1];
-		int32 BlockLvMin = BlockLevelMax;
-		int32 CurrentBlockLv = Data.BlockLevel;
-		int32 NIndex = 0;
-		for (int32 i = 0; i < OutSideNeighbors.Count; i++)
-		{
-			FIntPoint key = OutSideNeighbors.Points[i];
-			if (!TerrainMeshPointsIndices.Contains(key)) {
-				continue;
-			}
-			NIndex = TerrainMeshPointsIndices[key];
-			CurrentBlockLv = NeighborRange + TerrainMeshPointsData[NIndex].BlockLevel;
-			if (CurrentBlockLv < BlockLvMin) {
-				BlockLvMin = CurrentBlockLv;
-			}
-		}
-		Data.BlockLevel = BlockLvMin;
-	}
+	return Data.PositionZRatio > AltitudeBlockRatio;
 }
 
 void ATerrainGenerator::CreateRiver()
@@ -683,16 +1329,15 @@ void ATerrainGenerator::CreateRiver()
 		switch (WorkflowState)
 		{
 		case Enum_TerrainGeneratorState::CreateRiver:
-			WorkflowState = Enum_TerrainGeneratorState::AddRiverEndPoints;
-		case Enum_TerrainGeneratorState::AddRiverEndPoints:
-			AddRiverEndPoints();
+			WorkflowState = RiverMode == Enum_TerrainRiverMode::FlowAccumulation ?
+				Enum_TerrainGeneratorState::CreateFlowRiverLines : Enum_TerrainGeneratorState::DivideRiverEndPoints;
+			CreateRiver();
 			break;
-		case Enum_TerrainGeneratorState::DivideUpperRiver:
-		case Enum_TerrainGeneratorState::DivideLowerRiver:
+		case Enum_TerrainGeneratorState::DivideRiverEndPoints:
 			DivideRiverEndPointsIntoChunks();
 			break;
-		case Enum_TerrainGeneratorState::ChunkToOnePoint:
-			RiverChunkToOnePoint();
+		case Enum_TerrainGeneratorState::CreateFlowRiverLines:
+			CreateFlowRiverLines();
 			break;
 		case Enum_TerrainGeneratorState::CreateRiverLine:
 			CreateRiverLine();
@@ -715,95 +1360,154 @@ void ATerrainGenerator::CreateRiver()
 	}
 	else {
 		WorkflowState = Enum_TerrainGeneratorState::CreateTriangles;
-		FTimerHandle TimerHandle;
-		GetWorldTimerManager().SetTimer(TimerHandle, WorkflowDelegate, DefaultTimerRate, false);
+		SetWorkflowTimer(DefaultTimerRate);
 		UE_LOG(TerrainGenerator, Log, TEXT("No river was created."));
 	}
 }
 
-void ATerrainGenerator::AddRiverEndPoints()
+void ATerrainGenerator::DivideRiverEndPointsIntoChunks()
 {
-	if (TerrainMeshPointsLoopFunction(nullptr,
-		[this](int32 i) { AddRiverEndPoint(i); },
-		AddRiverEndPointsLoopData,
-		Enum_TerrainGeneratorState::DivideUpperRiver,
-		true, ProgressWeight_AddRiverEndPoints)) {
-		UE_LOG(TerrainGenerator, Log, TEXT("AddRiverEndPoints done."));
-	}
+	ChunkToEndPoints([this](int32 i) { return TerrainMeshPointsData[i].PositionZRatio >= UpperRiverLimitZRatio; },
+		UpperRiverEndPoints);
+	ChunkToEndPoints([this](int32 i) { return TerrainMeshPointsData[i].PositionZRatio <= LowerRiverLimitZRatio; },
+		LowerRiverEndPoints);
+
+	ProgressPassed += ProgressWeight_DivideRiverEndPoints;
+	Progress = ProgressPassed;
+
+	WorkflowState = Enum_TerrainGeneratorState::CreateRiverLine;
+	SetWorkflowTimer(DefaultTimerRate);
+	UE_LOG(TerrainGenerator, Log, TEXT("Divide River EndPoints Into Chunks done."));
 }
 
-void ATerrainGenerator::AddRiverEndPoint(int32 Index)
+void ATerrainGenerator::ChunkToEndPoints(TFunctionRef<bool(int32)> InChunk, TArray<int32>& EndPoints)
 {
-	FStructTerrainMeshPointData Data = TerrainMeshPointsData[Index];
+	//One end point per chunk, largest chunk first, at the chunk's highest |Z|
+	TArray<int32> Labels;
+	TArray<FStructComponentStats> Stats;
+	ComponentLabelUtility::FindComponents(TerrainMeshPointsData.Num(),
+		InChunk,
+		[this](const int32& Current, int32& Next, int32& Index) { return NextPoint(Current, Next, Index); },
+		[this](int32 i) { return GetPointAxialCoord(i); },
+		[this](int32 i) { return FMath::Abs<float>(TerrainMeshPointsData[i].PositionZ); },
+		Labels, Stats);
 
-	if (Data.PositionZRatio >= UpperRiverLimitZRatio) {
-		UpperRiverIndices.Add(TerrainMeshPointsIndices[pGI->TerrainGridPoints[Data.GridDataIndex].AxialCoord]);
-	}
-	if (Data.PositionZRatio <= LowerRiverLimitZRatio) {
-		LowerRiverIndices.Add(TerrainMeshPointsIndices[pGI->TerrainGridPoints[Data.GridDataIndex].AxialCoord]);
+	TArray<int32> Order;
+	ComponentLabelUtility::SortComponentsBySize(Stats, Order);
+	for (int32 Id : Order)
+	{
+		EndPoints.Add(Stats[Id].Representative);
 	}
 }
 
-void ATerrainGenerator::DivideRiverEndPointsIntoChunks()
+void ATerrainGenerator::CreateFlowRiverLines()
 {
-	switch (WorkflowState)
-	{
-	case Enum_TerrainGeneratorState::DivideUpperRiver:
-		DivideUpperRiverEndPointsIntoChunks();
-		break;
-	case Enum_TerrainGeneratorState::DivideLowerRiver:
-		DivideLowerRiverEndPointsIntoChunks();
-		break;
-	default:
-		break;
+	CalTerrainFlow();
+	ExtractFlowRiverLines();
+
+	int32 Total = RiverLinePointDatas.Num();
+	if (Total > 0) {
+		CalRiverNoiseSampleRotValue(Total, Total - 1);
 	}
+
+	//Stands in for the end point pairing and path finding stages
+	ProgressPassed += ProgressWeight_DivideRiverEndPoints + ProgressWeight_FindRiverLines;
+	Progress = ProgressPassed;
+
+	WorkflowState = Enum_TerrainGeneratorState::DigRiverLine;
+	SetWorkflowTimer(DefaultTimerRate);
+	UE_LOG(TerrainGenerator, Log, TEXT("CreateFlowRiverLines done."));
 }
 
-void ATerrainGenerator::DivideUpperRiverEndPointsIntoChunks()
+void ATerrainGenerator::CalTerrainFlow()
 {
-	FTimerHandle TimerHandle;
-	auto InitFunc = [&]() {
-		UpperRiverDivideData.Seed = UpperRiverIndices;
+	int32 Num = TerrainMeshPointsData.Num();
+	auto NextFunc = [this](const int32& Current, int32& Next, int32& Index) { return NextPointD8(Current, Next, Index); };
+
+	TerrainHydrology::PriorityFloodFunction(Num,
+		[this](int32 i) { return TerrainMeshPointsData[i].PositionZRatio; },
+		[this](int32 i) { return IsTerrainEdgePoint(i); },
+		NextFunc, RiverFlowFillEpsilon,
+		FlowFilledZRatios, FlowOrder);
+	TerrainHydrology::FlowDirectionFunction(Num, FlowFilledZRatios, NextFunc,
+		[this](int32 Current, int32 Next) { return GetD8Distance(Current, Next); },
+		FlowDownstream);
+	TerrainHydrology::FlowAccumulationFunction(FlowOrder, FlowDownstream, FlowAccumulation);
+}
+
+void ATerrainGenerator::ExtractFlowRiverLines()
+{
+	//Channel points carry enough flow and are still above the lower river limit.
+	//A line starts at a channel head and runs downstream until the sea, the edge or another line.
+	int32 Num = TerrainMeshPointsData.Num();
+	auto IsChannel = [this](int32 i) {
+		return FlowAccumulation[i] >= RiverFlowAccumulationThreshold
+			&& TerrainMeshPointsData[i].PositionZRatio > LowerRiverLimitZRatio;
 		};
-	TArray<int32> Indices = {};
-	if (AStarUtility::BFSFCLoopFunction<int32>(this,
-		UpperRiverDivideData,
-		Indices,
-		UpperRiverDivideLoopData,
-		WorkflowDelegate,
-		InitFunc,
-		[this](const int32& Current, int32& Next, int32& Index) { return NextPoint(Current, Next, Index); },
-		[this]() { AddUpperRiverEndPointsChunk(); })) {
-		WorkflowState = Enum_TerrainGeneratorState::DivideLowerRiver;
-		GetWorldTimerManager().SetTimer(TimerHandle, WorkflowDelegate, UpperRiverDivideLoopData.Rate, false);
-		UE_LOG(TerrainGenerator, Log, TEXT("Divide UpperRiver EndPoints Into Chunks done."));
+
+	TArray<bool> HasChannelUpstream;
+	HasChannelUpstream.Init(false, Num);
+	for (int32 i = 0; i < Num; i++)
+	{
+		if (IsChannel(i) && FlowDownstream[i] != INDEX_NONE) {
+			HasChannelUpstream[FlowDownstream[i]] = true;
+		}
+	}
+
+	//Highest heads first, they trace the trunks and later heads join them as tributaries
+	TArray<int32> Heads;
+	for (int32 i = 0; i < Num; i++)
+	{
+		if (IsChannel(i) && !HasChannelUpstream[i]) {
+			Heads.Add(i);
+		}
+	}
+	Heads.Sort([this](int32 A, int32 B) {
+		if (FlowFilledZRatios[A] != FlowFilledZRatios[B]) {
+			return FlowFilledZRatios[A] > FlowFilledZRatios[B];
+		}
+		return A < B;
+		});
+
+	TArray<bool> Claimed;
+	Claimed.Init(false, Num);
+	TArray<int32> Line;
+	for (int32 j = 0; j < Heads.Num() && RiverLinePointDatas.Num() < MaxRiverNum; j++)
+	{
+		if (!TraceFlowRiverLine(Heads[j], Claimed, Line)) {
+			continue;
+		}
+		for (int32 PointIndex : Line)
+		{
+			Claimed[PointIndex] = true;
+		}
+		FStructRiverLinePointData Data;
+		Data.UpperPointIndex = Line[0];
+		Data.LowerPointIndex = Line.Last();
+		Data.LinePointIndices = Line;
+		RiverLinePointDatas.Add(Data);
 	}
+	UE_LOG(TerrainGenerator, Log, TEXT("Add %d flow river lines from %d channel heads."), RiverLinePointDatas.Num(), Heads.Num());
 }
 
-void ATerrainGenerator::DivideLowerRiverEndPointsIntoChunks()
+bool ATerrainGenerator::TraceFlowRiverLine(int32 HeadIndex, const TArray<bool>& Claimed, TArray<int32>& OutLine)
 {
-	FTimerHandle TimerHandle;
-	auto InitFunc = [&]() {
-		LowerRiverDivideData.Seed = LowerRiverIndices;
-		};
-	TArray<int32> Indices = {};
-	if (AStarUtility::BFSFCLoopFunction<int32>(this,
-		LowerRiverDivideData,
-		Indices,
-		LowerRiverDivideLoopData,
-		WorkflowDelegate,
-		InitFunc,
-		[this](const int32& Current, int32& Next, int32& Index) { return NextPoint(Current, Next, Index); },
-		[this]() { AddLowerRiverEndPointsChunk(); })) {
-		WorkflowState = Enum_TerrainGeneratorState::ChunkToOnePoint;
-		GetWorldTimerManager().SetTimer(TimerHandle, WorkflowDelegate, LowerRiverDivideLoopData.Rate, false);
-		UE_LOG(TerrainGenerator, Log, TEXT("Divide LowerRiver EndPoints Into Chunks done."));
+	OutLine.Reset();
+	int32 Current = HeadIndex;
+	while (Current != INDEX_NONE) {
+		OutLine.Add(Current);
+		//Joins the confluence point then stops
+		if (Claimed[Current] || TerrainMeshPointsData[Current].PositionZRatio <= LowerRiverLimitZRatio) {
+			break;
+		}
+		Current = FlowDownstream[Current];
 	}
+	return OutLine.Num() >= FMath::Max(MinRiverLength, 2);
 }
 
 bool ATerrainGenerator::NextPoint(const int32& Current, int32& Next, int32& Index)
 {
-	FStructGridDataNeighbors Neighbors = pGI->TerrainGridPoints[TerrainMeshPointsData[Current].GridDataIndex].Neighbors[0];
+	const FStructGridDataNeighbors& Neighbors = pGI->TerrainGridPoints[TerrainMeshPointsData[Current].GridDataIndex].Neighbors[0];
 	if (Index < Neighbors.Points.Num()) {
 		FIntPoint key = Neighbors.Points[Index];
 		if (TerrainMeshPointsIndices.Contains(key)) {
@@ -815,86 +1519,87 @@ bool ATerrainGenerator::NextPoint(const int32& Current, int32& Next, int32& Inde
 	return false;
 }
 
-void ATerrainGenerator::AddUpperRiverEndPointsChunk()
-{
-	UpperRiverChunks.Add(UpperRiverDivideData.Reached);
-}
-
-void ATerrainGenerator::AddLowerRiverEndPointsChunk()
+bool ATerrainGenerator::NextPointD8(const int32& Current, int32& Next, int32& Index)
 {
-	LowerRiverChunks.Add(LowerRiverDivideData.Reached);
+	static const FIntPoint D8Offsets[8] = {
+		FIntPoint(1, 0), FIntPoint(0, 1), FIntPoint(-1, 0), FIntPoint(0, -1),
+		FIntPoint(1, 1), FIntPoint(-1, 1), FIntPoint(-1, -1), FIntPoint(1, -1)
+	};
+	if (Index < 8) {
+		const int32* Found = TerrainMeshPointsIndices.Find(GetPointAxialCoord(Current) + D8Offsets[Index]);
+		if (Found) {
+			Next = *Found;
+		}
+		Index++;
+		return true;
+	}
+	return false;
 }
 
-void ATerrainGenerator::RiverChunkToOnePoint()
+float ATerrainGenerator::GetD8Distance(int32 Current, int32 Next)
 {
-	ChunkToOnePoint(UpperRiverChunks, UpperRiverEndPoints);
-	ChunkToOnePoint(LowerRiverChunks, LowerRiverEndPoints);
-
-	FTimerHandle TimerHandle;
-	WorkflowState = Enum_TerrainGeneratorState::CreateRiverLine;
-	GetWorldTimerManager().SetTimer(TimerHandle, WorkflowDelegate, DefaultTimerRate, false);
-	UE_LOG(TerrainGenerator, Log, TEXT("RiverChunkToOnePoint done."));
+	FIntPoint Delta = GetPointAxialCoord(Next) - GetPointAxialCoord(Current);
+	return (Delta.X != 0 && Delta.Y != 0) ? UE_SQRT_2 : 1.0;
 }
 
-void ATerrainGenerator::ChunkToOnePoint(TArray<TSet<int32>>& Chunk, TArray<int32>& EndPoints)
+bool ATerrainGenerator::IsTerrainEdgePoint(int32 Index)
 {
-	Chunk.Sort([](const TSet<int32>& A, const TSet<int32>& B) {
-		return A.Num() > B.Num();
-		});
-	for (int32 i = 0; i < Chunk.Num(); i++) {
-		TArray<int32> arr = Chunk[i].Array();
-		int32 MaxZIndex = 0;
-		float MaxZ = 0.0;
-		float CurrentZ = 0.0;
-		for (int32 j = 0; j < arr.Num(); j++) {
-			CurrentZ = FMath::Abs<float>(TerrainMeshPointsData[arr[j]].PositionZ);
-			if (CurrentZ > MaxZ) {
-				MaxZIndex = arr[j];
-				MaxZ = CurrentZ;
-			}
+	const FStructGridDataNeighbors& Neighbors = pGI->TerrainGridPoints[TerrainMeshPointsData[Index].GridDataIndex].Neighbors[0];
+	for (const FIntPoint& Key : Neighbors.Points)
+	{
+		if (!TerrainMeshPointsIndices.Contains(Key)) {
+			return true;
 		}
-		EndPoints.Add(MaxZIndex);
 	}
+	return Neighbors.Points.Num() < QUAD_SIDE_NUM;
 }
 
 void ATerrainGenerator::CreateRiverLine()
 {
 	CreateRiverLinePointDatas();
 
-	FTimerHandle TimerHandle;
 	WorkflowState = Enum_TerrainGeneratorState::FindRiverLines;
-	GetWorldTimerManager().SetTimer(TimerHandle, WorkflowDelegate, DefaultTimerRate, false);
+	SetWorkflowTimer(DefaultTimerRate);
 	UE_LOG(TerrainGenerator, Log, TEXT("CreateRiverLine done."));
 }
 
 void ATerrainGenerator::CreateRiverLinePointDatas()
 {
-	for (int32 i = 0; i < MaxRiverNum; i++) {
-		bool find = false;
-		int32 j = 0;
-		int32 k = 0;
-		for (j = 0; j < UpperRiverEndPoints.Num(); j++) {
-			for (k = 0; k < LowerRiverEndPoints.Num(); k++) {
-				int32 distance = GetPointsDistance(UpperRiverEndPoints[j], LowerRiverEndPoints[k]);
-				if (distance >= MinRiverLength) {
-					FStructRiverLinePointData data;
-					data.UpperPointIndex = UpperRiverEndPoints[j];
-					data.LowerPointIndex = LowerRiverEndPoints[k];
-					RiverLinePointDatas.Add(data);
-					find = true;
-					break;
-				}
-			}
-			if (find) {
-				break;
-			}
+	//Upper points keep their chunk-size priority, each one pairs with the nearest lower point
+	//that is at least MinRiverLength away
+	int32 CellSize = FMath::Max(MinRiverLength, MinRiverSpacing) / 2;
+	PointGridIndex LowerIndex(CellSize);
+	for (int32 k = 0; k < LowerRiverEndPoints.Num(); k++) {
+		LowerIndex.Add(k, GetPointAxialCoord(LowerRiverEndPoints[k]));
+	}
+	PointGridIndex UsedUpperIndex(CellSize);
+
+	TArray<int32> Found;
+	for (int32 j = 0; j < UpperRiverEndPoints.Num() && RiverLinePointDatas.Num() < MaxRiverNum; j++) {
+		FIntPoint UpperCoord = GetPointAxialCoord(UpperRiverEndPoints[j]);
+		if (MinRiverSpacing > 0 && UsedUpperIndex.HasPointInRadius(UpperCoord, MinRiverSpacing - 1)) {
+			continue;
 		}
-		if (find) {
-			UpperRiverEndPoints.RemoveAt(j);
-			LowerRiverEndPoints.RemoveAt(k);
+
+		LowerIndex.FindNearest(UpperCoord, 1, MinRiverLength, Found);
+		if (Found.IsEmpty()) {
+			continue;
 		}
-		else {
-			break;
+		int32 k = Found[0];
+		FIntPoint LowerCoord = GetPointAxialCoord(LowerRiverEndPoints[k]);
+
+		FStructRiverLinePointData data;
+		data.UpperPointIndex = UpperRiverEndPoints[j];
+		data.LowerPointIndex = LowerRiverEndPoints[k];
+		RiverLinePointDatas.Add(data);
+		UsedUpperIndex.Add(j, UpperCoord);
+
+		LowerIndex.Remove(k, LowerCoord);
+		if (MinRiverSpacing > 0) {
+			LowerIndex.QueryRadius(LowerCoord, MinRiverSpacing - 1, Found);
+			for (int32 Near : Found) {
+				LowerIndex.Remove(Near, GetPointAxialCoord(LowerRiverEndPoints[Near]));
+			}
 		}
 	}
 	UE_LOG(TerrainGenerator, Log, TEXT("Add %d river line data."), RiverLinePointDatas.Num());
@@ -902,71 +1607,65 @@ void ATerrainGenerator::CreateRiverLinePointDatas()
 
 void ATerrainGenerator::FindRiverLines()
 {
-	TArray<int32> Indices = { 0 };
-	int32 i = FindRiverLinesLoopData.IndexSaved[0];
-	for (; i < RiverLinePointDatas.Num(); i++) {
-		Indices[0] = i;
-
-		if (!FindRiverLinesLoopData.HasInitialized) {
-			FindRiverLinesLoopData.HasInitialized = true;
-			AStarUtility::ClearAStarData(FindRiverLineData);
-			int32 Start = RiverLinePointDatas[i].UpperPointIndex;
-			FindRiverLineData.Frontier.Push(Start, 0.0);
-			FindRiverLineData.CameFrom.Add(Start, -1);
-			FindRiverLineData.CostSoFar.Add(Start, 0.0);
-			FindRiverLineData.Goal = RiverLinePointDatas[i].LowerPointIndex;
-
-			CalRiverNoiseSampleRotValue(RiverLinePointDatas.Num(), i);
-		}
-
-		if (AStarUtility::AStarSearchLoopFunction<int32>(this,
-			FindRiverLineData,
-			Indices,
-			FindRiverLinesLoopData,
-			WorkflowDelegate,
-			nullptr,
+	//River pairs are independent, each task keeps its own search state and writes its own line
+	int32 Total = RiverLinePointDatas.Num();
+	int32 Num = TerrainMeshPointsData.Num();
+	TArray<FStructDenseAStarData> AStarDatas;
+	ParallelForWithTaskContext(AStarDatas, Total, [&](FStructDenseAStarData& AStarData, int32 i) {
+		FStructRiverLinePointData& LineData = RiverLinePointDatas[i];
+		FVector2D SampleRot = GetRiverNoiseSampleRot(Total, i);
+		if (!AStarUtility::DenseAStarSearchFunction(AStarData, Num,
+			LineData.UpperPointIndex, LineData.LowerPointIndex,
 			[this](const int32& Current, int32& Next, int32& Index) { return NextPoint(Current, Next, Index); },
-			[this](const int32& Current, const int32& Next) { return RiverDirectionCost(Current, Next); },
-			[this](const int32& Goal, const int32& Next) { return RiverDirectionHeuristic(Goal, Next); })) {
-			AStarUtility::ReconstructPath<int32>(FindRiverLineData.Goal,
-				RiverLinePointDatas[i].UpperPointIndex, 
-				FindRiverLineData.CameFrom,
-				RiverLinePointDatas[i].LinePointIndices);
-			
-			FindRiverLinesLoopData.HasInitialized = false;
-			
-		}
-		else {
-			return;
+			[this, SampleRot](const int32& Current, const int32& Next) { return RiverDirectionCost(Next, SampleRot); },
+			[this](const int32& Goal, const int32& Next) { return RiverDirectionHeuristic(Goal, Next); },
+			LineData.LinePointIndices)) {
+			UE_LOG(TerrainGenerator, Warning, TEXT("River line %d can not reach its lower point!"), i);
 		}
-		Progress = ProgressPassed + (float)(i + 1) / (float)RiverLinePointDatas.Num() * ProgressWeight_FindRiverLines;
+		});
+
+	//Depth noise of the dig stages samples with the last river rotation
+	if (Total > 0) {
+		CalRiverNoiseSampleRotValue(Total, Total - 1);
 	}
 
 	ProgressPassed += ProgressWeight_FindRiverLines;
+	Progress = ProgressPassed;
 
-	FTimerHandle TimerHandle;
 	WorkflowState = Enum_TerrainGeneratorState::DigRiverLine;
-	GetWorldTimerManager().SetTimer(TimerHandle, WorkflowDelegate, DefaultTimerRate, false);
+	SetWorkflowTimer(DefaultTimerRate);
 	UE_LOG(TerrainGenerator, Log, TEXT("FindRiverLines done."));
 }
 
+FVector2D ATerrainGenerator::GetRiverNoiseSampleRot(int32 Total, int32 Index)
+{
+	float Angle = 2.0 * PI / (float)Total * (float)Index;
+	return FVector2D(FMath::Sin(Angle), FMath::Cos(Angle));
+}
+
 void ATerrainGenerator::CalRiverNoiseSampleRotValue(int32 Total, int32 Index)
 {
-	RiverNoiseSampleRotSin = FMath::Sin(2.0 * PI / (float)Total * (float)Index);
-	RiverNoiseSampleRotCos = FMath::Cos(2.0 * PI / (float)Total * (float)Index);
+	FVector2D SampleRot = GetRiverNoiseSampleRot(Total, Index);
+	RiverNoiseSampleRotSin = SampleRot.X;
+	RiverNoiseSampleRotCos = SampleRot.Y;
 }
 
 FVector2D ATerrainGenerator::GetRiverRotatedAxialCoord(FIntPoint AxialCoord)
 {
-	float X = (float)AxialCoord.X * RiverNoiseSampleRotCos - (float)AxialCoord.Y * RiverNoiseSampleRotSin;
-	float Y = (float)AxialCoord.X * RiverNoiseSampleRotSin + (float)AxialCoord.Y * RiverNoiseSampleRotCos;
+	return GetRiverRotatedAxialCoord(AxialCoord, FVector2D(RiverNoiseSampleRotSin, RiverNoiseSampleRotCos));
+}
+
+FVector2D ATerrainGenerator::GetRiverRotatedAxialCoord(FIntPoint AxialCoord, const FVector2D& SampleRot)
+{
+	float X = (float)AxialCoord.X * SampleRot.Y - (float)AxialCoord.Y * SampleRot.X;
+	float Y = (float)AxialCoord.X * SampleRot.X + (float)AxialCoord.Y * SampleRot.Y;
 	return FVector2D(X, Y);
 }
 
-float ATerrainGenerator::RiverDirectionCost(const int32& Current, const int32& Next)
+float ATerrainGenerator::RiverDirectionCost(const int32& Next, const FVector2D& SampleRot)
 {
 	FIntPoint AxialCoord = GetPointAxialCoord(Next);
-	FVector2D Coord = GetRiverRotatedAxialCoord(AxialCoord);
+	FVector2D Coord = GetRiverRotatedAxialCoord(AxialCoord, SampleRot);
 	float CostN = RiverDirectionNoiseCost(Coord.X, Coord.Y);
 	float CostA = RiverDirectionAltitudeCost(Next);
 	float Cost = (CostN + CostA) > 0 ? (CostN + CostA) : 0.0;
@@ -1002,133 +1701,155 @@ float ATerrainGenerator::RiverDirectionHeuristic(const int32& Goal, const int32&
 
 void ATerrainGenerator::DigRiverLine()
 {
-	TArray<int32> Indices = { 0, 0 };
-	int32 Count = 0;
-	bool SaveLoopFlag = false;
+	SetRiverBlockZRatio();
 
-	int32 i = DigRiverLineLoopData.IndexSaved[0];
-	for (; i < RiverLinePointDatas.Num(); i++)
+	RiverCarveSources.Empty();
+	RiverCarveSourceIndices.Empty();
+	for (const FStructRiverLinePointData& LinePointData : RiverLinePointDatas)
 	{
-		Indices[0] = i;
-		FStructRiverLinePointData LinePointData = RiverLinePointDatas[i];
+		AddRiverLineCarveSources(LinePointData);
+	}
 
-		int32 j = 0;
-		if (!DigRiverLineLoopData.HasInitialized) {
-			DigRiverLineLoopData.HasInitialized = true;
+	TArray<int32> Distances;
+	TArray<int32> BestSources;
+	CalRiverCarveField([this](int32 Index) { return !IsBlock(TerrainMeshPointsData[Index]); },
+		Distances, BestSources);
 
-			RiverLinePointBlockTestSet.Empty();
-			CurrentLineDepthRatio = RiverDepthRatioStart;
-		}
-		else {
-			j = DigRiverLineLoopData.IndexSaved[1];
+	ParallelFor(TerrainMeshPointsData.Num(), [&](int32 i) {
+		if (BestSources[i] == INDEX_NONE) {
+			return;
 		}
+		const FStructRiverCarveSource& Source = RiverCarveSources[BestSources[i]];
+		float ZRatio = GetRiverProfileRatio(Distances[i], Source.Radius) * Source.DepthRatio;
+		ZRatio = ZRatio > TerrainMeshPointsData[i].RiverBlockZRatio ? ZRatio : TerrainMeshPointsData[i].RiverBlockZRatio;
+		UpdateRiverPointZ(i, ZRatio);
+		});
 
-		
-		for (; j < LinePointData.LinePointIndices.Num(); j++)
-		{
-			Indices[1] = j;
-
-			FlowControlUtility::SaveLoopData(this, DigRiverLineLoopData, Count, Indices, WorkflowDelegate, SaveLoopFlag);
-			if (SaveLoopFlag) {
-				return;
-			}
+	ProgressPassed += ProgressWeight_DigRiverLine;
+	Progress = ProgressPassed;
 
-			CurrentLinePointIndex = LinePointData.LinePointIndices[j];
-			float ZRatio = TerrainMeshPointsData[CurrentLinePointIndex].PositionZRatio;
-			if (ZRatio > AltitudeBlockRatio) {
-				continue;
-			}
-			
-			float BlockZRatioByNeighbor = FindRiverBlockZByNeighbor(CurrentLinePointIndex);
-			CurrentLineDepthRatio = CurrentLineDepthRatio > BlockZRatioByNeighbor ? CurrentLineDepthRatio : BlockZRatioByNeighbor;
-			UpdateRiverPointZ(CurrentLinePointIndex, CurrentLineDepthRatio);
+	WorkflowState = Enum_TerrainGeneratorState::DigRiverPool;
+	SetWorkflowTimer(DefaultTimerRate);
+	UE_LOG(TerrainGenerator, Log, TEXT("DigRiverLine done."));
+}
 
-			UnitLineRisingStep = FMath::Abs(CurrentLineDepthRatio) / RiverDepthRisingStep;
+void ATerrainGenerator::SetRiverBlockZRatio()
+{
+	//River gets shallower near blocked points, one RiverDepthChangeStep per grid step
+	int32 MaxDistance = FMath::CeilToInt(1.0 / FMath::Max(RiverDepthChangeStep, KINDA_SMALL_NUMBER)) + 1;
+	TArray<int32> Distances;
+	AStarUtility::DistanceTransformFunction(TerrainMeshPointsData.Num(),
+		[this](int32 Index) { return IsBlock(TerrainMeshPointsData[Index]); },
+		[this](const int32& Current, int32& Next, int32& Index) { return NextPoint(Current, Next, Index); },
+		MaxDistance, Distances);
 
-			TStructBFSData<int32> BFSData;
-			BFSData.Frontier.Enqueue(CurrentLinePointIndex);
-			BFSData.Reached.Add(CurrentLinePointIndex);
-			AStarUtility::BFSFunction<int32>(BFSData,
-				[this](const int32& Current, int32& Next, int32& Index, TSet<int32>& Reached) { return DigRiverNextPoint(Current, Next, Index, Reached); });
+	for (int32 i = 0; i < TerrainMeshPointsData.Num(); i++)
+	{
+		if (Distances[i] == MaxDistance) {
+			TerrainMeshPointsData[i].RiverBlockZRatio = -1.0 - RiverDepthChangeStep;
+		}
+		else {
+			TerrainMeshPointsData[i].RiverBlockZRatio = -(float)Distances[i] * RiverDepthChangeStep;
+		}
+	}
+}
 
-			FIntPoint AxialCoord = GetPointAxialCoord(CurrentLinePointIndex);
-			FVector2D Coord = GetRiverRotatedAxialCoord(AxialCoord);
-			float DepthNoise = Noise->NWRiverDepth->GetNoise2D(Coord.X * RiverDepthSampleScale,
-				Coord.Y * RiverDepthSampleScale);
+void ATerrainGenerator::AddRiverLineCarveSources(const FStructRiverLinePointData& LinePointData)
+{
+	float DepthRatio = RiverDepthRatioStart;
+	for (int32 PointIndex : LinePointData.LinePointIndices)
+	{
+		const FStructTerrainMeshPointData& Data = TerrainMeshPointsData[PointIndex];
+		if (IsBlock(Data)) {
+			continue;
+		}
+		DepthRatio = DepthRatio > Data.RiverBlockZRatio ? DepthRatio : Data.RiverBlockZRatio;
+		AddRiverCarveSource(PointIndex, DepthRatio, RiverDepthRisingStep);
+		DepthRatio = GetNextLineDepthRatio(DepthRatio, PointIndex, RiverDepthRatioMin, RiverDepthRatioMax);
+	}
+}
 
-			if (CurrentLineDepthRatio > RiverDepthRatioMin) {
-				CurrentLineDepthRatio -= RiverDepthChangeStep;
-			}
-			else {
-				if (DepthNoise > 0.0) {
-					CurrentLineDepthRatio += RiverDepthChangeStep;
-					if (CurrentLineDepthRatio > RiverDepthRatioMin) {
-						CurrentLineDepthRatio = RiverDepthRatioMin;
-					}
-				}
-				else {
-					CurrentLineDepthRatio -= RiverDepthChangeStep;
-					if (CurrentLineDepthRatio < RiverDepthRatioMax) {
-						CurrentLineDepthRatio = RiverDepthRatioMax;
-					}
-				}
-			}
+void ATerrainGenerator::AddRiverPoolCarveSources(const FStructRiverLinePointData& LinePointData)
+{
+	float DepthRatio = RiverDepthRatioStart;
+	for (int32 PointIndex : LinePointData.LinePointIndices)
+	{
+		if (TerrainMeshPointsData[PointIndex].PositionZRatio < RiverPoolCombineLower) {
+			break;
+		}
+		AddRiverCarveSource(PointIndex, DepthRatio, RiverPoolDepthRisingStep);
+		DepthRatio = GetNextLineDepthRatio(DepthRatio, PointIndex, RiverPoolDepthRatioMin, RiverPoolDepthRatioMax);
+	}
+}
 
-			Count++;
-			Progress = ProgressPassed + (float)DigRiverLineLoopData.Count / (float)GetTotalRiverLinePointNum() * ProgressWeight_DigRiverLine;
+void ATerrainGenerator::AddRiverCarveSource(int32 PointIndex, float DepthRatio, float RisingStep)
+{
+	FStructRiverCarveSource Source;
+	Source.PointIndex = PointIndex;
+	Source.DepthRatio = DepthRatio;
+	Source.Radius = FMath::Abs(DepthRatio) / FMath::Max(RisingStep, KINDA_SMALL_NUMBER);
 
+	//Crossing rivers keep the deeper carve
+	int32* Found = RiverCarveSourceIndices.Find(PointIndex);
+	if (Found) {
+		if (RiverCarveSources[*Found].DepthRatio > DepthRatio) {
+			RiverCarveSources[*Found] = Source;
 		}
-		DigRiverLineLoopData.HasInitialized = false;
+		return;
 	}
+	RiverCarveSourceIndices.Add(PointIndex, RiverCarveSources.Add(Source));
+}
 
-	ProgressPassed += ProgressWeight_DigRiverLine;
+float ATerrainGenerator::GetNextLineDepthRatio(float DepthRatio, int32 PointIndex, 
+	float DepthRatioMin, float DepthRatioMax)
+{
+	if (DepthRatio > DepthRatioMin) {
+		return DepthRatio - RiverDepthChangeStep;
+	}
 
-	FTimerHandle TimerHandle;
-	WorkflowState = Enum_TerrainGeneratorState::DigRiverPool;
-	GetWorldTimerManager().SetTimer(TimerHandle, WorkflowDelegate, DefaultTimerRate, false);
-	UE_LOG(TerrainGenerator, Log, TEXT("DigRiverLine done."));
+	FIntPoint AxialCoord = GetPointAxialCoord(PointIndex);
+	FVector2D Coord = GetRiverRotatedAxialCoord(AxialCoord);
+	float DepthNoise = Noise->NWRiverDepth->GetNoise2D(Coord.X * RiverDepthSampleScale,
+		Coord.Y * RiverDepthSampleScale);
+	if (DepthNoise > 0.0) {
+		DepthRatio += RiverDepthChangeStep;
+		return DepthRatio > DepthRatioMin ? DepthRatioMin : DepthRatio;
+	}
+	DepthRatio -= RiverDepthChangeStep;
+	return DepthRatio < DepthRatioMax ? DepthRatioMax : DepthRatio;
 }
 
-int32 ATerrainGenerator::GetTotalRiverLinePointNum()
+void ATerrainGenerator::CalRiverCarveField(TFunctionRef<bool(int32 Index)> CanCarve,
+	TArray<int32>& OutDistances, TArray<int32>& OutBestSources)
 {
-	int32 Num = 0;
-	for (int32 i = 0; i < RiverLinePointDatas.Num(); i++)
+	TArray<int32> Sources;
+	Sources.Reserve(RiverCarveSources.Num());
+	for (const FStructRiverCarveSource& Source : RiverCarveSources)
 	{
-		Num += RiverLinePointDatas[i].LinePointIndices.Num();
+		Sources.Add(Source.PointIndex);
 	}
-	return Num;
+
+	//The deepest profile wins, so a narrow source never notches a wider river or pool next to it
+	AStarUtility::BestSourceTransformFunction(TerrainMeshPointsData.Num(), Sources,
+		[this](const int32& Current, int32& Next, int32& Index) { return NextPoint(Current, Next, Index); },
+		[&](int32 Index, int32 SourceId, int32 Distance) {
+			return (float)Distance < RiverCarveSources[SourceId].Radius && CanCarve(Index);
+		},
+		[this](int32 SourceId, int32 Distance) {
+			const FStructRiverCarveSource& Source = RiverCarveSources[SourceId];
+			return GetRiverProfileRatio(Distance, Source.Radius) * Source.DepthRatio;
+		},
+		OutDistances, OutBestSources);
 }
 
-float ATerrainGenerator::FindRiverBlockZByNeighbor(int32 Index)
+float ATerrainGenerator::GetRiverProfileRatio(int32 Distance, float Radius)
 {
-	float BlockZRatio = -1.0;
-	FStructGridDataNeighbors Neighbors = pGI->TerrainGridPoints[TerrainMeshPointsData[Index].GridDataIndex].Neighbors[0];
-	for (int32 i = 0; i < Neighbors.Points.Num(); i++) {
-		FIntPoint key = Neighbors.Points[i];
-		if (TerrainMeshPointsIndices.Contains(key)) {
-			int32 NIndex = TerrainMeshPointsIndices[key];
-			float zRatio = TerrainMeshPointsData[NIndex].PositionZRatio;
-			float NBlockZRatio = TerrainMeshPointsData[NIndex].RiverBlockZRatio;
-			if (zRatio > AltitudeBlockRatio) {
-				BlockZRatio = 0.0;
-				if (!RiverLinePointBlockTestSet.Contains(Index)) {
-					RiverLinePointBlockTestSet.Add(Index);
-				}
-				break;
-			}else if (RiverLinePointBlockTestSet.Contains(NIndex)) {
-				if (NBlockZRatio > BlockZRatio) {
-					if (!RiverLinePointBlockTestSet.Contains(Index)) {
-						RiverLinePointBlockTestSet.Add(Index);
-					}
-					BlockZRatio = NBlockZRatio;
-				}
-			}
-		}
+	//X is 1 at the river center and 0 at the bank
+	float X = (Radius - (float)Distance) / Radius;
+	if (RiverProfileCurve) {
+		return RiverProfileCurve->GetFloatValue(X);
 	}
-	BlockZRatio -= RiverDepthChangeStep;
-	BlockZRatio = BlockZRatio > 0.0 ? 0.0 : BlockZRatio;
-	TerrainMeshPointsData[Index].RiverBlockZRatio = BlockZRatio;
-	return BlockZRatio;
+	return X < 0.5 ? FMath::Pow(X, 5.0) * 16.0 : 1 - FMath::Pow(-2.0 * X + 2.0, 5.0) / 2.0;
 }
 
 void ATerrainGenerator::UpdateRiverPointZ(int32 Index, float ZRatio)
@@ -1136,128 +1857,45 @@ void ATerrainGenerator::UpdateRiverPointZ(int32 Index, float ZRatio)
 	if (TerrainMeshPointsData[Index].PositionZRatio > ZRatio) {
 		TerrainMeshPointsData[Index].PositionZRatio = ZRatio;
 		TerrainMeshPointsData[Index].PositionZ = ZRatio * TileAltitudeMultiplier;
+		TerrainMeshPointsData[Index].HasAnalyticGradient = false;
 		Vertices[Index].Z = TerrainMeshPointsData[Index].PositionZ;
 	}
 }
 
-bool ATerrainGenerator::DigRiverNextPoint(const int32& Current, int32& Next, 
-	int32& Index, TSet<int32>& Reached)
-{
-	int32 dis = GetPointsDistance(CurrentLinePointIndex, Current);
-	float diff = UnitLineRisingStep - (float)dis - 1.0;
-	if (diff > 0) {
-		float X = diff / UnitLineRisingStep;
-		float ZRatio = X < 0.5 ? FMath::Pow(X, 5.0) * 16.0 : 1 - FMath::Pow(-2.0 * X + 2.0, 5.0) / 2.0;
-		ZRatio *= CurrentLineDepthRatio;
-		FStructGridDataNeighbors Neighbors = pGI->TerrainGridPoints[TerrainMeshPointsData[Current].GridDataIndex].Neighbors[0];
-		if (Index < Neighbors.Points.Num()) {
-			FIntPoint key = Neighbors.Points[Index];
-			if (TerrainMeshPointsIndices.Contains(key)) {
-				Next = TerrainMeshPointsIndices[key];
-				float Z = TerrainMeshPointsData[Next].PositionZRatio;
-				if (Z > AltitudeBlockRatio) {
-					if (!Reached.Contains(Next)) {
-						Reached.Add(Next);
-					}
-				}
-				else {
-					float BlockZRatioByNeighbor = FindRiverBlockZByNeighbor(Next);
-					ZRatio = ZRatio > BlockZRatioByNeighbor ? ZRatio : BlockZRatioByNeighbor;
-					UpdateRiverPointZ(Next, ZRatio);
-				}
-			}
-			Index++;
-			return true;
-		}
-	}
-	return false;
-}
-
 void ATerrainGenerator::DigRiverPool()
 {
 	if (!HasRiverPool) {
 		ProgressPassed += ProgressWeight_DigRiverPool;
-		FTimerHandle TimerHandle;
 		WorkflowState = Enum_TerrainGeneratorState::CreateVertexColorsForAMTB;
-		GetWorldTimerManager().SetTimer(TimerHandle, WorkflowDelegate, DefaultTimerRate, false);
+		SetWorkflowTimer(DefaultTimerRate);
 		UE_LOG(TerrainGenerator, Log, TEXT("DigRiverPool done."));
+		return;
 	}
-	
-	TArray<int32> Indices = { 0, 0 };
-	int32 Count = 0;
-	bool SaveLoopFlag = false;
 
-	int32 i = DigRiverPoolLoopData.IndexSaved[0];
-	for (; i < RiverLinePointDatas.Num(); i++)
+	RiverCarveSources.Empty();
+	RiverCarveSourceIndices.Empty();
+	for (const FStructRiverLinePointData& LinePointData : RiverLinePointDatas)
 	{
-		Indices[0] = i;
-		FStructRiverLinePointData LinePointData = RiverLinePointDatas[i];
+		AddRiverPoolCarveSources(LinePointData);
+	}
 
-		int32 j = 0;
-		if (!DigRiverPoolLoopData.HasInitialized) {
-			DigRiverPoolLoopData.HasInitialized = true;
-			CurrentLineDepthRatio = RiverDepthRatioStart;
-		}
-		else {
-			j = DigRiverPoolLoopData.IndexSaved[1];
-		}
-		
-		for (; j < LinePointData.LinePointIndices.Num(); j++)
-		{
-			Indices[1] = j;
-			FlowControlUtility::SaveLoopData(this, DigRiverPoolLoopData, Count, Indices, WorkflowDelegate, SaveLoopFlag);
-			if (SaveLoopFlag) {
-				return;
-			}
-			
-			CurrentLinePointIndex = LinePointData.LinePointIndices[j];
-			float ZRatio = TerrainMeshPointsData[CurrentLinePointIndex].PositionZRatio;
-			if (ZRatio < RiverPoolCombineLower) {
-				break;
-			}
+	TArray<int32> Distances;
+	TArray<int32> BestSources;
+	CalRiverCarveField([](int32 Index) { return true; }, Distances, BestSources);
 
-			UpdateRiverPoolZ(CurrentLinePointIndex, CurrentLineDepthRatio);
-			UnitLineRisingStep = FMath::Abs(CurrentLineDepthRatio) / RiverPoolDepthRisingStep;
-			
-			TStructBFSData<int32> BFSData;
-			BFSData.Frontier.Enqueue(CurrentLinePointIndex);
-			BFSData.Reached.Add(CurrentLinePointIndex);
-			AStarUtility::BFSFunction<int32>(BFSData,
-				[this](const int32& Current, int32& Next, int32& Index, TSet<int32>& Reached) { return DigRiverPoolNextPoint(Current, Next, Index, Reached); });
-
-			FIntPoint AxialCoord = GetPointAxialCoord(CurrentLinePointIndex);
-			FVector2D Coord = GetRiverRotatedAxialCoord(AxialCoord);
-			float DepthNoise = Noise->NWRiverDepth->GetNoise2D(Coord.X * RiverDepthSampleScale,
-				Coord.Y * RiverDepthSampleScale);
-
-			if (CurrentLineDepthRatio > RiverPoolDepthRatioMin) {
-				CurrentLineDepthRatio -= RiverDepthChangeStep;
-			}
-			else {
-				if (DepthNoise > 0.0) {
-					CurrentLineDepthRatio += RiverDepthChangeStep;
-					if (CurrentLineDepthRatio > RiverPoolDepthRatioMin) {
-						CurrentLineDepthRatio = RiverPoolDepthRatioMin;
-					}
-				}
-				else {
-					CurrentLineDepthRatio -= RiverDepthChangeStep;
-					if (CurrentLineDepthRatio < RiverPoolDepthRatioMax) {
-						CurrentLineDepthRatio = RiverPoolDepthRatioMax;
-					}
-				}
-			}
-			Count++;
+	ParallelFor(TerrainMeshPointsData.Num(), [&](int32 i) {
+		if (BestSources[i] == INDEX_NONE) {
+			return;
 		}
-		Progress = ProgressPassed + (float)(i + 1) / (float)RiverLinePointDatas.Num() * ProgressWeight_DigRiverPool;
-		DigRiverPoolLoopData.HasInitialized = false;
-	}
+		const FStructRiverCarveSource& Source = RiverCarveSources[BestSources[i]];
+		UpdateRiverPoolZ(i, GetRiverProfileRatio(Distances[i], Source.Radius) * Source.DepthRatio);
+		});
 
 	ProgressPassed += ProgressWeight_DigRiverPool;
+	Progress = ProgressPassed;
 
-	FTimerHandle TimerHandle;
 	WorkflowState = Enum_TerrainGeneratorState::CombinePoolToTerrain;
-	GetWorldTimerManager().SetTimer(TimerHandle, WorkflowDelegate, DefaultTimerRate, false);
+	SetWorkflowTimer(DefaultTimerRate);
 	UE_LOG(TerrainGenerator, Log, TEXT("DigRiverPool done."));
 }
 
@@ -1268,28 +1906,6 @@ void ATerrainGenerator::UpdateRiverPoolZ(int32 Index, float ZRatio)
 	}
 }
 
-bool ATerrainGenerator::DigRiverPoolNextPoint(const int32& Current, int32& Next, int32& Index, TSet<int32>& Reached)
-{
-	int32 dis = GetPointsDistance(CurrentLinePointIndex, Current);
-	float diff = UnitLineRisingStep - (float)dis - 1.0;
-	if (diff > 0) {
-		float X = diff / UnitLineRisingStep;
-		float ZRatio = X < 0.5 ? FMath::Pow(X, 5.0) * 16.0 : 1 - FMath::Pow(-2.0 * X + 2.0, 5.0) / 2.0;
-		ZRatio *= CurrentLineDepthRatio;
-		FStructGridDataNeighbors Neighbors = pGI->TerrainGridPoints[TerrainMeshPointsData[Current].GridDataIndex].Neighbors[0];
-		if (Index < Neighbors.Points.Num()) {
-			FIntPoint key = Neighbors.Points[Index];
-			if (TerrainMeshPointsIndices.Contains(key)) {
-				Next = TerrainMeshPointsIndices[key];
-				UpdateRiverPoolZ(Next, ZRatio);
-			}
-			Index++;
-			return true;
-		}
-	}
-	return false;
-}
-
 void ATerrainGenerator::CombinePoolToTerrain()
 {
 	for (int32 i = 0; i < TerrainMeshPointsData.Num(); i++)
@@ -1309,13 +1925,13 @@ void ATerrainGenerator::CombinePoolToTerrain()
 
 			TerrainMeshPointsData[i].PositionZRatio = FMath::Lerp<float>(PoolZ, Z, alpha);
 			TerrainMeshPointsData[i].PositionZ = TerrainMeshPointsData[i].PositionZRatio * TileAltitudeMultiplier;
+			TerrainMeshPointsData[i].HasAnalyticGradient = false;
 			Vertices[i].Z = TerrainMeshPointsData[i].PositionZ;
 		}
 	}
 
-	FTimerHandle TimerHandle;
 	WorkflowState = Enum_TerrainGeneratorState::CreateVertexColorsForAMTB;
-	GetWorldTimerManager().SetTimer(TimerHandle, WorkflowDelegate, DefaultTimerRate, false);
+	SetWorkflowTimer(DefaultTimerRate);
 	UE_LOG(TerrainGenerator, Log, TEXT("CombinePoolToTerrain done."));
 }
 
@@ -1360,6 +1976,11 @@ void ATerrainGenerator::InitCreateVertexColorsForAMTB()
 
 //Add vertex Color(R:Altidude G:Moisture B:Temperature A:Biomes)
 void ATerrainGenerator::AddAMTBToVertexColor(int32 Index)
+{
+	VertexColors.Add(GetAMTBVertexColor(Index));
+}
+
+FColor ATerrainGenerator::GetAMTBVertexColor(int32 Index)
 {
 	float ZRatio = TerrainMeshPointsData[Index].PositionZRatio;
 	float ZRatioStd = ZRatio * 0.5 + 0.5;
@@ -1368,19 +1989,25 @@ void ATerrainGenerator::AddAMTBToVertexColor(int32 Index)
 	float Moisture = CalMoisture(X, Y);
 	float Temperature = CalTemperature(X, Y);
 	float Tree = CalTree(X, Y);
-	VertexColors.Add(FLinearColor(ZRatioStd, Moisture, Temperature, Tree));
-	
+	//Same quantization the mesh section applies, so nothing is lost by storing bytes
+	return FLinearColor(ZRatioStd, Moisture, Temperature, Tree).ToFColor(false);
 }
 
 float ATerrainGenerator::CalMoisture(int32 X, int32 Y)
 {
-	float Moisture = GetNoise2DStd(Noise->NWMoisture, X, Y, MoistureSampleScale, MoistureValueScale);
-	float WaterNoise = Noise->NWWater->GetNoise2D(X * WaterSampleScale, Y * WaterSampleScale);
-	WaterNoise *= MoistureValueScale;
-	WaterNoise = FMath::Clamp(WaterNoise, -1.0, 1.0);
 	FIntPoint key(X, Y);
 	int32 Index = TerrainMeshPointsIndices[key];
-	float ZRatio = TerrainMeshPointsData[Index].PositionZRatio;
+	return CalMoisture(X, Y, TerrainMeshPointsData[Index].PositionZRatio);
+}
+
+float ATerrainGenerator::CalMoisture(int32 X, int32 Y, float ZRatio, float DetailWavelength)
+{
+	float Moisture = GetNoise2DStd(Noise->NWMoisture, Noise->GNMoisture, X, Y, MoistureSampleScale, MoistureValueScale,
+		DetailWavelength);
+	float WaterNoise = GetBudgetedNoise2D(Noise->NWWater, Noise->GNWater, X * WaterSampleScale, Y * WaterSampleScale,
+		DetailWavelength * WaterSampleScale);
+	WaterNoise *= MoistureValueScale;
+	WaterNoise = FMath::Clamp(WaterNoise, -1.0, 1.0);
 	ZRatio *= MoistureZRatioScale;
 	ZRatio = FMath::Clamp(ZRatio, -1.0, 0.0);
 	
@@ -1395,10 +2022,12 @@ float ATerrainGenerator::CalMoisture(int32 X, int32 Y)
 	return Moisture;
 }
 
-float ATerrainGenerator::CalTemperature(int32 X, int32 Y)
+float ATerrainGenerator::CalTemperature(int32 X, int32 Y, float DetailWavelength)
 {
-	float Temperature = GetNoise2DStd(Noise->NWTemperature, X, Y, TemperatureSampleScale, TemperatureValueScale);
-	float Layer0Noise = Noise->NWLandLayer0->GetNoise2D(X * LandLayer0SampleScale, Y * LandLayer0SampleScale);
+	float Temperature = GetNoise2DStd(Noise->NWTemperature, Noise->GNTemperature, X, Y, TemperatureSampleScale, TemperatureValueScale,
+		DetailWavelength);
+	float Layer0Noise = GetBudgetedNoise2D(Noise->NWLandLayer0, Noise->GNLandLayer0, X * LandLayer0SampleScale, Y * LandLayer0SampleScale,
+		DetailWavelength * LandLayer0SampleScale);
 	Layer0Noise = FMath::Clamp(Layer0Noise, 0.0, 1.0);
 	float scale = 1.0 - Layer0Noise;
 	Temperature *= scale;
@@ -1428,27 +2057,27 @@ void ATerrainGenerator::CreateTriangles()
 			return;
 		}
 
-		FindTopRightSquareVertices(i, SqVArr, TerrainMeshPointsIndices, GridRange);
+		FindTopRightSquareVertices(i, TerrainMeshPointsData[i].GridDataIndex, SqVArr, TerrainMeshPointsIndices, GridRange);
 		CreatePairTriangles(SqVArr, Triangles);
 		Progress = ProgressPassed + (float)CreateTrianglesLoopData.Count / (float)StepTotalCount * ProgressWeight_CreateTriangles;
 		Count++;
 	}
 	ProgressPassed += ProgressWeight_CreateTriangles;
-	WorkflowState = Enum_TerrainGeneratorState::CalNormalsInit;
-	FTimerHandle TimerHandle;
-	GetWorldTimerManager().SetTimer(TimerHandle, WorkflowDelegate, CreateTrianglesLoopData.Rate, false);
+	WorkflowState = Enum_TerrainGeneratorState::CalNormals;
+	SetWorkflowTimer(CreateTrianglesLoopData.Rate);
 	UE_LOG(TerrainGenerator, Log, TEXT("Create triangles done."));
 }
 
-void ATerrainGenerator::FindTopRightSquareVertices(int32 Index, 
+void ATerrainGenerator::FindTopRightSquareVertices(int32 Index, int32 GridDataIndex,
 	TArray<int32>& SqVArr, const TMap<FIntPoint, int32>& Indices, 
 	int32 RangeLimit)
 {
 	SqVArr.Add(Index);
-	int32 Range = pGI->TerrainGridPoints[Index].RangeFromCenter;
+	const FStructGridData& GridPoint = pGI->TerrainGridPoints[GridDataIndex];
+	int32 Range = GridPoint.RangeFromCenter;
 	bool flag = Range < RangeLimit - 2;
 
-	FIntPoint point = pGI->TerrainGridPoints[Index].AxialCoord;
+	FIntPoint point = GridPoint.AxialCoord;
 	point = FIntPoint(point.X + 1, point.Y);
 	if (flag || Indices.Contains(point)) {
 		SqVArr.Add(Indices[point]);
@@ -1486,156 +2115,151 @@ void ATerrainGenerator::CreatePairTriangles(TArray<int32>& SqVArr,
 	SqVArr.Empty();
 }
 
-void ATerrainGenerator::CreateNormals()
+void ATerrainGenerator::CalNormals()
 {
-	CalNormalsWorkflow();
-}
+	int32 Total = TerrainMeshPointsData.Num();
+	ParallelFor(Total, [this](int32 Index) { CalNormalAndTangent(Index); });
 
-void ATerrainGenerator::CalNormalsWorkflow()
-{
-	switch (WorkflowState)
-	{
-	case Enum_TerrainGeneratorState::CalNormalsInit:
-		CalNormalsInit();
-		break;
-	case Enum_TerrainGeneratorState::CalNormalsAcc:
-		CalNormalsAcc();
-		break;
-	case Enum_TerrainGeneratorState::NormalizeNormals:
-		NormalizeNormals();
-		break;
-	default:
-		break;
-	}
+	ProgressPassed += ProgressWeight_CalNormals;
+	Progress = ProgressPassed;
+
+	WorkflowState = Enum_TerrainGeneratorState::FindLakes;
+	SetWorkflowTimer(DefaultTimerRate);
+	UE_LOG(TerrainGenerator, Log, TEXT("Calculate normals done."));
 }
 
-void ATerrainGenerator::CalNormalsInit()
+void ATerrainGenerator::FindLakes()
 {
-	int32 Count = 0;
-	TArray<int32> Indices = { 0 };
-	bool SaveLoopFlag = false;
-
-	if (!CalNormalsInitLoopData.HasInitialized) {
-		CalNormalsInitLoopData.HasInitialized = true;
-		StepTotalCount = Vertices.Num();
-	}
-	int32 i = CalNormalsInitLoopData.IndexSaved[0];
-	for (; i < Vertices.Num(); i++) {
-		Indices[0] = i;
-		FlowControlUtility::SaveLoopData(this, CalNormalsInitLoopData, Count, Indices, WorkflowDelegate, SaveLoopFlag);
-		if (SaveLoopFlag) {
-			return;
-		}
-		NormalsAcc.Add(FVector(0, 0, 0));
-		Progress = ProgressPassed + (float)CalNormalsInitLoopData.Count / (float)StepTotalCount * ProgressWeight_CalNormalsInit;
-		Count++;
+	if (HasLake) {
+		//Flood without epsilon so every basin fills flat to its spill height
+		TArray<float> Filled;
+		TArray<int32> Order;
+		TerrainHydrology::PriorityFloodFunction(TerrainMeshPointsData.Num(),
+			[this](int32 i) { return TerrainMeshPointsData[i].PositionZRatio; },
+			[this](int32 i) { return IsTerrainEdgePoint(i); },
+			[this](const int32& Current, int32& Next, int32& Index) { return NextPoint(Current, Next, Index); },
+			0.0, Filled, Order);
+		AddLakes(Filled);
 	}
-	ProgressPassed += ProgressWeight_CalNormalsInit;
 
-	FTimerHandle TimerHandle;
-	WorkflowState = Enum_TerrainGeneratorState::CalNormalsAcc;
-	GetWorldTimerManager().SetTimer(TimerHandle, WorkflowDelegate, CalNormalsInitLoopData.Rate, false);
-	UE_LOG(TerrainGenerator, Log, TEXT("Calculate normals initialization done."));
+	WorkflowState = Enum_TerrainGeneratorState::SaveTerrainCache;
+	SetWorkflowTimer(DefaultTimerRate);
+	UE_LOG(TerrainGenerator, Log, TEXT("Find %d lakes done."), LakeDatas.Num());
 }
 
-void ATerrainGenerator::CalNormalsAcc()
+void ATerrainGenerator::AddLakes(const TArray<float>& Filled)
 {
-	int32 Count = 0;
-	TArray<int32> Indices = { 0 };
-	bool SaveLoopFlag = false;
-
-	if (!CalNormalsAccLoopData.HasInitialized) {
-		CalNormalsAccLoopData.HasInitialized = true;
-		StepTotalCount = Triangles.Num() / 3;
+	//Flooded points above the sea, grouped into basins, the deepest point gives the lake depth
+	TArray<int32> Labels;
+	TArray<FStructComponentStats> Stats;
+	ComponentLabelUtility::FindComponents(TerrainMeshPointsData.Num(),
+		[&](int32 i) {
+			return Filled[i] - TerrainMeshPointsData[i].PositionZRatio > KINDA_SMALL_NUMBER && Filled[i] > WaterBaseRatio;
+		},
+		[this](const int32& Current, int32& Next, int32& Index) { return NextPoint(Current, Next, Index); },
+		[this](int32 i) { return GetPointAxialCoord(i); },
+		[&](int32 i) { return Filled[i] - TerrainMeshPointsData[i].PositionZRatio; },
+		Labels, Stats);
+
+	TArray<int32> SortedIds;
+	ComponentLabelUtility::SortComponentsBySize(Stats, SortedIds);
+	TArray<int32> LakeIndices;
+	LakeIndices.Init(INDEX_NONE, Stats.Num());
+	for (int32 Id : SortedIds)
+	{
+		if (Stats[Id].Size < LakeMinPointNum || Stats[Id].RepresentativeScore < LakeMinDepthRatio) {
+			continue;
+		}
+		FStructLakeData Data;
+		Data.WaterZRatio = Filled[Stats[Id].Representative];
+		Data.WaterZ = Data.WaterZRatio * TileAltitudeMultiplier;
+		Data.MaxDepthRatio = Stats[Id].RepresentativeScore;
+		Data.PointIndices.Reserve(Stats[Id].Size);
+		LakeIndices[Id] = LakeDatas.Add(Data);
 	}
 
-	int32 i = CalNormalsAccLoopData.IndexSaved[0];
-	int32 last = Triangles.Num() / 3 - 1;
-	for (; i <= last; i++) {
-		Indices[0] = i;
-		FlowControlUtility::SaveLoopData(this, CalNormalsAccLoopData, Count, Indices, WorkflowDelegate, SaveLoopFlag);
-		if (SaveLoopFlag) {
-			return;
+	for (int32 i = 0; i < Labels.Num(); i++)
+	{
+		if (Labels[i] == INDEX_NONE || LakeIndices[Labels[i]] == INDEX_NONE) {
+			continue;
 		}
-		CalTriangleNormalForVertex(i);
-		Progress = ProgressPassed + (float)CalNormalsAccLoopData.Count / (float)StepTotalCount * ProgressWeight_CalNormalsAcc;
-		Count++;
+		int32 LakeIndex = LakeIndices[Labels[i]];
+		LakeDatas[LakeIndex].PointIndices.Add(i);
+		TerrainMeshPointsData[i].LakeIndex = LakeIndex;
 	}
-	ProgressPassed += ProgressWeight_CalNormalsAcc;
 
-	FTimerHandle TimerHandle;
-	WorkflowState = Enum_TerrainGeneratorState::NormalizeNormals;
-	GetWorldTimerManager().SetTimer(TimerHandle, WorkflowDelegate, CalNormalsAccLoopData.Rate, false);
-	UE_LOG(TerrainGenerator, Log, TEXT("Calculate normals accumulation done."));
+	for (int32 i = 0; i < LakeDatas.Num(); i++)
+	{
+		FindLakeShore(LakeDatas[i], i);
+	}
 }
 
-void ATerrainGenerator::CalTriangleNormalForVertex(int32 TriangleIndex)
+void ATerrainGenerator::FindLakeShore(FStructLakeData& Data, int32 LakeIndex)
 {
-	int32 Index3Times = TriangleIndex * 3;
-	int32 Index1 = Triangles[Index3Times];
-	int32 Index2 = Triangles[Index3Times + 1];
-	int32 Index3 = Triangles[Index3Times + 2];
-
-	FVector Normal = FVector::CrossProduct(Vertices[Index1] - Vertices[Index2], Vertices[Index3] - Vertices[Index2]);
-
-	FVector N1 = NormalsAcc[Index1] + Normal;
-	NormalsAcc[Index1] = N1;
-
-	FVector N2 = NormalsAcc[Index2] + Normal;
-	NormalsAcc[Index2] = N2;
-
-	FVector N3 = NormalsAcc[Index3] + Normal;
-	NormalsAcc[Index3] = N3;
+	for (int32 PointIndex : Data.PointIndices)
+	{
+		int32 Next = INDEX_NONE;
+		int32 Index = 0;
+		while (NextPoint(PointIndex, Next, Index)) {
+			if (Next == INDEX_NONE || TerrainMeshPointsData[Next].LakeIndex != LakeIndex) {
+				Data.ShorePointIndices.Add(PointIndex);
+				break;
+			}
+			Next = INDEX_NONE;
+		}
+	}
 }
 
-void ATerrainGenerator::NormalizeNormals()
+//Central difference on the quad grid, one-sided where a neighbor is off the map.
+//Only touches point Index, so it is safe to run in parallel.
+void ATerrainGenerator::CalNormalAndTangent(int32 Index)
 {
-	int32 Count = 0;
-	TArray<int32> Indices = { 0 };
-	bool SaveLoopFlag = false;
+	FStructTerrainMeshPointData& Data = TerrainMeshPointsData[Index];
+	FIntPoint Coord = GetPointAxialCoord(Index);
+	float SlopeX = 0.0;
+	float SlopeY = 0.0;
 
-	if (!NormalizeNormalsLoopData.HasInitialized) {
-		NormalizeNormalsLoopData.HasInitialized = true;
-		StepTotalCount = NormalsAcc.Num();
+	if (UseAnalyticNormals && Data.HasAnalyticGradient) {
+		float SlopeScale = TileAltitudeMultiplier / TileSizeMultiplier;
+		SlopeX = Data.ZRatioGradient.X * SlopeScale;
+		SlopeY = Data.ZRatioGradient.Y * SlopeScale;
 	}
-
-	int32 i = NormalizeNormalsLoopData.IndexSaved[0];
-	int32 last = NormalsAcc.Num() - 1;
-	for (; i <= last; i++) {
-		Indices[0] = i;
-		FlowControlUtility::SaveLoopData(this, NormalizeNormalsLoopData, Count, Indices, WorkflowDelegate, SaveLoopFlag);
-		if (SaveLoopFlag) {
-			return;
+	else {
+		float Z = Data.PositionZ;
+		float ZL = Z, ZR = Z, ZD = Z, ZU = Z;
+		int32 SpanX = (GetMeshPointZ(FIntPoint(Coord.X - 1, Coord.Y), ZL) ? 1 : 0)
+			+ (GetMeshPointZ(FIntPoint(Coord.X + 1, Coord.Y), ZR) ? 1 : 0);
+		int32 SpanY = (GetMeshPointZ(FIntPoint(Coord.X, Coord.Y - 1), ZD) ? 1 : 0)
+			+ (GetMeshPointZ(FIntPoint(Coord.X, Coord.Y + 1), ZU) ? 1 : 0);
+		if (SpanX > 0) {
+			SlopeX = (ZR - ZL) / (SpanX * TileSizeMultiplier);
+		}
+		if (SpanY > 0) {
+			SlopeY = (ZU - ZD) / (SpanY * TileSizeMultiplier);
 		}
-		AddNormal(i);
-		CalAngleToUp(i);
-		Progress = ProgressPassed + (float)NormalizeNormalsLoopData.Count / (float)StepTotalCount * ProgressWeight_NormalizeNormals;
-		Count++;
 	}
-	ProgressPassed += ProgressWeight_NormalizeNormals;
 
-	FTimerHandle TimerHandle;
-	WorkflowState = Enum_TerrainGeneratorState::DrawLandMesh;
-	GetWorldTimerManager().SetTimer(TimerHandle, WorkflowDelegate, NormalizeNormalsLoopData.Rate, false);
-	UE_LOG(TerrainGenerator, Log, TEXT("Normalize normals done."));
-}
+	FVector Normal(-SlopeX, -SlopeY, 1.0);
+	Normal.Normalize();
 
-void ATerrainGenerator::AddNormal(int32 Index)
-{
-	NormalsAcc[Index].Normalize();
-	TerrainMeshPointsData[Index].Normal = NormalsAcc[Index];
-	Normals.Add(TerrainMeshPointsData[Index].Normal);
+	//The tangent follows from the normal, see GetLandVertex
+	Data.Normal = Normal;
+	Data.AngleToUp = AngleBetweenVectors(FVector::UpVector, Normal);
 }
 
-float ATerrainGenerator::AngleBetweenVectors(const FVector& A, const FVector& B)
+bool ATerrainGenerator::GetMeshPointZ(const FIntPoint& AxialCoord, float& OutZ) const
 {
-	return acosf(FVector::DotProduct(A, B));
+	const int32* pIndex = TerrainMeshPointsIndices.Find(AxialCoord);
+	if (pIndex) {
+		OutZ = TerrainMeshPointsData[*pIndex].PositionZ;
+		return true;
+	}
+	return false;
 }
 
-void ATerrainGenerator::CalAngleToUp(int32 Index)
+float ATerrainGenerator::AngleBetweenVectors(const FVector& A, const FVector& B)
 {
-	FVector UpVector(0.0, 0.0, 1.0);
-	TerrainMeshPointsData[Index].AngleToUp = AngleBetweenVectors(UpVector, Normals[Index]);
+	return acosf(FMath::Clamp(FVector::DotProduct(A, B), -1.0, 1.0));
 }
 
 void ATerrainGenerator::CreateWaterfall()
@@ -1648,9 +2272,8 @@ void ATerrainGenerator::CreateWaterfall()
 		}
 	}
 
-	FTimerHandle TimerHandle;
 	WorkflowState = Enum_TerrainGeneratorState::Done;
-	GetWorldTimerManager().SetTimer(TimerHandle, WorkflowDelegate, DefaultTimerRate, false);
+	SetWorkflowTimer(DefaultTimerRate);
 	UE_LOG(TerrainGenerator, Log, TEXT("Create waterfall done."));
 }
 
@@ -1948,7 +2571,7 @@ void ATerrainGenerator::AddWaterfallMist()
 {
 	for (int32 i = 0; i < RiverLinePointDatas.Num(); i++)
 	{
-		FStructRiverLinePointData Data = RiverLinePointDatas[i];
+		FStructRiverLinePointData& Data = RiverLinePointDatas[i];
 		if (!Data.HasWaterfall) {
 			continue;
 		}
@@ -1970,25 +2593,25 @@ void ATerrainGenerator::CreateWater()
 			CreateCaustics();
 		}
 	}
+	if (HasLake) {
+		CreateLakePlanes();
+	}
 
 	UE_LOG(TerrainGenerator, Log, TEXT("Create water done."));
 }
 
 void ATerrainGenerator::CreateWaterPlane()
 {
-	CreateWaterVerticesAndUVs();
+	CreateWaterPoints();
 	CreateWaterTriangles();
-	CreateWaterNormals();
 	CreateWaterMesh();
 	SetWaterMaterial();
 }
 
-void ATerrainGenerator::CreateWaterVerticesAndUVs()
+void ATerrainGenerator::CreateWaterPoints()
 {
 	UKismetMaterialLibrary::SetScalarParameterValue(this, TerrainMPC, TEXT("WaterBase"),
 		WaterBase);
-	float WaterTileMultiplier = TileSizeMultiplier * (float)GridRange / (float)WaterRange;
-	float UVUnit = UVScale / WaterRange;
 	
 	int32 X = 0;
 	int32 Y = 0;
@@ -1997,40 +2620,108 @@ void ATerrainGenerator::CreateWaterVerticesAndUVs()
 		X = pGI->TerrainGridPoints[i].AxialCoord.X;
 		Y = pGI->TerrainGridPoints[i].AxialCoord.Y;
 		WaterMeshPointsIndices.Add(FIntPoint(X, Y), i);
-
-		WaterVertices.Add(FVector(X * WaterTileMultiplier, Y * WaterTileMultiplier, WaterBase));
-		WaterUVs.Add(FVector2D(X * UVUnit, Y * UVUnit));
 	}
 }
 
 void ATerrainGenerator::CreateWaterTriangles()
 {
-	StepTotalCount = WaterVertices.Num();
+	StepTotalCount = WaterMeshPointsIndices.Num();
 	TArray<int32> SqVArr = {};
 	for (int32 i = 0; i < StepTotalCount; i++)
 	{
-		FindTopRightSquareVertices(i, SqVArr, WaterMeshPointsIndices, WaterRange);
+		FindTopRightSquareVertices(i, i, SqVArr, WaterMeshPointsIndices, WaterRange);
 		CreatePairTriangles(SqVArr, WaterTriangles);
 	}
 }
 
-void ATerrainGenerator::CreateWaterNormals()
+void ATerrainGenerator::CreateWaterMesh()
 {
-	int32 i;
-	for (i = 0; i <= WaterVertices.Num() - 1; i++) {
-		WaterNormals.Add(FVector(0, 0, 1.0));
+	//Flat plane, every vertex comes straight from its grid coord into the section
+	float WaterTileMultiplier = TileSizeMultiplier * (float)GridRange / (float)WaterRange;
+	float UVUnit = UVScale / WaterRange;
+	FProcMeshSection Section;
+	Section.ProcVertexBuffer.SetNum(WaterMeshPointsIndices.Num());
+	for (const TPair<FIntPoint, int32>& Point : WaterMeshPointsIndices)
+	{
+		FProcMeshVertex& Vertex = Section.ProcVertexBuffer[Point.Value];
+		Vertex.Position = FVector(Point.Key.X * WaterTileMultiplier, Point.Key.Y * WaterTileMultiplier, WaterBase);
+		Vertex.UV0 = FVector2D(Point.Key.X * UVUnit, Point.Key.Y * UVUnit);
+		Section.SectionLocalBox += Vertex.Position;
+	}
+	Section.ProcIndexBuffer.Reserve(WaterTriangles.Num());
+	for (int32 Index : WaterTriangles)
+	{
+		Section.ProcIndexBuffer.Add(Index);
 	}
+	Section.bEnableCollision = true;
+	WaterMesh->bUseAsyncCooking = UseAsyncCollisionCooking;
+	WaterMesh->SetProcMeshSection(0, Section);
 }
 
-void ATerrainGenerator::CreateWaterMesh()
+void ATerrainGenerator::SetWaterMaterial()
 {
-	WaterMesh->CreateMeshSection_LinearColor(0, WaterVertices, WaterTriangles, WaterNormals, WaterUVs,
-		TArray<FLinearColor>(), TArray<FProcMeshTangent>(), true);
+	WaterMesh->SetMaterial(0, WaterMaterialIns);
 }
 
-void ATerrainGenerator::SetWaterMaterial()
+void ATerrainGenerator::CreateLakePlanes()
 {
-	WaterMesh->SetMaterial(0, WaterMaterialIns);
+	for (int32 i = 0; i < LakeDatas.Num(); i++)
+	{
+		CreateLakeVerticesAndTriangles(LakeDatas[i]);
+		CreateLakeMesh(i);
+	}
+}
+
+void ATerrainGenerator::CreateLakeVerticesAndTriangles(FStructLakeData& Data)
+{
+	//Lake points and one ring of land, the terrain clips the plane along the shore contour
+	float Z = Data.WaterZ - WaterMesh->GetComponentLocation().Z;
+	float UVUnit = UVScale / GridRange;
+	TMap<FIntPoint, int32> LakeVertexIndices;
+	auto AddVertex = [&](int32 PointIndex) {
+		FIntPoint Coord = GetPointAxialCoord(PointIndex);
+		if (LakeVertexIndices.Contains(Coord)) {
+			return;
+		}
+		FVector2D Pos2D = GetPointPosition2D(PointIndex);
+		LakeVertexIndices.Add(Coord, Data.LakeVertices.Add(FVector(Pos2D.X, Pos2D.Y, Z)));
+		Data.LakeUVs.Add(FVector2D(Coord.X * UVUnit, Coord.Y * UVUnit));
+		Data.LakeNormals.Add(FVector(0, 0, 1.0));
+		};
+
+	for (int32 PointIndex : Data.PointIndices)
+	{
+		AddVertex(PointIndex);
+		int32 Next = INDEX_NONE;
+		int32 Index = 0;
+		while (NextPointD8(PointIndex, Next, Index)) {
+			if (Next != INDEX_NONE) {
+				AddVertex(Next);
+			}
+			Next = INDEX_NONE;
+		}
+	}
+
+	TArray<int32> SqVArr = {};
+	for (const TPair<FIntPoint, int32>& Pair : LakeVertexIndices)
+	{
+		const int32* Right = LakeVertexIndices.Find(Pair.Key + FIntPoint(1, 0));
+		const int32* TopRight = LakeVertexIndices.Find(Pair.Key + FIntPoint(1, 1));
+		const int32* Top = LakeVertexIndices.Find(Pair.Key + FIntPoint(0, 1));
+		if (Right && TopRight && Top) {
+			SqVArr = { Pair.Value, *Right, *TopRight, *Top };
+			CreatePairTriangles(SqVArr, Data.LakeTriangles);
+		}
+	}
+}
+
+void ATerrainGenerator::CreateLakeMesh(int32 Index)
+{
+	//Section 0 is the sea
+	FStructLakeData& Data = LakeDatas[Index];
+	WaterMesh->CreateMeshSection_LinearColor(Index + 1, Data.LakeVertices, Data.LakeTriangles, Data.LakeNormals, Data.LakeUVs,
+		TArray<FLinearColor>(), TArray<FProcMeshTangent>(), true);
+	WaterMesh->SetMaterial(Index + 1, LakeMaterialIns ? LakeMaterialIns : WaterMaterialIns);
 }
 
 void ATerrainGenerator::CreateCaustics()
@@ -2044,10 +2735,107 @@ void ATerrainGenerator::CreateCaustics()
 	UGameplayStatics::SpawnDecalAtLocation(this, CausticsMaterialIns, size, location, rotator);
 }
 
+void ATerrainGenerator::BuildHeightfield()
+{
+	FIntPoint CoordMin(MAX_int32, MAX_int32);
+	FIntPoint CoordMax(MIN_int32, MIN_int32);
+	for (int32 i = 0; i < TerrainMeshPointsData.Num(); i++)
+	{
+		FIntPoint Coord = GetPointAxialCoord(i);
+		CoordMin = CoordMin.ComponentMin(Coord);
+		CoordMax = CoordMax.ComponentMax(Coord);
+	}
+
+	Heightfield.Init(CoordMin, CoordMax, TileSizeMultiplier, TerrainMesh->GetComponentLocation());
+	for (int32 i = 0; i < TerrainMeshPointsData.Num(); i++)
+	{
+		Heightfield.SetHeight(GetPointAxialCoord(i), Vertices[i].Z);
+	}
+	UE_LOG(TerrainGenerator, Log, TEXT("Build heightfield done."));
+}
+
+void ATerrainGenerator::BuildWaterDistances()
+{
+	TBitArray<> RiverPoints(false, TerrainMeshPointsData.Num());
+	for (const FStructRiverLinePointData& Data : RiverLinePointDatas)
+	{
+		for (int32 Index : Data.LinePointIndices)
+		{
+			RiverPoints[Index] = true;
+		}
+	}
+	CreateWaterDistanceField([&](int32 Index) { return (bool)RiverPoints[Index]; }, RiverDistances);
+	CreateWaterDistanceField([this](int32 Index) { return TerrainMeshPointsData[Index].LakeIndex != INDEX_NONE; },
+		LakeDistances);
+	CreateWaterDistanceField([this](int32 Index) { return IsCoastPoint(TerrainMeshPointsData[Index]); }, CoastDistances);
+	UE_LOG(TerrainGenerator, Log, TEXT("Build water distances done."));
+}
+
+void ATerrainGenerator::CreateWaterDistanceField(TFunctionRef<bool(int32 Index)> IsSeed, TArray<float>& OutDistances)
+{
+	FIntPoint CoordMin(MAX_int32, MAX_int32);
+	FIntPoint CoordMax(MIN_int32, MIN_int32);
+	for (int32 i = 0; i < TerrainMeshPointsData.Num(); i++)
+	{
+		FIntPoint Coord = GetPointAxialCoord(i);
+		CoordMin = CoordMin.ComponentMin(Coord);
+		CoordMax = CoordMax.ComponentMax(Coord);
+	}
+	int32 SizeX = FMath::Max(0, CoordMax.X - CoordMin.X + 1);
+	int32 SizeY = FMath::Max(0, CoordMax.Y - CoordMin.Y + 1);
+	auto GetCell = [&](int32 Index) {
+		FIntPoint Coord = GetPointAxialCoord(Index) - CoordMin;
+		return Coord.Y * SizeX + Coord.X;
+		};
+
+	TBitArray<> Seeds(false, SizeX * SizeY);
+	for (int32 i = 0; i < TerrainMeshPointsData.Num(); i++)
+	{
+		if (IsSeed(i)) {
+			Seeds[GetCell(i)] = true;
+		}
+	}
+
+	//Grid distances are in tiles, scale to world units per mesh point
+	TArray<float> Field;
+	DistanceFieldUtility::DistanceTransform(SizeX, SizeY, Seeds, Field);
+	OutDistances.SetNumUninitialized(TerrainMeshPointsData.Num());
+	for (int32 i = 0; i < TerrainMeshPointsData.Num(); i++)
+	{
+		float Distance = Field[GetCell(i)];
+		OutDistances[i] = Distance == TNumericLimits<float>::Max() ? Distance : Distance * TileSizeMultiplier;
+	}
+}
+
 void ATerrainGenerator::CreateTerrainMesh()
 {
-	TerrainMesh->CreateMeshSection_LinearColor(0, Vertices, Triangles, Normals, UVs, UV1, UV2, UV3,
-		VertexColors, TArray<FProcMeshTangent>(), true);
+	if (LandChunkSize > 0) {
+		//Drop the preview, the root mesh only carries the transform from now on
+		TerrainMesh->ClearAllMeshSections();
+		CreateLandChunks();
+		UE_LOG(TerrainGenerator, Log, TEXT("Create terrain mesh done, %d chunks."), LandChunkDatas.Num());
+		return;
+	}
+
+	FProcMeshSection Section;
+	Section.ProcVertexBuffer.Reserve(Vertices.Num());
+	for (int32 i = 0; i < Vertices.Num(); i++)
+	{
+		Section.ProcVertexBuffer.Add(GetLandVertex(i));
+		Section.SectionLocalBox += Section.ProcVertexBuffer.Last().Position;
+	}
+	TArray<int32> SectionTriangles = Triangles;
+	if (OptimizeLandIndexOrder) {
+		MeshOrderUtility::OptimizeTriangleOrder(SectionTriangles, Vertices.Num());
+	}
+	Section.ProcIndexBuffer.Reserve(SectionTriangles.Num());
+	for (int32 Index : SectionTriangles)
+	{
+		Section.ProcIndexBuffer.Add(Index);
+	}
+	Section.bEnableCollision = true;
+	TerrainMesh->bUseAsyncCooking = UseAsyncCollisionCooking;
+	TerrainMesh->SetProcMeshSection(0, Section);
 	TerrainMesh->bUseComplexAsSimpleCollision = true;
 	TerrainMesh->SetCollisionResponseToAllChannels(ECollisionResponse::ECR_Block);
 	TerrainMesh->SetCollisionObjectType(ECollisionChannel::ECC_WorldStatic);
@@ -2059,11 +2847,769 @@ void ATerrainGenerator::CreateTerrainMesh()
 void ATerrainGenerator::SetTerrainMaterial()
 {
 	TerrainMesh->SetMaterial(0, TerrainMaterialIns);
+	for (const FStructTerrainChunkData& Data : LandChunkDatas)
+	{
+		for (int32 LOD = 0; LOD < Data.LODs.Num(); LOD++)
+		{
+			Data.ChunkMesh->SetMaterial(LOD, TerrainMaterialIns);
+		}
+	}
+}
+
+void ATerrainGenerator::CreateLandChunks()
+{
+	//Coarse cells must not cross the chunk border, so the chunk size limits the LOD count
+	int32 LODNum = 1;
+	while (LODNum < LandLODNum && LandChunkSize % (1 << LODNum) == 0) {
+		LODNum++;
+	}
+
+	auto FindOrAddChunk = [this, LODNum](const FIntPoint& AxialCoord) {
+		FIntPoint ChunkCoord = GetLandChunkCoord(AxialCoord);
+		int32* pChunkIndex = LandChunkIndices.Find(ChunkCoord);
+		if (pChunkIndex == nullptr) {
+			FStructTerrainChunkData Data;
+			Data.ChunkCoord = ChunkCoord;
+			Data.LODs.SetNum(LODNum);
+			pChunkIndex = &LandChunkIndices.Add(ChunkCoord, LandChunkDatas.Add(Data));
+		}
+		return *pChunkIndex;
+		};
+
+	//A cell belongs to the chunk of its bottom left point, which is the first index of both its triangles
+	for (int32 i = 0; i + 2 < Triangles.Num(); i += 3)
+	{
+		int32 ChunkIndex = FindOrAddChunk(GetPointAxialCoord(Triangles[i]));
+		LandChunkDatas[ChunkIndex].LODs[0].Triangles.Append(&Triangles[i], 3);
+	}
+
+	//Coarser LODs take every Step-th point, same corner order as FindTopRightSquareVertices
+	TArray<int32> SqVArr = {};
+	auto FindCell = [this, &SqVArr](int32 Index, const FIntPoint& AxialCoord, int32 Step) {
+		SqVArr.Add(Index);
+		for (const FIntPoint& Corner : { FIntPoint(Step, 0), FIntPoint(Step, Step), FIntPoint(0, Step) })
+		{
+			if (const int32* pIndex = TerrainMeshPointsIndices.Find(AxialCoord + Corner)) {
+				SqVArr.Add(*pIndex);
+			}
+		}
+		};
+	for (int32 LOD = 1; LOD < LODNum; LOD++)
+	{
+		int32 Step = 1 << LOD;
+		for (int32 i = 0; i < TerrainMeshPointsData.Num(); i++)
+		{
+			FIntPoint AxialCoord = GetPointAxialCoord(i);
+			FIntPoint CoarseCoord = AxialCoord - FIntPoint((AxialCoord.X + GridRange) % Step, (AxialCoord.Y + GridRange) % Step);
+			const int32* pCoarse = TerrainMeshPointsIndices.Find(CoarseCoord);
+			bool IsFull = false;
+			if (pCoarse != nullptr) {
+				FindCell(*pCoarse, CoarseCoord, Step);
+				IsFull = SqVArr.Num() == 4;
+				if (!IsFull || CoarseCoord != AxialCoord) {
+					SqVArr.Reset();
+				}
+			}
+			//Coarse cells cut by the terrain rim keep their full resolution cells, the skirts cover the T joints
+			if (!IsFull) {
+				FindCell(i, AxialCoord, 1);
+			}
+			CreatePairTriangles(SqVArr, LandChunkDatas[FindOrAddChunk(AxialCoord)].LODs[LOD].Triangles);
+		}
+	}
+
+	TMap<FIntPoint, FBox> ChunkBounds;
+	for (FStructTerrainChunkData& Data : LandChunkDatas)
+	{
+		for (FStructTerrainChunkLODData& LODData : Data.LODs)
+		{
+			BuildLandChunkLOD(LODData);
+		}
+		FBox& Bounds = ChunkBounds.Add(Data.ChunkCoord, FBox(ForceInit));
+		for (int32 Index : Data.LODs[0].PointIndices)
+		{
+			Bounds += FVector(Vertices[Index]);
+		}
+		CreateLandChunkMesh(Data);
+	}
+
+	LandLODSelector.Init(ChunkBounds, LODNum, LandLODRange);
+	if (LODNum > 1) {
+		GetWorldTimerManager().SetTimer(LandLODTimerHandle, LandLODDelegate, LandLODTimerRate, true);
+	}
+}
+
+void ATerrainGenerator::BuildLandChunkLOD(FStructTerrainChunkLODData& LODData)
+{
+	//Edges used by one triangle only are the chunk outline
+	TMap<FIntPoint, int32> EdgeCounts;
+	auto GetEdgeKey = [](int32 A, int32 B) {
+		return FIntPoint(FMath::Min(A, B), FMath::Max(A, B));
+		};
+	for (int32 i = 0; i < LODData.Triangles.Num(); i++)
+	{
+		int32 Next = i % 3 == 2 ? i - 2 : i + 1;
+		EdgeCounts.FindOrAdd(GetEdgeKey(LODData.Triangles[i], LODData.Triangles[Next]))++;
+	}
+
+	TArray<FIntPoint> OutlineEdges;
+	for (int32 i = 0; i < LODData.Triangles.Num(); i++)
+	{
+		int32 Next = i % 3 == 2 ? i - 2 : i + 1;
+		if (EdgeCounts[GetEdgeKey(LODData.Triangles[i], LODData.Triangles[Next])] == 1) {
+			OutlineEdges.Add(FIntPoint(LODData.Triangles[i], LODData.Triangles[Next]));
+		}
+	}
+
+	TMap<int32, int32> LocalIndices;
+	auto GetLocal = [&LODData, &LocalIndices](int32 Index) {
+		int32* pLocal = LocalIndices.Find(Index);
+		if (pLocal == nullptr) {
+			pLocal = &LocalIndices.Add(Index, LODData.PointIndices.Add(Index));
+		}
+		return *pLocal;
+		};
+	for (int32& Index : LODData.Triangles)
+	{
+		Index = GetLocal(Index);
+	}
+	if (OptimizeLandIndexOrder) {
+		//Renumber in order of first use, vertex fetches then follow the optimized triangles
+		MeshOrderUtility::OptimizeTriangleOrder(LODData.Triangles, LODData.PointIndices.Num());
+		TArray<int32> PointIndices = MoveTemp(LODData.PointIndices);
+		LODData.PointIndices.Reset();
+		LocalIndices.Reset();
+		for (int32& Index : LODData.Triangles)
+		{
+			Index = GetLocal(PointIndices[Index]);
+		}
+	}
+	LODData.SkirtStart = LODData.PointIndices.Num();
+	if (LandSkirtDepth <= 0.0) {
+		return;
+	}
+
+	//Hang a wall under every outline edge, it covers the cracks to a neighbor of another LOD
+	TMap<int32, int32> SkirtIndices;
+	auto GetSkirt = [&LODData, &SkirtIndices](int32 Local) {
+		int32* pSkirt = SkirtIndices.Find(Local);
+		if (pSkirt == nullptr) {
+			pSkirt = &SkirtIndices.Add(Local, LODData.PointIndices.Add(LODData.PointIndices[Local]));
+		}
+		return *pSkirt;
+		};
+	for (const FIntPoint& Edge : OutlineEdges)
+	{
+		int32 A = LocalIndices[Edge.X];
+		int32 B = LocalIndices[Edge.Y];
+		int32 SkirtA = GetSkirt(A);
+		int32 SkirtB = GetSkirt(B);
+		//Reversed to the surface winding along the edge, so the wall faces out of the chunk
+		LODData.Triangles.Append({ A, SkirtB, B, A, SkirtA, SkirtB });
+	}
+}
+
+void ATerrainGenerator::CreateLandChunkMesh(FStructTerrainChunkData& Data)
+{
+	FString NameStr = FString::Printf(TEXT("TerrainChunk_%d_%d"), Data.ChunkCoord.X, Data.ChunkCoord.Y);
+	Data.ChunkMesh = NewObject<UProceduralMeshComponent>(this, FName(*NameStr));
+	Data.ChunkMesh->SetupAttachment(TerrainMesh);
+	Data.ChunkMesh->SetCollisionEnabled(ECollisionEnabled::QueryOnly);
+	Data.ChunkMesh->SetCollisionResponseToAllChannels(ECollisionResponse::ECR_Block);
+	Data.ChunkMesh->SetCollisionObjectType(ECollisionChannel::ECC_WorldStatic);
+	Data.ChunkMesh->SetReceivesDecals(true);
+	Data.ChunkMesh->bUseAsyncCooking = UseAsyncCollisionCooking;
+	Data.ChunkMesh->RegisterComponent();
+	UpdateLandChunkMeshes(Data);
+}
+
+//Every SetProcMeshSection cooks the collision of the whole component, so the colliding section is switched off
+//while the others are written and goes last, one real cook per chunk
+void ATerrainGenerator::UpdateLandChunkMeshes(FStructTerrainChunkData& Data)
+{
+	int32 CollisionLOD = GetLandCollisionLOD(Data);
+	if (FProcMeshSection* pSection = Data.ChunkMesh->GetProcMeshSection(CollisionLOD)) {
+		pSection->bEnableCollision = false;
+	}
+	for (int32 LOD = 0; LOD < Data.LODs.Num(); LOD++)
+	{
+		if (LOD != CollisionLOD) {
+			UpdateLandChunkMesh(Data, LOD);
+		}
+	}
+	UpdateLandChunkMesh(Data, CollisionLOD);
+}
+
+int32 ATerrainGenerator::GetLandCollisionLOD(const FStructTerrainChunkData& Data)
+{
+	return FMath::Min(LandCollisionLOD, Data.LODs.Num() - 1);
+}
+
+void ATerrainGenerator::UpdateLandChunkMesh(FStructTerrainChunkData& Data, int32 LOD)
+{
+	//Written straight into the section, no intermediate per stream arrays
+	const FStructTerrainChunkLODData& LODData = Data.LODs[LOD];
+	FProcMeshSection Section;
+	Section.ProcVertexBuffer.Reserve(LODData.PointIndices.Num());
+	for (int32 i = 0; i < LODData.PointIndices.Num(); i++)
+	{
+		FProcMeshVertex Vertex = GetLandVertex(LODData.PointIndices[i]);
+		if (i >= LODData.SkirtStart) {
+			Vertex.Position.Z -= LandSkirtDepth;
+		}
+		Section.SectionLocalBox += Vertex.Position;
+		Section.ProcVertexBuffer.Add(Vertex);
+	}
+	Section.ProcIndexBuffer.Reserve(LODData.Triangles.Num());
+	for (int32 Index : LODData.Triangles)
+	{
+		Section.ProcIndexBuffer.Add(Index);
+	}
+	//One section per chunk collides, the others are only drawn
+	Section.bEnableCollision = LOD == GetLandCollisionLOD(Data);
+	Section.bSectionVisible = LOD == Data.CurrentLOD;
+	Data.ChunkMesh->SetProcMeshSection(LOD, Section);
+}
+
+FProcMeshVertex ATerrainGenerator::GetLandVertex(int32 Index)
+{
+	const FStructTerrainMeshPointData& Data = TerrainMeshPointsData[Index];
+	FIntPoint AxialCoord = GetPointAxialCoord(Index);
+	FProcMeshVertex Vertex;
+	Vertex.Position = FVector(Vertices[Index]);
+	Vertex.Normal = Data.Normal;
+	//Normal is (-SlopeX, -SlopeY, 1) normalized, so (1, 0, SlopeX) is (Normal.Z, 0, -Normal.X)
+	Vertex.Tangent = FProcMeshTangent(FVector(Data.Normal.Z, 0.0, -Data.Normal.X).GetSafeNormal(), false);
+	Vertex.Color = VertexColors.IsValidIndex(Index) ? VertexColors[Index] : FColor::Black;
+	Vertex.UV0 = FVector2D(AxialCoord.X * UVScale, AxialCoord.Y * UVScale);
+	Vertex.UV1 = FVector2D(1.0, 0.0);
+	return Vertex;
+}
+
+void ATerrainGenerator::UpdateLandChunks(const TArray<int32>& PointIndices)
+{
+	//Single section mode has nothing smaller to update
+	if (LandChunkDatas.IsEmpty()) {
+		CreateTerrainMesh();
+		return;
+	}
+
+	//A point is a corner of the cells to its bottom left, so it can sit in up to four chunks
+	TSet<int32> ChunkIndices;
+	for (int32 Index : PointIndices)
+	{
+		FIntPoint Coord = GetPointAxialCoord(Index);
+		for (int32 dx = -1; dx <= 0; dx++)
+		{
+			for (int32 dy = -1; dy <= 0; dy++)
+			{
+				if (const int32* pChunkIndex = LandChunkIndices.Find(GetLandChunkCoord(Coord + FIntPoint(dx, dy)))) {
+					ChunkIndices.Add(*pChunkIndex);
+				}
+			}
+		}
+	}
+	for (int32 ChunkIndex : ChunkIndices)
+	{
+		UpdateLandChunkMeshes(LandChunkDatas[ChunkIndex]);
+	}
+	UE_LOG(TerrainGenerator, Log, TEXT("Update %d terrain chunks done."), ChunkIndices.Num());
+}
+
+FIntPoint ATerrainGenerator::GetLandChunkCoord(const FIntPoint& AxialCoord)
+{
+	//Axial coords start at -GridRange, shift them so the division floors
+	return FIntPoint((AxialCoord.X + GridRange) / LandChunkSize, (AxialCoord.Y + GridRange) / LandChunkSize);
+}
+
+void ATerrainGenerator::UpdateLandLOD()
+{
+	APlayerCameraManager* CameraManager = UGameplayStatics::GetPlayerCameraManager(this, 0);
+	if (CameraManager == nullptr || !LandLODSelector.IsBuilt()) {
+		return;
+	}
+	FVector ViewPos = TerrainMesh->GetComponentTransform().InverseTransformPosition(CameraManager->GetCameraLocation());
+	LandLODSelector.Select(ViewPos, SelectedLandLODs);
+
+	int32 ChangedNum = 0;
+	for (FStructTerrainChunkData& Data : LandChunkDatas)
+	{
+		int32 LOD = SelectedLandLODs.FindRef(Data.ChunkCoord);
+		if (LOD == Data.CurrentLOD) {
+			continue;
+		}
+		Data.ChunkMesh->SetMeshSectionVisible(Data.CurrentLOD, false);
+		Data.ChunkMesh->SetMeshSectionVisible(LOD, true);
+		Data.CurrentLOD = LOD;
+		ChangedNum++;
+	}
+	if (ChangedNum > 0) {
+		UE_LOG(TerrainGenerator, Verbose, TEXT("Land LOD changed %d chunks, %d triangles drawn."), ChangedNum, GetLandTriangleNum());
+	}
+}
+
+void ATerrainGenerator::GetBakeSources(TArray<UProceduralMeshComponent*>& OutMeshes, TArray<int32>& OutSectionNums,
+	TArray<AActor*>& OutEffects)
+{
+	auto AddMesh = [&OutMeshes, &OutSectionNums](UProceduralMeshComponent* Mesh, int32 SectionNum) {
+		if (Mesh && SectionNum > 0) {
+			OutMeshes.Add(Mesh);
+			OutSectionNums.Add(SectionNum);
+		}
+		};
+
+	AddMesh(TerrainMesh, TerrainMesh->GetNumSections());
+	for (const FStructTerrainChunkData& Data : LandChunkDatas)
+	{
+		AddMesh(Data.ChunkMesh, 1);
+	}
+	AddMesh(WaterMesh, WaterMesh->GetNumSections());
+	for (const FStructWaterfallRenderData& Data : WaterfallRenderDatas)
+	{
+		AddMesh(Data.WaterfallMesh, Data.WaterfallMesh ? Data.WaterfallMesh->GetNumSections() : 0);
+	}
+
+	for (const FStructRiverLinePointData& Data : RiverLinePointDatas)
+	{
+		if (Data.Waterfall) {
+			OutEffects.Add(Data.Waterfall);
+		}
+		if (Data.WaterfallMist) {
+			OutEffects.Add(Data.WaterfallMist);
+		}
+	}
+}
+
+void ATerrainGenerator::WaitCollision()
+{
+	CollisionReady = false;
+	GetWorldTimerManager().SetTimer(CollisionTimerHandle, CollisionDelegate, WaitCollisionTimerRate, true);
+}
+
+void ATerrainGenerator::UpdateCollisionReady()
+{
+	if (!IsMeshCollisionReady(WaterMesh)) {
+		return;
+	}
+	if (LandChunkDatas.IsEmpty() && !IsMeshCollisionReady(TerrainMesh)) {
+		return;
+	}
+	for (const FStructTerrainChunkData& Data : LandChunkDatas)
+	{
+		if (!IsMeshCollisionReady(Data.ChunkMesh)) {
+			return;
+		}
+	}
+
+	GetWorldTimerManager().ClearTimer(CollisionTimerHandle);
+	CollisionReady = true;
+	UE_LOG(TerrainGenerator, Log, TEXT("Terrain collision ready."));
+	OnCollisionReady.Broadcast();
+}
+
+bool ATerrainGenerator::IsMeshCollisionReady(UProceduralMeshComponent* Mesh)
+{
+	//Nothing to cook without a colliding section, e.g. the water mesh of a map without sea or lakes
+	bool HasCollision = false;
+	for (int32 i = 0; i < Mesh->GetNumSections() && !HasCollision; i++)
+	{
+		const FProcMeshSection* pSection = Mesh->GetProcMeshSection(i);
+		HasCollision = pSection && pSection->bEnableCollision && !pSection->ProcIndexBuffer.IsEmpty();
+	}
+	if (!HasCollision) {
+		return true;
+	}
+
+	//An async cook swaps in the cooked body setup and recreates the physics state when it is done
+	UBodySetup* BodySetup = Mesh->GetBodySetup();
+	return BodySetup && BodySetup->TriMeshGeometries.Num() > 0 && Mesh->GetBodyInstance()->IsValidBodyInstance();
+}
+
+int32 ATerrainGenerator::GetLandTriangleNum()
+{
+	if (LandChunkDatas.IsEmpty()) {
+		return Triangles.Num() / 3;
+	}
+	int32 Num = 0;
+	for (const FStructTerrainChunkData& Data : LandChunkDatas)
+	{
+		Num += Data.LODs[Data.CurrentLOD].Triangles.Num() / 3;
+	}
+	return Num;
+}
+
+bool ATerrainGenerator::ModifyTerrain(Enum_TerrainBrushMode Mode, FVector2D Center, float Radius, float Strength)
+{
+	if (!CanTerraform() || Radius <= 0.0) {
+		return false;
+	}
+	float TargetRatio = 0.0;
+	int32 CenterIndex;
+	if (GetPointIndexAt(Center, CenterIndex)) {
+		TargetRatio = TerrainMeshPointsData[CenterIndex].PositionZRatio;
+	}
+	else if (Mode == Enum_TerrainBrushMode::Flatten) {
+		return false;
+	}
+
+	FBox2D Bounds(Center - FVector2D(Radius), Center + FVector2D(Radius));
+	TArray<int32> PointIndices;
+	GetBrushPoints(Bounds, PointIndices);
+	float StrengthRatio = Strength / TileAltitudeMultiplier;
+	TArray<int32> Changed;
+	for (int32 Index : PointIndices)
+	{
+		float Weight = GetBrushWeight(FVector2D::Distance(GetPointWorldPosition2D(Index), Center), Radius);
+		float ZRatio = TerrainMeshPointsData[Index].PositionZRatio;
+		switch (Mode)
+		{
+		case Enum_TerrainBrushMode::Raise:
+			ZRatio += StrengthRatio * Weight;
+			break;
+		case Enum_TerrainBrushMode::Lower:
+			ZRatio -= StrengthRatio * Weight;
+			break;
+		case Enum_TerrainBrushMode::Flatten:
+			ZRatio += FMath::Clamp(TargetRatio - ZRatio, -StrengthRatio, StrengthRatio) * Weight;
+			break;
+		}
+		if (SetPointZRatio(Index, ZRatio)) {
+			Changed.Add(Index);
+		}
+	}
+
+	ApplyTerraform(Changed, Bounds);
+	return !Changed.IsEmpty();
+}
+
+bool ATerrainGenerator::DigTerrainChannel(FVector2D Start, FVector2D End, float Radius, float Depth)
+{
+	int32 StartIndex, EndIndex;
+	if (!CanTerraform() || Radius <= 0.0 || !GetPointIndexAt(Start, StartIndex) || !GetPointIndexAt(End, EndIndex)) {
+		return false;
+	}
+	float StartRatio = TerrainMeshPointsData[StartIndex].PositionZRatio;
+	float EndRatio = TerrainMeshPointsData[EndIndex].PositionZRatio;
+	float DepthRatio = Depth / TileAltitudeMultiplier;
+	float Length = FVector2D::Distance(Start, End);
+
+	FBox2D Bounds(Start.ComponentMin(End) - FVector2D(Radius), Start.ComponentMax(End) + FVector2D(Radius));
+	TArray<int32> PointIndices;
+	GetBrushPoints(Bounds, PointIndices);
+	TArray<int32> Changed;
+	for (int32 Index : PointIndices)
+	{
+		FVector2D Pos = GetPointWorldPosition2D(Index);
+		FVector2D Closest = FMath::ClosestPointOnSegment2D(Pos, Start, End);
+		float Weight = GetBrushWeight(FVector2D::Distance(Pos, Closest), Radius);
+		//A straight bed keeps the channel draining one way
+		float Alpha = Length > 0.0 ? FVector2D::Distance(Start, Closest) / Length : 0.0;
+		float BedRatio = FMath::Lerp(StartRatio, EndRatio, Alpha) - DepthRatio;
+		float ZRatio = TerrainMeshPointsData[Index].PositionZRatio;
+		if (SetPointZRatio(Index, FMath::Min(ZRatio, FMath::Lerp(ZRatio, BedRatio, Weight)))) {
+			Changed.Add(Index);
+		}
+	}
+
+	ApplyTerraform(Changed, Bounds);
+	return !Changed.IsEmpty();
+}
+
+bool ATerrainGenerator::CanTerraform()
+{
+	if (!IsLoadingCompleted()) {
+		return false;
+	}
+	if (Vertices.IsEmpty()) {
+		UE_LOG(TerrainGenerator, Warning, TEXT("Terraform needs AllowTerraform when TrimAfterGeneration is on!"));
+		return false;
+	}
+	return true;
+}
+
+//Brush positions are world space, the heightfield carries the mesh origin
+bool ATerrainGenerator::GetPointIndexAt(const FVector2D& Point, int32& OutIndex)
+{
+	const int32* pIndex = TerrainMeshPointsIndices.Find(Heightfield.GetCoord(Point));
+	if (pIndex == nullptr) {
+		return false;
+	}
+	OutIndex = *pIndex;
+	return true;
+}
+
+FVector2D ATerrainGenerator::GetPointWorldPosition2D(int32 Index)
+{
+	return Heightfield.GetPosition(GetPointAxialCoord(Index));
+}
+
+void ATerrainGenerator::GetBrushPoints(const FBox2D& Bounds, TArray<int32>& OutPoints)
+{
+	FIntPoint Low = Heightfield.GetCoord(Bounds.Min);
+	FIntPoint High = Heightfield.GetCoord(Bounds.Max);
+	for (int32 X = Low.X; X <= High.X; X++)
+	{
+		for (int32 Y = Low.Y; Y <= High.Y; Y++)
+		{
+			if (const int32* pIndex = TerrainMeshPointsIndices.Find(FIntPoint(X, Y))) {
+				OutPoints.Add(*pIndex);
+			}
+		}
+	}
+}
+
+float ATerrainGenerator::GetBrushWeight(float Distance, float Radius)
+{
+	return 1.0 - FMath::SmoothStep(0.0, 1.0, Distance / Radius);
+}
+
+bool ATerrainGenerator::SetPointZRatio(int32 Index, float ZRatio)
+{
+	FStructTerrainMeshPointData& Data = TerrainMeshPointsData[Index];
+	ZRatio = FMath::Clamp(ZRatio, -1.0, 1.0);
+	if (FMath::IsNearlyEqual(ZRatio, Data.PositionZRatio)) {
+		return false;
+	}
+	Data.PositionZRatio = ZRatio;
+	Data.PositionZ = ZRatio * TileAltitudeMultiplier;
+	Data.HasAnalyticGradient = false;
+	Vertices[Index].Z = Data.PositionZ;
+	return true;
+}
+
+void ATerrainGenerator::ApplyTerraform(const TArray<int32>& PointIndices, const FBox2D& Bounds)
+{
+	if (PointIndices.IsEmpty()) {
+		return;
+	}
+
+	//Normals read the direct neighbors, so the ring around the edit changes too
+	TArray<int32> NormalPoints;
+	TArray<int32> Distances;
+	TMap<int32, int32> LocalIndices;
+	GetPointsInRange(PointIndices, 1, NormalPoints, Distances, LocalIndices);
+	//The noise gradient no longer matches any of them, ring points included
+	for (int32 Index : NormalPoints)
+	{
+		TerrainMeshPointsData[Index].HasAnalyticGradient = false;
+	}
+	ParallelFor(NormalPoints.Num(), [&](int32 i) { CalNormalAndTangent(NormalPoints[i]); });
+
+	//Water distance seeds sit at 0 and block points at level 0, so a flip shows against the old values
+	bool ShoreChanged = false;
+	bool BlockChanged = false;
+	for (int32 Index : PointIndices)
+	{
+		const FStructTerrainMeshPointData& Data = TerrainMeshPointsData[Index];
+		Heightfield.SetHeight(GetPointAxialCoord(Index), Data.PositionZ);
+		if (VertexColors.IsValidIndex(Index)) {
+			VertexColors[Index] = GetAMTBVertexColor(Index);
+		}
+		ShoreChanged |= CoastDistances.IsValidIndex(Index) && IsCoastPoint(Data) != (CoastDistances[Index] == 0.0);
+		BlockChanged |= IsBlock(Data) != (Data.BlockLevel == 0);
+	}
+	if (BlockChanged) {
+		UpdateBlockLevels(PointIndices);
+	}
+	//River lines and lakes stay as generated, only the sea shore follows the new heights.
+	//A filled bay moves the shore for points far from the edit, so the coast field is rebuilt whole, linear time
+	if (ShoreChanged) {
+		CreateWaterDistanceField([this](int32 Index) { return IsCoastPoint(TerrainMeshPointsData[Index]); },
+			CoastDistances);
+	}
+	if (!IsHeadless) {
+		UpdateLandChunks(NormalPoints);
+	}
+
+	UE_LOG(TerrainGenerator, Log, TEXT("Terraform %d points done."), PointIndices.Num());
+	OnTerrainModified.Broadcast(Bounds);
+}
+
+void ATerrainGenerator::UpdateBlockLevels(const TArray<int32>& PointIndices)
+{
+	//Levels only change within BlockLevelMax of an edited point, and the nearest block of such a point
+	//lies within twice that, so the transform runs on that neighborhood alone
+	TArray<int32> Region;
+	TArray<int32> Distances;
+	TMap<int32, int32> LocalIndices;
+	GetPointsInRange(PointIndices, BlockLevelMax * 2, Region, Distances, LocalIndices);
+
+	TArray<int32> BlockLevels;
+	AStarUtility::DistanceTransformFunction(Region.Num(),
+		[&](int32 i) { return IsBlock(TerrainMeshPointsData[Region[i]]); },
+		[&](const int32& Current, int32& Next, int32& Index) {
+			int32 PointNext = INDEX_NONE;
+			bool Ret = NextPoint(Region[Current], PointNext, Index);
+			if (const int32* pLocal = LocalIndices.Find(PointNext)) {
+				Next = *pLocal;
+			}
+			return Ret;
+		},
+		BlockLevelMax, BlockLevels);
+
+	for (int32 i = 0; i < Region.Num(); i++)
+	{
+		if (Distances[i] <= BlockLevelMax) {
+			TerrainMeshPointsData[Region[i]].BlockLevel = BlockLevels[i];
+		}
+	}
+}
+
+bool ATerrainGenerator::IsCoastPoint(const FStructTerrainMeshPointData& Data)
+{
+	return HasWater && Data.LakeIndex == INDEX_NONE && Data.PositionZRatio < WaterBaseRatio;
+}
+
+//Breadth first from the seeds, OutDistances holds the grid distance of each point in OutPoints
+void ATerrainGenerator::GetPointsInRange(const TArray<int32>& Seeds, int32 Range, TArray<int32>& OutPoints,
+	TArray<int32>& OutDistances, TMap<int32, int32>& OutLocalIndices)
+{
+	for (int32 Seed : Seeds)
+	{
+		if (!OutLocalIndices.Contains(Seed)) {
+			OutLocalIndices.Add(Seed, OutPoints.Add(Seed));
+			OutDistances.Add(0);
+		}
+	}
+
+	int32 Head = 0;
+	while (Head < OutPoints.Num()) {
+		int32 Current = OutPoints[Head];
+		int32 NextDistance = OutDistances[Head] + 1;
+		Head++;
+		if (NextDistance > Range) {
+			continue;
+		}
+
+		int32 Next = INDEX_NONE;
+		int32 Index = 0;
+		while (NextPoint(Current, Next, Index)) {
+			if (Next != INDEX_NONE && !OutLocalIndices.Contains(Next)) {
+				OutLocalIndices.Add(Next, OutPoints.Add(Next));
+				OutDistances.Add(NextDistance);
+			}
+			Next = INDEX_NONE;
+		}
+	}
 }
 
 void ATerrainGenerator::DoWorkflowDone()
 {
 	Progress = 1.0;
+	if (TrimAfterGeneration) {
+		LogMemoryFootprint(TEXT("before trim"));
+		TrimGenerationData();
+	}
+	LogMemoryFootprint(TEXT("resident"));
+}
+
+void ATerrainGenerator::TrimGenerationData()
+{
+	//Already uploaded into the mesh sections, terraform rebuilds chunks from the vertex streams
+	if (!AllowTerraform) {
+		Vertices.Empty();
+		VertexColors.Empty();
+	}
+	if (!AllowTerraform || !LandChunkDatas.IsEmpty()) {
+		Triangles.Empty();
+	}
+	WaterTriangles.Empty();
+	for (FStructWaterfallRenderData& Data : WaterfallRenderDatas)
+	{
+		Data.WaterfallVertices.Empty();
+		Data.WaterfallUVs.Empty();
+		Data.WaterfallTriangles.Empty();
+		Data.WaterfallNormals.Empty();
+	}
+	for (FStructLakeData& Data : LakeDatas)
+	{
+		Data.LakeVertices.Empty();
+		Data.LakeUVs.Empty();
+		Data.LakeTriangles.Empty();
+		Data.LakeNormals.Empty();
+	}
+
+	//Only used while building
+	WaterMeshPointsIndices.Empty();
+	UpperRiverEndPoints.Empty();
+	LowerRiverEndPoints.Empty();
+	FlowFilledZRatios.Empty();
+	FlowOrder.Empty();
+	FlowDownstream.Empty();
+	FlowAccumulation.Empty();
+	RiverCarveSources.Empty();
+	RiverCarveSourceIndices.Empty();
+
+	//Point data, rivers, lakes, heightfield and distances stay for the runtime queries
+	TerrainMeshPointsData.Shrink();
+	TerrainMeshPointsIndices.Shrink();
+	RiverLinePointDatas.Shrink();
+	LakeDatas.Shrink();
+	WaterfallRenderDatas.Shrink();
+	UE_LOG(TerrainGenerator, Log, TEXT("Trim generation data done."));
+}
+
+void ATerrainGenerator::LogMemoryFootprint(const TCHAR* Label)
+{
+	SIZE_T RiverLineSize = RiverLinePointDatas.GetAllocatedSize();
+	for (const FStructRiverLinePointData& Data : RiverLinePointDatas)
+	{
+		RiverLineSize += Data.LinePointIndices.GetAllocatedSize();
+	}
+	SIZE_T LakeSize = LakeDatas.GetAllocatedSize();
+	for (const FStructLakeData& Data : LakeDatas)
+	{
+		LakeSize += Data.PointIndices.GetAllocatedSize() + Data.ShorePointIndices.GetAllocatedSize()
+			+ Data.LakeVertices.GetAllocatedSize() + Data.LakeUVs.GetAllocatedSize()
+			+ Data.LakeTriangles.GetAllocatedSize() + Data.LakeNormals.GetAllocatedSize();
+	}
+	SIZE_T WaterfallSize = WaterfallRenderDatas.GetAllocatedSize();
+	for (const FStructWaterfallRenderData& Data : WaterfallRenderDatas)
+	{
+		WaterfallSize += Data.WaterfallVertices.GetAllocatedSize() + Data.WaterfallUVs.GetAllocatedSize()
+			+ Data.WaterfallTriangles.GetAllocatedSize() + Data.WaterfallNormals.GetAllocatedSize();
+	}
+
+	SIZE_T ChunkSize = LandChunkDatas.GetAllocatedSize() + LandChunkIndices.GetAllocatedSize();
+	for (const FStructTerrainChunkData& Data : LandChunkDatas)
+	{
+		for (const FStructTerrainChunkLODData& LODData : Data.LODs)
+		{
+			ChunkSize += LODData.PointIndices.GetAllocatedSize() + LODData.Triangles.GetAllocatedSize();
+		}
+	}
+
+	TArray<TPair<const TCHAR*, SIZE_T>> Sizes = {
+		{ TEXT("TerrainMeshPointsData"), TerrainMeshPointsData.GetAllocatedSize() },
+		{ TEXT("TerrainMeshPointsIndices"), TerrainMeshPointsIndices.GetAllocatedSize() },
+		{ TEXT("WaterMeshPointsIndices"), WaterMeshPointsIndices.GetAllocatedSize() },
+		{ TEXT("RiverEndPoints"), UpperRiverEndPoints.GetAllocatedSize() + LowerRiverEndPoints.GetAllocatedSize() },
+		{ TEXT("RiverLinePointDatas"), RiverLineSize },
+		{ TEXT("Flow"), FlowFilledZRatios.GetAllocatedSize() + FlowOrder.GetAllocatedSize()
+			+ FlowDownstream.GetAllocatedSize() + FlowAccumulation.GetAllocatedSize() },
+		{ TEXT("RiverCarveSources"), RiverCarveSources.GetAllocatedSize() + RiverCarveSourceIndices.GetAllocatedSize() },
+		{ TEXT("WaterfallRenderDatas"), WaterfallSize },
+		{ TEXT("LakeDatas"), LakeSize },
+		{ TEXT("LandChunkDatas"), ChunkSize },
+		{ TEXT("Heightfield"), Heightfield.GetAllocatedSize() },
+		{ TEXT("WaterDistances"), RiverDistances.GetAllocatedSize() + LakeDistances.GetAllocatedSize()
+			+ CoastDistances.GetAllocatedSize() },
+		{ TEXT("Vertices"), Vertices.GetAllocatedSize() },
+		{ TEXT("Triangles"), Triangles.GetAllocatedSize() },
+		{ TEXT("VertexColors"), VertexColors.GetAllocatedSize() },
+		{ TEXT("WaterTriangles"), WaterTriangles.GetAllocatedSize() }
+	};
+
+	SIZE_T Total = 0;
+	for (const TPair<const TCHAR*, SIZE_T>& Size : Sizes)
+	{
+		Total += Size.Value;
+	}
+	UE_LOG(TerrainGenerator, Log, TEXT("Terrain memory %s, GridRange %d: %llu KB"), Label, GridRange, (uint64)(Total / 1024));
+	for (const TPair<const TCHAR*, SIZE_T>& Size : Sizes)
+	{
+		UE_LOG(TerrainGenerator, Log, TEXT("    %s: %llu KB"), Size.Key, (uint64)(Size.Value / 1024));
+	}
 }
 
 // Called every frame
@@ -2089,19 +3635,108 @@ bool ATerrainGenerator::GetMeshPointByLineTrance(UProceduralMeshComponent* Mesh,
 
 bool ATerrainGenerator::GetTerrainPointByLineTrace(FVector Start, FVector End, FVector& Loc)
 {
-	return GetMeshPointByLineTrance(TerrainMesh, Start, End, Loc);
+	return Heightfield.Raycast(Start, End, Loc);
 }
 
 bool ATerrainGenerator::GetTerrainPointBy2DPos(FVector2D Start2D, FVector2D End2D, FVector& Loc)
 {
 	FVector Start(Start2D.X, Start2D.Y, TileAltitudeMax);
 	FVector End(End2D.X, End2D.Y, -TileAltitudeMax);
+	if (Start2D.Equals(End2D)) {
+		float Z;
+		if (!Heightfield.SampleHeight(Start2D, Z) || Z > Start.Z || Z < End.Z) {
+			return false;
+		}
+		Loc.Set(Start2D.X, Start2D.Y, Z);
+		return true;
+	}
 	return GetTerrainPointByLineTrace(Start, End, Loc);
 }
 
+//The water mesh is a flat plane at WaterBase
 bool ATerrainGenerator::GetWaterPointByLineTrance(FVector Start, FVector End, FVector& Loc)
 {
-	return GetMeshPointByLineTrance(WaterMesh, Start, End, Loc);
+	if (!HasWater) {
+		return false;
+	}
+	float WaterZ = WaterBase + WaterMesh->GetComponentLocation().Z;
+	float StartDZ = Start.Z - WaterZ;
+	float EndDZ = End.Z - WaterZ;
+	if (StartDZ * EndDZ > 0.0 || StartDZ == EndDZ) {
+		return false;
+	}
+	Loc = FMath::Lerp(Start, End, StartDZ / (StartDZ - EndDZ));
+	return true;
+}
+
+void ATerrainGenerator::SetupSweep(ATerrainNoise* InNoise, int32 SeedOffset)
+{
+	FActorSpawnParameters Params;
+	Params.Template = InNoise;
+	Noise = GetWorld()->SpawnActor<ATerrainNoise>(InNoise ? InNoise->GetClass() : ATerrainNoise::StaticClass(), Params);
+	if (Noise) {
+		Noise->OffsetSeeds(SeedOffset);
+	}
+
+	IsHeadless = true;
+	UseTerrainCache = false;
+	UseStageCache = false;
+	UseProgressivePreview = false;
+}
+
+void ATerrainGenerator::GetSweepMetrics(float& OutLandRatio, int32& OutRiverNum, float& OutRiverLength,
+	int32& OutBlockLevelMax, float& OutBlockLevelMean)
+{
+	int32 LandNum = 0;
+	int64 BlockLevelSum = 0;
+	OutBlockLevelMax = 0;
+	for (const FStructTerrainMeshPointData& Data : TerrainMeshPointsData)
+	{
+		if (Data.PositionZRatio > WaterBaseRatio) {
+			LandNum++;
+		}
+		BlockLevelSum += Data.BlockLevel;
+		OutBlockLevelMax = FMath::Max(OutBlockLevelMax, Data.BlockLevel);
+	}
+	int32 Total = FMath::Max(1, TerrainMeshPointsData.Num());
+	OutLandRatio = (float)LandNum / (float)Total;
+	OutBlockLevelMean = (float)BlockLevelSum / (float)Total;
+
+	OutRiverNum = RiverLinePointDatas.Num();
+	OutRiverLength = 0.0;
+	for (const FStructRiverLinePointData& Data : RiverLinePointDatas)
+	{
+		for (int32 i = 1; i < Data.LinePointIndices.Num(); i++)
+		{
+			OutRiverLength += FVector2D::Distance(GetPointPosition2D(Data.LinePointIndices[i - 1]),
+				GetPointPosition2D(Data.LinePointIndices[i]));
+		}
+	}
+}
+
+//Top down, height as gray, water tinted blue, off map black
+void ATerrainGenerator::GetHeightThumbnail(int32 Size, TArray<FColor>& OutPixels)
+{
+	Size = FMath::Max(1, Size);
+	OutPixels.Init(FColor::Black, Size * Size);
+	float HalfExtent = GridRange * TileSizeMultiplier;
+	FVector Origin = TerrainMesh->GetComponentLocation();
+	float WaterZ = WaterBaseRatio * TileAltitudeMultiplier;
+	for (int32 Y = 0; Y < Size; Y++)
+	{
+		for (int32 X = 0; X < Size; X++)
+		{
+			FVector2D Pos(Origin.X + ((X + 0.5) / Size * 2.0 - 1.0) * HalfExtent,
+				Origin.Y + ((Y + 0.5) / Size * 2.0 - 1.0) * HalfExtent);
+			float Z;
+			if (!Heightfield.SampleHeight(Pos, Z)) {
+				continue;
+			}
+			Z -= Origin.Z;
+			uint8 Gray = (uint8)FMath::Clamp(FMath::RoundToInt((Z / TileAltitudeMultiplier * 0.5 + 0.5) * 255.0), 0, 255);
+			OutPixels[Y * Size + X] = Z < WaterZ ? FColor(Gray / 4, Gray / 2, Gray) : FColor(Gray, Gray, Gray);
+		}
+	}
 }
 
 Enum_TerrainType ATerrainGenerator::GetTerrainType(FVector2D Point, float& OutMoisture, float& OutTemperature)
@@ -2116,8 +3751,8 @@ Enum_TerrainType ATerrainGenerator::GetTerrainType(FVector2D Point, float& OutMo
 	if (TerrainMeshPointsIndices.Contains(key)) {
 		int32 Index = TerrainMeshPointsIndices[key];
 		float ZRatio = TerrainMeshPointsData[Index].PositionZRatio;
-		float Moisture = CalMoisture(X, Y);
-		float Temperature = CalTemperature(X, Y);
+		float Moisture = CalMoisture(X, Y, ZRatio, TerrainTypeDetailWavelength);
+		float Temperature = CalTemperature(X, Y, TerrainTypeDetailWavelength);
 		OutMoisture = Moisture;
 		OutTemperature = Temperature;
 
@@ -2206,6 +3841,27 @@ int32 ATerrainGenerator::GetScalarStep(float Scalar, float Lower, float Upper)
 	return Ret;
 }
 
+bool ATerrainGenerator::GetPointWaterDistances(int32 Index, float& OutRiver, float& OutLake, float& OutCoast)
+{
+	if (!RiverDistances.IsValidIndex(Index)) {
+		return false;
+	}
+	OutRiver = RiverDistances[Index];
+	OutLake = LakeDistances[Index];
+	OutCoast = CoastDistances[Index];
+	return true;
+}
+
+bool ATerrainGenerator::GetWaterDistancesAt(FVector2D Point, float& OutRiver, float& OutLake, float& OutCoast)
+{
+	//World space like GetTerrainPointBy2DPos, the heightfield knows where the mesh sits
+	const int32* Index = TerrainMeshPointsIndices.Find(Heightfield.GetCoord(Point));
+	if (Index == nullptr) {
+		return false;
+	}
+	return GetPointWaterDistances(*Index, OutRiver, OutLake, OutCoast);
+}
+
 bool ATerrainGenerator::HasTreeAt(const FVector2D& Point)
 {
 	bool Ret = false;
@@ -2228,9 +3884,9 @@ float ATerrainGenerator::GetTreeDensity(Enum_TerrainType TT)
 	return 0.0;
 }
 
-float ATerrainGenerator::CalTree(int32 X, int32 Y)
+float ATerrainGenerator::CalTree(int32 X, int32 Y, float DetailWavelength)
 {
-	return GetNoise2DStd(Noise->NWTree, X, Y, TreeSampleScale, TreeValueScale);
+	return GetNoise2DStd(Noise->NWTree, Noise->GNTree, X, Y, TreeSampleScale, TreeValueScale, DetailWavelength);
 }
 
 void ATerrainGenerator::GetDebugRiverLineEndPoints(TArray<FVector>& Points)
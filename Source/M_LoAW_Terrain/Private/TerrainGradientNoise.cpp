@@ -0,0 +1,234 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "TerrainGradientNoise.h"
+#include <random>
+
+namespace
+{
+	const float GradX[] = { 1, -1, 1, -1, 1, -1, 1, -1, 0, 0, 0, 0 };
+	const float GradY[] = { 1, 1, -1, -1, 0, 0, 0, 0, 1, -1, 1, -1 };
+
+	FORCEINLINE void InterpWithDerivative(EFastNoise_Interp Interp, float T, float& OutS, float& OutDS)
+	{
+		switch (Interp)
+		{
+		case EFastNoise_Interp::Linear:
+			OutS = T;
+			OutDS = 1.0f;
+			break;
+		case EFastNoise_Interp::Hermite:
+			OutS = T * T * (3.0f - 2.0f * T);
+			OutDS = 6.0f * T * (1.0f - T);
+			break;
+		case EFastNoise_Interp::Quintic:
+		default:
+			OutS = T * T * T * (T * (T * 6.0f - 15.0f) + 10.0f);
+			OutDS = 30.0f * T * T * (T - 1.0f) * (T - 1.0f);
+			break;
+		}
+	}
+}
+
+TerrainGradientNoise::TerrainGradientNoise()
+{
+	Setup(Seed, Frequency, Interp, FractalType, Octaves, Lacunarity, Gain);
+}
+
+TerrainGradientNoise::~TerrainGradientNoise()
+{
+}
+
+void TerrainGradientNoise::Setup(int32 InSeed, float InFrequency, EFastNoise_Interp InInterp,
+	EFastNoise_FractalType InFractalType, int32 InOctaves, float InLacunarity, float InGain)
+{
+	Seed = InSeed;
+	Frequency = InFrequency;
+	Interp = InInterp;
+	FractalType = InFractalType;
+	Octaves = InOctaves;
+	Lacunarity = InLacunarity;
+	Gain = InGain;
+
+	//Same shuffle as FastNoise::SetSeed
+	std::mt19937_64 Gen(Seed);
+	for (int32 i = 0; i < 256; i++) {
+		Perm[i] = i;
+	}
+	for (int32 j = 0; j < 256; j++)
+	{
+		int32 Rng = (int32)(Gen() % (256 - j));
+		int32 k = Rng + j;
+		int32 l = Perm[j];
+		Perm[j] = Perm[j + 256] = Perm[k];
+		Perm[k] = l;
+		Perm12[j] = Perm12[j + 256] = Perm[j] % 12;
+	}
+
+	CalculateFractalBounding();
+}
+
+void TerrainGradientNoise::CalculateFractalBounding()
+{
+	float Amp = Gain;
+	float AmpFractal = 1.0f;
+	for (int32 i = 1; i < Octaves; i++)
+	{
+		AmpFractal += Amp;
+		Amp *= Gain;
+	}
+	FractalBounding = 1.0f / AmpFractal;
+}
+
+float TerrainGradientNoise::GetNoise2D(float X, float Y) const
+{
+	FVector2D Gradient;
+	return GetNoise2D(X, Y, Gradient);
+}
+
+float TerrainGradientNoise::GetNoise2D(float X, float Y, FVector2D& OutGradient) const
+{
+	return GetNoise2D(X, Y, OutGradient, Octaves);
+}
+
+float TerrainGradientNoise::GetNoise2D(float X, float Y, FVector2D& OutGradient, int32 MaxOctaves) const
+{
+	int32 OctaveNum = FMath::Clamp(MaxOctaves, 1, Octaves);
+	X *= Frequency;
+	Y *= Frequency;
+
+	float Value = 0.0f;
+	switch (FractalType)
+	{
+	case EFastNoise_FractalType::Billow:
+		Value = SinglePerlinFractalBillow(X, Y, OctaveNum, OutGradient);
+		break;
+	case EFastNoise_FractalType::RigidMulti:
+		Value = SinglePerlinFractalRigidMulti(X, Y, OctaveNum, OutGradient);
+		break;
+	case EFastNoise_FractalType::FBM:
+	default:
+		Value = SinglePerlinFractalFBM(X, Y, OctaveNum, OutGradient);
+		break;
+	}
+	OutGradient *= Frequency;
+	return Value;
+}
+
+int32 TerrainGradientNoise::GetOctavesForWavelength(float Wavelength) const
+{
+	if (Wavelength <= 0.0f || Frequency <= 0.0f || Lacunarity <= 1.0f) {
+		return Octaves;
+	}
+	//Octave i repeats every 1 / (Frequency * Lacunarity^i)
+	float Ratio = 1.0f / (Frequency * Wavelength);
+	if (Ratio < 1.0f) {
+		return 1;
+	}
+	int32 Num = FMath::FloorToInt(FMath::Loge(Ratio) / FMath::Loge(Lacunarity)) + 1;
+	return FMath::Clamp(Num, 1, Octaves);
+}
+
+float TerrainGradientNoise::SinglePerlin(uint8 Offset, float X, float Y, FVector2D& OutGradient) const
+{
+	int32 X0 = FastFloor(X);
+	int32 Y0 = FastFloor(Y);
+	int32 X1 = X0 + 1;
+	int32 Y1 = Y0 + 1;
+
+	float XD0 = X - (float)X0;
+	float YD0 = Y - (float)Y0;
+	float XD1 = XD0 - 1.0f;
+	float YD1 = YD0 - 1.0f;
+
+	float XS, YS, DXS, DYS;
+	InterpWithDerivative(Interp, XD0, XS, DXS);
+	InterpWithDerivative(Interp, YD0, YS, DYS);
+
+	uint8 L00 = Index2D12(Offset, X0, Y0);
+	uint8 L10 = Index2D12(Offset, X1, Y0);
+	uint8 L01 = Index2D12(Offset, X0, Y1);
+	uint8 L11 = Index2D12(Offset, X1, Y1);
+
+	float G00 = XD0 * GradX[L00] + YD0 * GradY[L00];
+	float G10 = XD1 * GradX[L10] + YD0 * GradY[L10];
+	float G01 = XD0 * GradX[L01] + YD1 * GradY[L01];
+	float G11 = XD1 * GradX[L11] + YD1 * GradY[L11];
+
+	float XF0 = FMath::Lerp(G00, G10, XS);
+	float XF1 = FMath::Lerp(G01, G11, XS);
+
+	float DXF0X = FMath::Lerp(GradX[L00], GradX[L10], XS) + DXS * (G10 - G00);
+	float DXF1X = FMath::Lerp(GradX[L01], GradX[L11], XS) + DXS * (G11 - G01);
+	float DXF0Y = FMath::Lerp(GradY[L00], GradY[L10], XS);
+	float DXF1Y = FMath::Lerp(GradY[L01], GradY[L11], XS);
+
+	OutGradient.X = FMath::Lerp(DXF0X, DXF1X, YS);
+	OutGradient.Y = FMath::Lerp(DXF0Y, DXF1Y, YS) + DYS * (XF1 - XF0);
+	return FMath::Lerp(XF0, XF1, YS);
+}
+
+float TerrainGradientNoise::SinglePerlinFractalFBM(float X, float Y, int32 OctaveNum, FVector2D& OutGradient) const
+{
+	FVector2D Gradient;
+	float Sum = SinglePerlin(Perm[0], X, Y, OutGradient);
+	float Amp = 1.0f;
+	float Scale = 1.0f;
+	int32 i = 0;
+	while (++i < OctaveNum)
+	{
+		X *= Lacunarity;
+		Y *= Lacunarity;
+		Scale *= Lacunarity;
+		Amp *= Gain;
+		Sum += SinglePerlin(Perm[i], X, Y, Gradient) * Amp;
+		OutGradient += Gradient * (Amp * Scale);
+	}
+	OutGradient *= FractalBounding;
+	return Sum * FractalBounding;
+}
+
+float TerrainGradientNoise::SinglePerlinFractalBillow(float X, float Y, int32 OctaveNum, FVector2D& OutGradient) const
+{
+	FVector2D Gradient;
+	float Value = SinglePerlin(Perm[0], X, Y, Gradient);
+	float Sum = FMath::Abs(Value) * 2.0f - 1.0f;
+	OutGradient = Gradient * (FMath::Sign(Value) * 2.0f);
+	float Amp = 1.0f;
+	float Scale = 1.0f;
+	int32 i = 0;
+	while (++i < OctaveNum)
+	{
+		X *= Lacunarity;
+		Y *= Lacunarity;
+		Scale *= Lacunarity;
+		Amp *= Gain;
+		Value = SinglePerlin(Perm[i], X, Y, Gradient);
+		Sum += (FMath::Abs(Value) * 2.0f - 1.0f) * Amp;
+		OutGradient += Gradient * (FMath::Sign(Value) * 2.0f * Amp * Scale);
+	}
+	OutGradient *= FractalBounding;
+	return Sum * FractalBounding;
+}
+
+float TerrainGradientNoise::SinglePerlinFractalRigidMulti(float X, float Y, int32 OctaveNum, FVector2D& OutGradient) const
+{
+	FVector2D Gradient;
+	float Value = SinglePerlin(Perm[0], X, Y, Gradient);
+	float Sum = 1.0f - FMath::Abs(Value);
+	OutGradient = Gradient * -FMath::Sign(Value);
+	float Amp = 1.0f;
+	float Scale = 1.0f;
+	int32 i = 0;
+	while (++i < OctaveNum)
+	{
+		X *= Lacunarity;
+		Y *= Lacunarity;
+		Scale *= Lacunarity;
+		Amp *= Gain;
+		Value = SinglePerlin(Perm[i], X, Y, Gradient);
+		Sum -= (1.0f - FMath::Abs(Value)) * Amp;
+		OutGradient += Gradient * (FMath::Sign(Value) * Amp * Scale);
+	}
+	return Sum;
+}
@@ -0,0 +1,70 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "FastNoiseWrapper.h"
+
+#include "CoreMinimal.h"
+
+/**
+ * Perlin fractal noise returning the value and its analytic derivative from one evaluation.
+ * Permutation table, gradients, interpolation and fractal bounding follow FastNoise, so the
+ * value equals UFastNoiseWrapper::GetNoise2D with the same settings.
+ */
+class M_LOAW_TERRAIN_API TerrainGradientNoise
+{
+private:
+	uint8 Perm[512] = {};
+	uint8 Perm12[512] = {};
+
+	int32 Seed = 0;
+	float Frequency = 0.01f;
+	EFastNoise_Interp Interp = EFastNoise_Interp::Quintic;
+	EFastNoise_FractalType FractalType = EFastNoise_FractalType::FBM;
+	int32 Octaves = 3;
+	float Lacunarity = 2.0f;
+	float Gain = 0.5f;
+	float FractalBounding = 1.0f;
+
+public:
+	TerrainGradientNoise();
+	~TerrainGradientNoise();
+
+	void Setup(int32 InSeed, float InFrequency, EFastNoise_Interp InInterp,
+		EFastNoise_FractalType InFractalType, int32 InOctaves, float InLacunarity, float InGain);
+
+	float GetNoise2D(float X, float Y) const;
+
+	//OutGradient is the derivative with respect to X and Y (frequency included)
+	float GetNoise2D(float X, float Y, FVector2D& OutGradient) const;
+
+	//Sums only the first MaxOctaves octaves. The bounding of the full sum is kept,
+	//so the result is the full value without its finest detail.
+	float GetNoise2D(float X, float Y, FVector2D& OutGradient, int32 MaxOctaves) const;
+
+	//Octaves whose wavelength is at least Wavelength (in input units), at least 1, all when Wavelength <= 0
+	int32 GetOctavesForWavelength(float Wavelength) const;
+
+	FORCEINLINE int32 GetOctaves() const
+	{
+		return Octaves;
+	}
+
+private:
+	void CalculateFractalBounding();
+
+	float SinglePerlin(uint8 Offset, float X, float Y, FVector2D& OutGradient) const;
+	float SinglePerlinFractalFBM(float X, float Y, int32 OctaveNum, FVector2D& OutGradient) const;
+	float SinglePerlinFractalBillow(float X, float Y, int32 OctaveNum, FVector2D& OutGradient) const;
+	float SinglePerlinFractalRigidMulti(float X, float Y, int32 OctaveNum, FVector2D& OutGradient) const;
+
+	FORCEINLINE static int32 FastFloor(float F)
+	{
+		return F >= 0 ? (int32)F : (int32)F - 1;
+	}
+
+	FORCEINLINE uint8 Index2D12(uint8 Offset, int32 X, int32 Y) const
+	{
+		return Perm12[(X & 0xff) + Perm[(Y & 0xff) + Offset]];
+	}
+};
@@ -0,0 +1,240 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "TerrainHeightfield.h"
+
+TerrainHeightfield::TerrainHeightfield()
+{
+}
+
+TerrainHeightfield::~TerrainHeightfield()
+{
+}
+
+void TerrainHeightfield::Init(const FIntPoint& InCoordMin, const FIntPoint& InCoordMax, float InCellSize, const FVector& InOrigin)
+{
+	CoordMin = InCoordMin;
+	SizeX = FMath::Max(0, InCoordMax.X - InCoordMin.X + 1);
+	SizeY = FMath::Max(0, InCoordMax.Y - InCoordMin.Y + 1);
+	CellSize = FMath::Max(InCellSize, KINDA_SMALL_NUMBER);
+	Origin = InOrigin;
+	Heights.Init(0.0, SizeX * SizeY);
+	Valid.Init(false, SizeX * SizeY);
+}
+
+void TerrainHeightfield::SetHeight(const FIntPoint& Coord, float Z)
+{
+	int32 X = Coord.X - CoordMin.X;
+	int32 Y = Coord.Y - CoordMin.Y;
+	if (X < 0 || Y < 0 || X >= SizeX || Y >= SizeY) {
+		return;
+	}
+	int32 Index = GetIndex(X, Y);
+	Heights[Index] = Z;
+	Valid[Index] = true;
+}
+
+void TerrainHeightfield::Reset()
+{
+	Heights.Empty();
+	Valid.Empty();
+	SizeX = 0;
+	SizeY = 0;
+}
+
+bool TerrainHeightfield::SampleHeight(const FVector2D& Pos, float& OutZ) const
+{
+	if (!IsBuilt()) {
+		return false;
+	}
+	FVector GridPos = ToGrid(FVector(Pos.X, Pos.Y, 0.0));
+	if (!SampleGridHeight(GridPos.X, GridPos.Y, OutZ)) {
+		return false;
+	}
+	OutZ += Origin.Z;
+	return true;
+}
+
+bool TerrainHeightfield::Raycast(const FVector& Start, const FVector& End, FVector& OutLoc) const
+{
+	if (!IsBuilt()) {
+		return false;
+	}
+	FVector GridStart = ToGrid(Start);
+	FVector Dir = ToGrid(End) - GridStart;
+
+	//Vertical segments only need the height under them
+	if (FMath::IsNearlyZero(Dir.X) && FMath::IsNearlyZero(Dir.Y)) {
+		float Z;
+		if (!SampleGridHeight(GridStart.X, GridStart.Y, Z)
+			|| Z < FMath::Min(GridStart.Z, GridStart.Z + Dir.Z) || Z > FMath::Max(GridStart.Z, GridStart.Z + Dir.Z)) {
+			return false;
+		}
+		OutLoc = FromGrid(FVector(GridStart.X, GridStart.Y, Z));
+		return true;
+	}
+
+	float TMin = 0.0;
+	float TMax = 1.0;
+	if (!ClipAxis(GridStart.X, Dir.X, 0.0, SizeX - 1, TMin, TMax)
+		|| !ClipAxis(GridStart.Y, Dir.Y, 0.0, SizeY - 1, TMin, TMax)) {
+		return false;
+	}
+
+	//Walk the cells under the segment in order, the first cell with a hit holds the nearest one
+	FVector Enter = GridStart + Dir * TMin;
+	int32 CellX = FMath::Clamp(FMath::FloorToInt(Enter.X), 0, SizeX - 2);
+	int32 CellY = FMath::Clamp(FMath::FloorToInt(Enter.Y), 0, SizeY - 2);
+	int32 StepX = Dir.X > 0.0 ? 1 : -1;
+	int32 StepY = Dir.Y > 0.0 ? 1 : -1;
+	float TDeltaX = Dir.X != 0.0 ? FMath::Abs(1.0 / Dir.X) : UE_BIG_NUMBER;
+	float TDeltaY = Dir.Y != 0.0 ? FMath::Abs(1.0 / Dir.Y) : UE_BIG_NUMBER;
+	float TNextX = Dir.X > 0.0 ? (CellX + 1 - GridStart.X) / Dir.X
+		: (Dir.X < 0.0 ? (CellX - GridStart.X) / Dir.X : UE_BIG_NUMBER);
+	float TNextY = Dir.Y > 0.0 ? (CellY + 1 - GridStart.Y) / Dir.Y
+		: (Dir.Y < 0.0 ? (CellY - GridStart.Y) / Dir.Y : UE_BIG_NUMBER);
+
+	while (true) {
+		float T;
+		if (IntersectCell(CellX, CellY, GridStart, Dir, T)) {
+			OutLoc = FromGrid(GridStart + Dir * T);
+			return true;
+		}
+		if (TNextX < TNextY) {
+			if (TNextX > TMax) {
+				break;
+			}
+			CellX += StepX;
+			TNextX += TDeltaX;
+		}
+		else {
+			if (TNextY > TMax) {
+				break;
+			}
+			CellY += StepY;
+			TNextY += TDeltaY;
+		}
+		if (CellX < 0 || CellY < 0 || CellX > SizeX - 2 || CellY > SizeY - 2) {
+			break;
+		}
+	}
+	return false;
+}
+
+bool TerrainHeightfield::SampleGridHeight(float X, float Y, float& OutZ) const
+{
+	if (X < 0.0 || Y < 0.0 || X > SizeX - 1 || Y > SizeY - 1) {
+		return false;
+	}
+	int32 CellX = FMath::Min(FMath::FloorToInt(X), SizeX - 2);
+	int32 CellY = FMath::Min(FMath::FloorToInt(Y), SizeY - 2);
+	float FX = X - CellX;
+	float FY = Y - CellY;
+
+	int32 I00 = GetIndex(CellX, CellY);
+	int32 I10 = GetIndex(CellX + 1, CellY);
+	int32 I11 = GetIndex(CellX + 1, CellY + 1);
+	int32 I01 = GetIndex(CellX, CellY + 1);
+	if (!Valid[I00]) {
+		return false;
+	}
+
+	//Edge cells missing the far corner are one triangle across the other diagonal
+	if (!Valid[I11]) {
+		if (!Valid[I10] || !Valid[I01] || FX + FY > 1.0) {
+			return false;
+		}
+		OutZ = Heights[I00] + FX * (Heights[I10] - Heights[I00]) + FY * (Heights[I01] - Heights[I00]);
+		return true;
+	}
+	if (FX >= FY) {
+		if (!Valid[I10]) {
+			return false;
+		}
+		OutZ = Heights[I00] + FX * (Heights[I10] - Heights[I00]) + FY * (Heights[I11] - Heights[I10]);
+	}
+	else {
+		if (!Valid[I01]) {
+			return false;
+		}
+		OutZ = Heights[I00] + FY * (Heights[I01] - Heights[I00]) + FX * (Heights[I11] - Heights[I01]);
+	}
+	return true;
+}
+
+bool TerrainHeightfield::IntersectCell(int32 CellX, int32 CellY, const FVector& Start, const FVector& Dir, float& OutT) const
+{
+	int32 I00 = GetIndex(CellX, CellY);
+	int32 I10 = GetIndex(CellX + 1, CellY);
+	int32 I11 = GetIndex(CellX + 1, CellY + 1);
+	int32 I01 = GetIndex(CellX, CellY + 1);
+	if (!Valid[I00]) {
+		return false;
+	}
+	FVector P00(CellX, CellY, Heights[I00]);
+	FVector P10(CellX + 1, CellY, Valid[I10] ? Heights[I10] : 0.0);
+	FVector P11(CellX + 1, CellY + 1, Valid[I11] ? Heights[I11] : 0.0);
+	FVector P01(CellX, CellY + 1, Valid[I01] ? Heights[I01] : 0.0);
+
+	bool IsHit = false;
+	float T;
+	OutT = UE_BIG_NUMBER;
+	if (!Valid[I11]) {
+		if (Valid[I10] && Valid[I01] && IntersectTriangle(Start, Dir, P00, P10, P01, T)) {
+			OutT = T;
+			IsHit = true;
+		}
+		return IsHit;
+	}
+	if (Valid[I10] && IntersectTriangle(Start, Dir, P00, P10, P11, T)) {
+		OutT = T;
+		IsHit = true;
+	}
+	if (Valid[I01] && IntersectTriangle(Start, Dir, P00, P11, P01, T) && T < OutT) {
+		OutT = T;
+		IsHit = true;
+	}
+	return IsHit;
+}
+
+//Moller-Trumbore, two sided, T is the segment parameter in [0, 1]
+bool TerrainHeightfield::IntersectTriangle(const FVector& Start, const FVector& Dir,
+	const FVector& A, const FVector& B, const FVector& C, float& OutT)
+{
+	const float Tolerance = 1e-5;
+	FVector E1 = B - A;
+	FVector E2 = C - A;
+	FVector P = FVector::CrossProduct(Dir, E2);
+	float Det = FVector::DotProduct(E1, P);
+	if (FMath::IsNearlyZero(Det)) {
+		return false;
+	}
+	float InvDet = 1.0 / Det;
+	FVector S = Start - A;
+	float U = FVector::DotProduct(S, P) * InvDet;
+	if (U < -Tolerance || U > 1.0 + Tolerance) {
+		return false;
+	}
+	FVector Q = FVector::CrossProduct(S, E1);
+	float V = FVector::DotProduct(Dir, Q) * InvDet;
+	if (V < -Tolerance || U + V > 1.0 + Tolerance) {
+		return false;
+	}
+	OutT = FVector::DotProduct(E2, Q) * InvDet;
+	return OutT >= 0.0 && OutT <= 1.0;
+}
+
+bool TerrainHeightfield::ClipAxis(float Start, float Dir, float Min, float Max, float& InOutTMin, float& InOutTMax)
+{
+	if (FMath::IsNearlyZero(Dir)) {
+		return Start >= Min && Start <= Max;
+	}
+	float T0 = (Min - Start) / Dir;
+	float T1 = (Max - Start) / Dir;
+	if (T0 > T1) {
+		Swap(T0, T1);
+	}
+	InOutTMin = FMath::Max(InOutTMin, T0);
+	InOutTMax = FMath::Min(InOutTMax, T1);
+	return InOutTMin <= InOutTMax;
+}
@@ -0,0 +1,103 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "TerrainHydrology.h"
+#include "PriorityQueue.h"
+
+TerrainHydrology::TerrainHydrology()
+{
+}
+
+TerrainHydrology::~TerrainHydrology()
+{
+}
+
+void TerrainHydrology::PriorityFloodFunction(int32 Num,
+	TFunctionRef<float(int32 Index)> GetHeight,
+	TFunctionRef<bool(int32 Index)> IsEdge,
+	TFunctionRef<bool(const int32& Current, int32& Next, int32& Index)> NextFunc,
+	float Epsilon,
+	TArray<float>& OutFilled,
+	TArray<int32>& OutOrder)
+{
+	OutFilled.SetNumUninitialized(Num);
+	OutOrder.Reset(Num);
+
+	TArray<bool> Closed;
+	Closed.Init(false, Num);
+	PriorityQueue<int32> Open;
+
+	int32 LowestIndex = INDEX_NONE;
+	for (int32 i = 0; i < Num; i++)
+	{
+		OutFilled[i] = GetHeight(i);
+		if (IsEdge(i)) {
+			Closed[i] = true;
+			Open.Push(i, OutFilled[i]);
+		}
+		if (LowestIndex == INDEX_NONE || OutFilled[i] < OutFilled[LowestIndex]) {
+			LowestIndex = i;
+		}
+	}
+	//Closed domain without edges drains through its lowest point
+	if (Open.IsEmpty() && LowestIndex != INDEX_NONE) {
+		Closed[LowestIndex] = true;
+		Open.Push(LowestIndex, OutFilled[LowestIndex]);
+	}
+
+	while (!Open.IsEmpty()) {
+		int32 Current = Open.Pop();
+		OutOrder.Add(Current);
+
+		int32 Next = INDEX_NONE;
+		int32 Index = 0;
+		while (NextFunc(Current, Next, Index)) {
+			if (Next != INDEX_NONE && !Closed[Next]) {
+				Closed[Next] = true;
+				float Spill = OutFilled[Current] + Epsilon;
+				OutFilled[Next] = OutFilled[Next] > Spill ? OutFilled[Next] : Spill;
+				Open.Push(Next, OutFilled[Next]);
+			}
+			Next = INDEX_NONE;
+		}
+	}
+}
+
+void TerrainHydrology::FlowDirectionFunction(int32 Num,
+	const TArray<float>& Filled,
+	TFunctionRef<bool(const int32& Current, int32& Next, int32& Index)> NextFunc,
+	TFunctionRef<float(int32 Current, int32 Next)> GetDistance,
+	TArray<int32>& OutDownstream)
+{
+	OutDownstream.Init(INDEX_NONE, Num);
+	for (int32 i = 0; i < Num; i++)
+	{
+		float MaxSlope = 0.0;
+		int32 Next = INDEX_NONE;
+		int32 Index = 0;
+		while (NextFunc(i, Next, Index)) {
+			if (Next != INDEX_NONE && Filled[Next] < Filled[i]) {
+				float Slope = (Filled[i] - Filled[Next]) / GetDistance(i, Next);
+				if (Slope > MaxSlope) {
+					MaxSlope = Slope;
+					OutDownstream[i] = Next;
+				}
+			}
+			Next = INDEX_NONE;
+		}
+	}
+}
+
+void TerrainHydrology::FlowAccumulationFunction(const TArray<int32>& Order,
+	const TArray<int32>& Downstream,
+	TArray<int32>& OutAccumulation)
+{
+	OutAccumulation.Init(1, Downstream.Num());
+	for (int32 i = Order.Num() - 1; i >= 0; i--)
+	{
+		int32 Current = Order[i];
+		if (Downstream[Current] != INDEX_NONE) {
+			OutAccumulation[Downstream[Current]] += OutAccumulation[Current];
+		}
+	}
+}
@@ -81,11 +81,8 @@ bool ATerrainInput::IsMouseClick()
 	FVector location, direction;
 	Controller->DeprojectMousePositionToWorld(location, direction);
 
-	FHitResult result;
-	FCollisionQueryParams params;
-	bool isHit = pTG->GetTerrainMesh()->LineTraceComponent(result, location, HoldTraceLength * direction + location,
-		params);
-	return isHit;
+	FVector Loc;
+	return pTG->GetTerrainPointByLineTrace(location, HoldTraceLength * direction + location, Loc);
 }
 
 void ATerrainInput::OnLeftHoldStarted(const FInputActionValue& Value)
@@ -137,12 +134,9 @@ void ATerrainInput::UpdateMousePosition()
 		FVector location, direction;
 		Controller->DeprojectMousePositionToWorld(location, direction);
 
-		FHitResult result;
-		FCollisionQueryParams params;
-		bool isHit = pTG->GetTerrainMesh()->LineTraceComponent(result, location, HoldTraceLength * direction + location,
-			params);
-		if (isHit) {
-			MousePos.Set(result.Location.X, result.Location.Y, result.Location.Z);
+		FVector Loc;
+		if (pTG->GetTerrainPointByLineTrace(location, HoldTraceLength * direction + location, Loc)) {
+			MousePos.Set(Loc.X, Loc.Y, Loc.Z);
 		}
 	}
 }
@@ -0,0 +1,95 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "TerrainLODSelector.h"
+
+TerrainLODSelector::TerrainLODSelector()
+{
+}
+
+TerrainLODSelector::~TerrainLODSelector()
+{
+}
+
+void TerrainLODSelector::Init(const TMap<FIntPoint, FBox>& ChunkBounds, int32 InLODNum, double InBaseRange)
+{
+	Reset();
+	LODNum = FMath::Max(1, InLODNum);
+	BaseRange = FMath::Max(1.0, InBaseRange);
+	if (ChunkBounds.IsEmpty()) {
+		return;
+	}
+
+	//Leaves first, then merge 2 x 2 blocks level by level until one node is left
+	TMap<FIntPoint, int32> LevelNodes;
+	for (const TPair<FIntPoint, FBox>& Chunk : ChunkBounds)
+	{
+		FNode Node;
+		Node.Bounds = Chunk.Value;
+		Node.ChunkCoord = Chunk.Key;
+		LevelNodes.Add(Chunk.Key, Nodes.Add(Node));
+	}
+
+	int32 Level = 0;
+	while (LevelNodes.Num() > 1) {
+		Level++;
+		TMap<FIntPoint, int32> ParentNodes;
+		for (const TPair<FIntPoint, int32>& Child : LevelNodes)
+		{
+			FIntPoint ParentCoord(Child.Key.X >> 1, Child.Key.Y >> 1);
+			int32* pParent = ParentNodes.Find(ParentCoord);
+			if (pParent == nullptr) {
+				FNode Node;
+				Node.Level = Level;
+				pParent = &ParentNodes.Add(ParentCoord, Nodes.Add(Node));
+			}
+			FNode& Parent = Nodes[*pParent];
+			Parent.Bounds += Nodes[Child.Value].Bounds;
+			Parent.Children.Add(Child.Value);
+		}
+		LevelNodes = MoveTemp(ParentNodes);
+	}
+	RootIndex = LevelNodes.CreateConstIterator().Value();
+}
+
+void TerrainLODSelector::Reset()
+{
+	Nodes.Empty();
+	RootIndex = INDEX_NONE;
+}
+
+void TerrainLODSelector::Select(const FVector& ViewPos, TMap<FIntPoint, int32>& OutLODs) const
+{
+	OutLODs.Reset();
+	if (IsBuilt()) {
+		SelectNode(RootIndex, ViewPos, OutLODs);
+	}
+}
+
+void TerrainLODSelector::SelectNode(int32 NodeIndex, const FVector& ViewPos, TMap<FIntPoint, int32>& OutLODs) const
+{
+	const FNode& Node = Nodes[NodeIndex];
+	//Past the last LOD only the coarsest mesh is left, no need to go deeper
+	int32 LOD = FMath::Min(Node.Level, LODNum - 1);
+	if (LOD == 0 || FMath::Sqrt(Node.Bounds.ComputeSquaredDistanceToPoint(ViewPos)) > GetRange(LOD - 1)) {
+		AssignNode(NodeIndex, LOD, OutLODs);
+		return;
+	}
+	for (int32 Child : Node.Children)
+	{
+		SelectNode(Child, ViewPos, OutLODs);
+	}
+}
+
+void TerrainLODSelector::AssignNode(int32 NodeIndex, int32 LOD, TMap<FIntPoint, int32>& OutLODs) const
+{
+	const FNode& Node = Nodes[NodeIndex];
+	if (Node.Level == 0) {
+		OutLODs.Add(Node.ChunkCoord, LOD);
+		return;
+	}
+	for (int32 Child : Node.Children)
+	{
+		AssignNode(Child, LOD, OutLODs);
+	}
+}
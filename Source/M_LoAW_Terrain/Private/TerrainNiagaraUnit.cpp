@@ -28,6 +28,14 @@ void ATerrainNiagaraUnit::SetActive(bool flag)
 	}
 }
 
+void ATerrainNiagaraUnit::CopyEffectFrom(ATerrainNiagaraUnit* Source)
+{
+	if (NiagaraUnit && Source && Source->NiagaraUnit) {
+		NiagaraUnit->SetAsset(Source->NiagaraUnit->GetAsset());
+		NiagaraUnit->SetAutoActivate(Source->NiagaraUnit->IsActive());
+	}
+}
+
 // Called when the game starts or when spawned
 void ATerrainNiagaraUnit::BeginPlay()
 {
@@ -126,12 +126,72 @@ bool ATerrainNoise::Create()
 			NWTree_CDF,
 			NWTree_CRT);
 
+		GNLandLayer0.Setup(NW_Land_Layer_0_NoiseSeed,
+			NW_Land_Layer_0_NoiseFrequency,
+			NW_Land_Layer_0_Interp,
+			NW_Land_Layer_0_FractalType,
+			NW_Land_Layer_0_Octaves,
+			NW_Land_Layer_0_Lacunarity,
+			NW_Land_Layer_0_Gain);
+
+		GNLandLayer1.Setup(NW_Land_Layer_1_NoiseSeed,
+			NW_Land_Layer_1_NoiseFrequency,
+			NW_Land_Layer_1_Interp,
+			NW_Land_Layer_1_FractalType,
+			NW_Land_Layer_1_Octaves,
+			NW_Land_Layer_1_Lacunarity,
+			NW_Land_Layer_1_Gain);
+
+		GNWater.Setup(NWWater_NoiseSeed,
+			NWWater_NoiseFrequency,
+			NWWater_Interp,
+			NWWater_FractalType,
+			NWWater_Octaves,
+			NWWater_Lacunarity,
+			NWWater_Gain);
+
+		GNMoisture.Setup(NWMoisture_NoiseSeed,
+			NWMoisture_NoiseFrequency,
+			NWMoisture_Interp,
+			NWMoisture_FractalType,
+			NWMoisture_Octaves,
+			NWMoisture_Lacunarity,
+			NWMoisture_Gain);
+
+		GNTemperature.Setup(NWTemperature_NoiseSeed,
+			NWTemperature_NoiseFrequency,
+			NWTemperature_Interp,
+			NWTemperature_FractalType,
+			NWTemperature_Octaves,
+			NWTemperature_Lacunarity,
+			NWTemperature_Gain);
+
+		GNTree.Setup(NWTree_NoiseSeed,
+			NWTree_NoiseFrequency,
+			NWTree_Interp,
+			NWTree_FractalType,
+			NWTree_Octaves,
+			NWTree_Lacunarity,
+			NWTree_Gain);
+
 		UE_LOG(TerrainNoise, Log, TEXT("Create Noise successfully."));
 		return true;
 	}
 	return false;
 }
 
+void ATerrainNoise::OffsetSeeds(int32 Offset)
+{
+	NW_Land_Layer_0_NoiseSeed += Offset;
+	NW_Land_Layer_1_NoiseSeed += Offset;
+	NWRiverDirection_NoiseSeed += Offset;
+	NWRiverDepth_NoiseSeed += Offset;
+	NWWater_NoiseSeed += Offset;
+	NWMoisture_NoiseSeed += Offset;
+	NWTemperature_NoiseSeed += Offset;
+	NWTree_NoiseSeed += Offset;
+}
+
 // Called when the game starts or when spawned
 void ATerrainNoise::BeginPlay()
 {
@@ -3,6 +3,7 @@
 #pragma once
 
 #include "FastNoiseWrapper.h"
+#include "TerrainGradientNoise.h"
 
 #include "CoreMinimal.h"
 #include "GameFramework/Actor.h"
@@ -14,6 +15,9 @@ UCLASS()
 class M_LOAW_TERRAIN_API ATerrainNoise : public AActor
 {
 	GENERATED_BODY()
+
+	//The stage cache maps the noise properties by checked member name
+	friend class ATerrainGenerator;
 	
 private:
 	//noise param for land layer 0
@@ -157,12 +161,23 @@ public:
 	UFastNoiseWrapper* NWTemperature = nullptr;
 	UFastNoiseWrapper* NWTree = nullptr;
 
+	//Same layers as above, evaluated with analytic derivatives
+	TerrainGradientNoise GNLandLayer0;
+	TerrainGradientNoise GNLandLayer1;
+	TerrainGradientNoise GNWater;
+	TerrainGradientNoise GNMoisture;
+	TerrainGradientNoise GNTemperature;
+	TerrainGradientNoise GNTree;
+
 public:	
 	// Sets default values for this actor's properties
 	ATerrainNoise();
 
 	bool Create();
 
+	//Shifts every layer seed, call before Create
+	void OffsetSeeds(int32 Offset);
+
 protected:
 	// Called when the game starts or when spawned
 	virtual void BeginPlay() override;
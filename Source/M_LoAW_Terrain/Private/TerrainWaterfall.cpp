@@ -19,3 +19,12 @@ void ATerrainWaterfall::SetParamVelocityScale(FVector VecScale)
 		NiagaraUnit->SetVariableVec3(VelocityScaleName, VelocityScale);
 	}
 }
+
+void ATerrainWaterfall::CopyEffectFrom(ATerrainNiagaraUnit* Source)
+{
+	Super::CopyEffectFrom(Source);
+	if (ATerrainWaterfall* Waterfall = Cast<ATerrainWaterfall>(Source)) {
+		SetParamLifeTimeScale(Waterfall->GetLifeTimeScale());
+		SetParamVelocityScale(Waterfall->GetVelocityScale());
+	}
+}
@@ -11,3 +11,11 @@ void ATerrainWaterfallMist::SetParamWaterfallRadius(FVector2D Radius)
 		NiagaraUnit->SetVariableVec2(WaterfallRadiusName, WaterfallRadius);
 	}
 }
+
+void ATerrainWaterfallMist::CopyEffectFrom(ATerrainNiagaraUnit* Source)
+{
+	Super::CopyEffectFrom(Source);
+	if (ATerrainWaterfallMist* Mist = Cast<ATerrainWaterfallMist>(Source)) {
+		SetParamWaterfallRadius(Mist->GetWaterfallRadius());
+	}
+}
@@ -24,6 +24,16 @@ struct TStructAStarData
 	T Goal;
 };
 
+//A* state over dense point indices, flat arrays instead of maps.
+//Only the touched entries are reset between searches, so one state can serve many searches on a thread.
+struct FStructDenseAStarData
+{
+	PriorityQueue<int32> Frontier = {};
+	TArray<float> CostSoFar = {};
+	TArray<int32> CameFrom = {};
+	TArray<int32> Touched = {};
+};
+
 /**
  * 
  */
@@ -171,6 +181,104 @@ public:
 		return false;
 	}
 
+	//Multi-source distance transform over dense point indices.
+	//All sources start in one BFS frontier, so every point is visited once: O(N) in total.
+	//OutDistances[i] is the step count to the nearest source, capped at MaxDistance.
+	//NextFunc leaves Next untouched for a missing neighbor, it is reset to INDEX_NONE between calls.
+	FORCEINLINE static void DistanceTransformFunction(int32 Num,
+		TFunctionRef<bool(int32 Index)> IsSource,
+		TFunctionRef<bool(const int32& Current, int32& Next, int32& Index)> NextFunc,
+		int32 MaxDistance,
+		TArray<int32>& OutDistances)
+	{
+		OutDistances.Init(MaxDistance, Num);
+		TArray<int32> Frontier;
+		Frontier.Reserve(Num);
+		for (int32 i = 0; i < Num; i++)
+		{
+			if (IsSource(i)) {
+				OutDistances[i] = 0;
+				Frontier.Add(i);
+			}
+		}
+
+		int32 Head = 0;
+		while (Head < Frontier.Num()) {
+			int32 Current = Frontier[Head++];
+			int32 NextDistance = OutDistances[Current] + 1;
+			if (NextDistance >= MaxDistance) {
+				continue;
+			}
+
+			int32 Next = INDEX_NONE;
+			int32 Index = 0;
+			while (NextFunc(Current, Next, Index)) {
+				if (Next != INDEX_NONE && OutDistances[Next] > NextDistance) {
+					OutDistances[Next] = NextDistance;
+					Frontier.Add(Next);
+				}
+				Next = INDEX_NONE;
+			}
+		}
+	}
+
+	//Multi-source distance transform that keeps, per point, the source with the lowest GetScore(SourceId, Distance).
+	//All sources share one queue, CanReach(Index, SourceId, Distance) limits the spread (radius, blocked points).
+	//A point is expanded again only when a competing source improves its score, so overlaps are not walked twice.
+	//Unreached points keep MAX_int32 distance and INDEX_NONE source.
+	FORCEINLINE static void BestSourceTransformFunction(int32 Num,
+		const TArray<int32>& Sources,
+		TFunctionRef<bool(const int32& Current, int32& Next, int32& Index)> NextFunc,
+		TFunctionRef<bool(int32 Index, int32 SourceId, int32 Distance)> CanReach,
+		TFunctionRef<float(int32 SourceId, int32 Distance)> GetScore,
+		TArray<int32>& OutDistances,
+		TArray<int32>& OutBestSource)
+	{
+		OutDistances.Init(MAX_int32, Num);
+		OutBestSource.Init(INDEX_NONE, Num);
+		TArray<float> Scores;
+		Scores.Init(TNumericLimits<float>::Max(), Num);
+		TBitArray<> Queued(false, Num);
+		TArray<int32> Frontier;
+		Frontier.Reserve(Sources.Num());
+
+		//Queued points spread whichever source holds them when they are popped
+		auto Relax = [&](int32 Point, int32 SourceId, int32 Distance) {
+			float Score = GetScore(SourceId, Distance);
+			if (Score < Scores[Point]) {
+				Scores[Point] = Score;
+				OutDistances[Point] = Distance;
+				OutBestSource[Point] = SourceId;
+				if (!Queued[Point]) {
+					Queued[Point] = true;
+					Frontier.Add(Point);
+				}
+			}
+			};
+
+		for (int32 i = 0; i < Sources.Num(); i++)
+		{
+			Relax(Sources[i], i, 0);
+		}
+
+		int32 Head = 0;
+		while (Head < Frontier.Num()) {
+			int32 Current = Frontier[Head++];
+			Queued[Current] = false;
+			int32 SourceId = OutBestSource[Current];
+			int32 NextDistance = OutDistances[Current] + 1;
+
+			int32 Next = INDEX_NONE;
+			int32 Index = 0;
+			while (NextFunc(Current, Next, Index)) {
+				if (Next != INDEX_NONE && CanReach(Next, SourceId, NextDistance)) {
+					Relax(Next, SourceId, NextDistance);
+				}
+				Next = INDEX_NONE;
+			}
+		}
+	}
+
 	//A* Search
 	template <class T>
 	FORCEINLINE static bool AStarSearchLoopFunction(AActor* Owner,
@@ -279,6 +387,79 @@ public:
 		}
 	}
 
+	//Same expansion order as AStarSearchFunction, so the path matches it for the same inputs.
+	//Returns false and leaves Path empty if Goal can not be reached.
+	FORCEINLINE static bool DenseAStarSearchFunction(FStructDenseAStarData& AStarData,
+		int32 Num, int32 Start, int32 Goal,
+		TFunctionRef<bool(const int32& Current, int32& Next, int32& Index)> NextFunc,
+		TFunctionRef<float(const int32& Current, const int32& Next)> Cost,
+		TFunctionRef<float(const int32& Goal, const int32& Next)> Heuristic,
+		TArray<int32>& Path)
+	{
+		if (AStarData.CostSoFar.Num() != Num) {
+			AStarData.CostSoFar.Init(MAX_flt, Num);
+			AStarData.CameFrom.Init(INDEX_NONE, Num);
+			AStarData.Touched.Reset();
+		}
+		else {
+			for (int32 Touched : AStarData.Touched) {
+				AStarData.CostSoFar[Touched] = MAX_flt;
+				AStarData.CameFrom[Touched] = INDEX_NONE;
+			}
+			AStarData.Touched.Reset();
+		}
+		AStarData.Frontier.Empty();
+
+		AStarData.Frontier.Push(Start, 0.0);
+		AStarData.CostSoFar[Start] = 0.0;
+		AStarData.Touched.Add(Start);
+
+		bool bFound = false;
+		while (!AStarData.Frontier.IsEmpty()) {
+			int32 Current = AStarData.Frontier.Pop();
+			if (Current == Goal) {
+				bFound = true;
+				break;
+			}
+
+			int32 Next = INDEX_NONE;
+			int32 Index = 0;
+			while (NextFunc(Current, Next, Index)) {
+				if (Next != INDEX_NONE) {
+					float NewCost = AStarData.CostSoFar[Current] + Cost(Current, Next);
+					bool flag = false;
+					if (AStarData.CostSoFar[Next] == MAX_flt) {
+						AStarData.CostSoFar[Next] = NewCost;
+						AStarData.Touched.Add(Next);
+						flag = true;
+					}
+					else if (NewCost < AStarData.CostSoFar[Next]) {
+						AStarData.CostSoFar[Next] = NewCost;
+						flag = true;
+					}
+					if (flag) {
+						AStarData.Frontier.Push(Next, NewCost + Heuristic(Goal, Next));
+						AStarData.CameFrom[Next] = Current;
+					}
+				}
+				Next = INDEX_NONE;
+			}
+		}
+
+		Path.Reset();
+		if (!bFound) {
+			return false;
+		}
+		int32 Current = Goal;
+		while (Current != Start) {
+			Path.Add(Current);
+			Current = AStarData.CameFrom[Current];
+		}
+		Path.Add(Start);
+		Algo::Reverse(Path);
+		return true;
+	}
+
 	template <class T>
 	FORCEINLINE static void ReconstructPath(const T& Goal, const T& Start, 
 		const TMap<T, T>& CameFrom, 
@@ -0,0 +1,63 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+struct FStructComponentStats
+{
+	int32 Size = 0;
+	FVector2D Centroid = FVector2D::ZeroVector;
+	FIntPoint BoundsMin = FIntPoint(MAX_int32, MAX_int32);
+	FIntPoint BoundsMax = FIntPoint(MIN_int32, MIN_int32);
+	//Point with the highest score, the lowest index wins ties
+	int32 Representative = INDEX_NONE;
+	float RepresentativeScore = 0.0;
+};
+
+/**
+ * Connected component labeling over dense point indices with union-find.
+ * Labels are dense, numbered in order of each component's lowest index.
+ */
+class M_LOAW_TERRAIN_API ComponentLabelUtility
+{
+public:
+	ComponentLabelUtility();
+	~ComponentLabelUtility();
+
+	//Returns the component count, OutLabels[i] is INDEX_NONE for points outside every component
+	static int32 LabelComponents(int32 Num,
+		TFunctionRef<bool(int32 Index)> InComponent,
+		TFunctionRef<bool(const int32& Current, int32& Next, int32& Index)> NextFunc,
+		TArray<int32>& OutLabels);
+
+	static void CalComponentStats(const TArray<int32>& Labels, int32 ComponentNum,
+		TFunctionRef<FIntPoint(int32 Index)> GetCoord,
+		TFunctionRef<float(int32 Index)> GetScore,
+		TArray<FStructComponentStats>& OutStats);
+
+	//Labels and stats in one call
+	static int32 FindComponents(int32 Num,
+		TFunctionRef<bool(int32 Index)> InComponent,
+		TFunctionRef<bool(const int32& Current, int32& Next, int32& Index)> NextFunc,
+		TFunctionRef<FIntPoint(int32 Index)> GetCoord,
+		TFunctionRef<float(int32 Index)> GetScore,
+		TArray<int32>& OutLabels,
+		TArray<FStructComponentStats>& OutStats);
+
+	//Component ids ordered by size descending, ties by id
+	static void SortComponentsBySize(const TArray<FStructComponentStats>& Stats, TArray<int32>& OutOrder);
+
+private:
+	FORCEINLINE static int32 FindRoot(TArray<int32>& Parents, int32 Index)
+	{
+		while (Parents[Index] != Index) {
+			//Path halving
+			Parents[Index] = Parents[Parents[Index]];
+			Index = Parents[Index];
+		}
+		return Index;
+	}
+
+	static void Union(TArray<int32>& Parents, TArray<int32>& Sizes, int32 A, int32 B);
+};
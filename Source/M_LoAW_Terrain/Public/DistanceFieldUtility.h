@@ -0,0 +1,30 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * Exact Euclidean distance transform on a dense grid (Felzenszwalb and Huttenlocher),
+ * linear in the cell count: one lower envelope of parabolas per column, then per row.
+ */
+class M_LOAW_TERRAIN_API DistanceFieldUtility
+{
+public:
+	DistanceFieldUtility();
+	~DistanceFieldUtility();
+
+	//Cell index is Y * SizeX + X. Distance in cells to the nearest seed,
+	//TNumericLimits<float>::Max() everywhere when there is no seed.
+	static void DistanceTransform(int32 SizeX, int32 SizeY, const TBitArray<>& Seeds, TArray<float>& OutDistances);
+
+private:
+	//Squared distances of one line, F and D are read and written with Stride
+	static void DistanceTransform1D(double* Data, int32 Num, int32 Stride, double* F, int32* V, double* Z);
+
+	//Where the parabolas rooted at Q and P cross
+	FORCEINLINE static double Intersect(const double* F, int32 Q, int32 P)
+	{
+		return ((F[Q] + (double)Q * Q) - (F[P] + (double)P * P)) / (2.0 * (Q - P));
+	}
+};
@@ -0,0 +1,45 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * Memory layouts that keep grid neighbors close: Z-order (Morton) for points,
+ * Forsyth's linear-speed vertex cache optimization for triangle lists.
+ */
+class M_LOAW_TERRAIN_API MeshOrderUtility
+{
+public:
+	MeshOrderUtility();
+	~MeshOrderUtility();
+
+	//OutOrder[i] is the index into Coords of the i-th point in Z-order, ties keep their input order
+	static void SortByMortonCode(const TArray<FIntPoint>& Coords, TArray<int32>& OutOrder);
+
+	//Reorders the triangles for a vertex cache of CacheSize, winding and triangle set stay the same.
+	//Indices must be below VertexNum.
+	static void OptimizeTriangleOrder(TArray<int32>& InOutTriangles, int32 VertexNum);
+
+	static constexpr int32 CacheSize = 32;
+
+private:
+	//Bits of X on even positions, Y on odd ones, 16 bits per axis
+	FORCEINLINE static uint32 MortonCode(uint32 X, uint32 Y)
+	{
+		return SpreadBits(X) | (SpreadBits(Y) << 1);
+	}
+
+	FORCEINLINE static uint32 SpreadBits(uint32 Value)
+	{
+		Value &= 0x0000FFFF;
+		Value = (Value | (Value << 8)) & 0x00FF00FF;
+		Value = (Value | (Value << 4)) & 0x0F0F0F0F;
+		Value = (Value | (Value << 2)) & 0x33333333;
+		Value = (Value | (Value << 1)) & 0x55555555;
+		return Value;
+	}
+
+	//Recently used vertices score high, so do vertices with few triangles left
+	static float GetVertexScore(int32 CachePosition, int32 RemainingNum);
+};
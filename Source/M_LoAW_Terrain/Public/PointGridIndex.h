@@ -0,0 +1,80 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * Uniform grid over axial coordinates for radius and nearest queries.
+ * Distance is Manhattan, the same as Quad::Distance.
+ */
+class M_LOAW_TERRAIN_API PointGridIndex
+{
+private:
+	struct FEntry
+	{
+		int32 Id = 0;
+		FIntPoint Coord = FIntPoint();
+	};
+
+	TMap<FIntPoint, TArray<FEntry>> Cells = {};
+	int32 CellSize = 1;
+	int32 Num = 0;
+	FIntPoint CellMin = FIntPoint(MAX_int32, MAX_int32);
+	FIntPoint CellMax = FIntPoint(MIN_int32, MIN_int32);
+
+public:
+	PointGridIndex();
+	PointGridIndex(int32 InCellSize);
+	~PointGridIndex();
+
+	void Add(int32 Id, const FIntPoint& Coord);
+	bool Remove(int32 Id, const FIntPoint& Coord);
+
+	//Ids with distance <= Radius, sorted by Id
+	void QueryRadius(const FIntPoint& Center, int32 Radius, TArray<int32>& OutIds) const;
+	bool HasPointInRadius(const FIntPoint& Center, int32 Radius) const;
+
+	//Up to K ids with distance >= MinDistance, nearest first, ties by Id
+	void FindNearest(const FIntPoint& Center, int32 K, int32 MinDistance, TArray<int32>& OutIds) const;
+
+	FORCEINLINE int32 GetNum() const
+	{
+		return Num;
+	}
+
+private:
+	FIntPoint GetCell(const FIntPoint& Coord) const;
+	int32 GetMaxRing(const FIntPoint& CenterCell) const;
+
+	FORCEINLINE static int32 FloorDiv(int32 A, int32 B)
+	{
+		return A >= 0 ? A / B : (A - B + 1) / B;
+	}
+
+	FORCEINLINE static int32 Distance(const FIntPoint& A, const FIntPoint& B)
+	{
+		return FMath::Abs(A.X - B.X) + FMath::Abs(A.Y - B.Y);
+	}
+
+	template <class FuncType>
+	void ForEachCellInRing(const FIntPoint& CenterCell, int32 Ring, FuncType Func) const
+	{
+		if (Ring == 0) {
+			if (const TArray<FEntry>* Cell = Cells.Find(CenterCell)) {
+				Func(*Cell);
+			}
+			return;
+		}
+		for (int32 X = -Ring; X <= Ring; X++)
+		{
+			int32 Step = (X == -Ring || X == Ring) ? 1 : Ring * 2;
+			for (int32 Y = -Ring; Y <= Ring; Y += Step)
+			{
+				if (const TArray<FEntry>* Cell = Cells.Find(CenterCell + FIntPoint(X, Y))) {
+					Func(*Cell);
+				}
+			}
+		}
+	}
+};
@@ -0,0 +1,28 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * Helpers for the terrain derived data cache: property text for cache keys
+ * and binary save/load of USTRUCT data.
+ */
+class M_LOAW_TERRAIN_API TerrainCacheUtility
+{
+public:
+	TerrainCacheUtility();
+	~TerrainCacheUtility();
+
+	//Appends "Name=Value;" for each property in declaration order, only those passing Filter when given.
+	//Object references are skipped, except float curves which add their keys.
+	static void AppendProperties(const UStruct* Struct, const void* Container, bool EditableOnly, FString& OutText,
+		TFunction<bool(const FProperty* Property)> Filter = nullptr);
+
+	static FString HashText(const FString& Text);
+
+	static FString GetCachePath(const FString& Folder, const FString& Key);
+
+	static bool SaveStruct(const FString& Path, const UScriptStruct* Struct, void* Data);
+	static bool LoadStruct(const FString& Path, const UScriptStruct* Struct, void* Data);
+};
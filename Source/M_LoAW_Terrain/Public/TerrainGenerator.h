@@ -7,28 +7,34 @@
 #include "AStarUtility.h"
 #include "TerrainWaterfall.h"
 #include "TerrainWaterfallMist.h"
+#include "TerrainHeightfield.h"
+#include "TerrainLODSelector.h"
+#include "ProceduralMeshComponent.h"
 
 #include "CoreMinimal.h"
+#include "Async/Future.h"
+#include <atomic>
 #include "GameFramework/Actor.h"
 #include "TerrainGenerator.generated.h"
 
 DECLARE_LOG_CATEGORY_EXTERN(TerrainGenerator, Log, All);
 
+DECLARE_DYNAMIC_MULTICAST_DELEGATE(FTerrainCollisionReadySignature);
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_OneParam(FTerrainModifiedSignature, FBox2D, Bounds);
+
 UENUM(BlueprintType)
 enum class Enum_TerrainGeneratorState : uint8
 {
 	InitWorkflow,
+	CreatePreview,
 	CreateVertices,
 	ReMappingZ,
 
 	SetBlockLevel,
-	SetBlockLevelEx,
 
 	CreateRiver,
-	AddRiverEndPoints,
-	DivideUpperRiver,
-	DivideLowerRiver,
-	ChunkToOnePoint,
+	DivideRiverEndPoints,
+	CreateFlowRiverLines,
 	CreateRiverLine,
 	FindRiverLines,
 	DigRiverLine,
@@ -38,9 +44,10 @@ enum class Enum_TerrainGeneratorState : uint8
 	CreateVertexColorsForAMTB,
 
 	CreateTriangles,
-	CalNormalsInit,
-	CalNormalsAcc,
-	NormalizeNormals,
+	CalNormals,
+
+	FindLakes,
+	SaveTerrainCache,
 
 	DrawLandMesh,
 
@@ -53,6 +60,39 @@ enum class Enum_TerrainGeneratorState : uint8
 	Error
 };
 
+UENUM(BlueprintType)
+enum class Enum_TerrainRiverMode : uint8
+{
+	//A* lines between paired high and low chunk points
+	EndPointPairs,
+	//Downhill networks from flow accumulation
+	FlowAccumulation
+};
+
+UENUM(BlueprintType)
+enum class Enum_TerrainBrushMode : uint8
+{
+	Raise,
+	Lower,
+	//Toward the height under the brush center
+	Flatten
+};
+
+//Groups of workflow states cached together, each keyed by the properties it reads
+UENUM(BlueprintType)
+enum class Enum_TerrainStage : uint8
+{
+	Height,
+	River,
+	VertexColors,
+	Triangles,
+	Normals,
+	Lakes,
+
+	//Properties no data stage reads
+	None
+};
+
 UENUM(BlueprintType)
 enum class Enum_TerrainType : uint8
 {
@@ -89,7 +129,8 @@ private:
 
 	class UGridDataGameInstance* pGI;
 
-	Enum_TerrainGeneratorState WorkflowState = Enum_TerrainGeneratorState::InitWorkflow;
+	//Written by the background workflow while game thread code polls IsWorkFlowStepDone
+	std::atomic<Enum_TerrainGeneratorState> WorkflowState = Enum_TerrainGeneratorState::InitWorkflow;
 
 	float TileSizeMultiplier = 0.f;
 	float TileAltitudeMultiplier = 0.f;
@@ -102,15 +143,14 @@ private:
 	float ProgressPassed = 0.f;
 	float Progress = 0.f;
 
-	TArray<FVector> NormalsAcc = {};
-
 	TArray<FStructTerrainMeshPointData> TerrainMeshPointsData = {};
+	//Grid data index of each mesh point while vertices are created, empty for the spiral order
+	TArray<int32> MeshPointOrder = {};
 	TMap<FIntPoint, int32> TerrainMeshPointsIndices = {};
 
 	TMap<FIntPoint, int32> WaterMeshPointsIndices = {};
 
 	int32 BlockLevelMax = 0;
-	TArray<FStructLoopData> BlockLevelExLoopDatas = {};
 
 	float ZRatioMax = 0.0;
 	float ZRatioMin = 0.0;
@@ -118,33 +158,59 @@ private:
 	int32 ZRatioLandPointCount = 0;
 	FStructHeightMapping ZRatioMapping = {};
 
-	TSet<int32> UpperRiverIndices = {};
-	TSet<int32> LowerRiverIndices = {};
-
-	TStructBFSData<int32> UpperRiverDivideData = {};
-	TStructBFSData<int32> LowerRiverDivideData = {};
-
-	TArray<TSet<int32>> UpperRiverChunks = {};
-	TArray<TSet<int32>> LowerRiverChunks = {};
-	
 	TArray<int32> UpperRiverEndPoints = {};
 	TArray<int32> LowerRiverEndPoints = {};
 
 	TArray<FStructRiverLinePointData> RiverLinePointDatas = {};
 
-	TStructAStarData<int32> FindRiverLineData = {};
+	TArray<float> FlowFilledZRatios = {};
+	TArray<int32> FlowOrder = {};
+	TArray<int32> FlowDownstream = {};
+	TArray<int32> FlowAccumulation = {};
 
 	float RiverNoiseSampleRotSin = 0.0;
 	float RiverNoiseSampleRotCos = 0.0;
 
-	TSet<int32> RiverLinePointBlockTestSet = {};
-	float CurrentLineDepthRatio = 0.0;
-	int32 CurrentLinePointIndex = 0;
-	float UnitLineRisingStep = 0.0;
+	TArray<FStructRiverCarveSource> RiverCarveSources = {};
+	TMap<int32, int32> RiverCarveSourceIndices = {};
 
 	TArray<FStructWaterfallRenderData> WaterfallRenderDatas = {};
 	float CurrentWaterfallRadius = 0.0;
 
+	TArray<FStructLakeData> LakeDatas = {};
+
+	TArray<FStructTerrainChunkData> LandChunkDatas = {};
+	TMap<FIntPoint, int32> LandChunkIndices = {};
+
+	TerrainLODSelector LandLODSelector;
+	TMap<FIntPoint, int32> SelectedLandLODs = {};
+	FTimerDynamicDelegate LandLODDelegate;
+	FTimerHandle LandLODTimerHandle;
+
+	FTimerDynamicDelegate CollisionDelegate;
+	FTimerHandle CollisionTimerHandle;
+	bool CollisionReady = false;
+
+	TerrainHeightfield Heightfield;
+
+	//Euclidean distance per mesh point, TNumericLimits<float>::Max() when there is no such water
+	TArray<float> RiverDistances = {};
+	TArray<float> LakeDistances = {};
+	TArray<float> CoastDistances = {};
+
+	FString TerrainCacheKey = FString();
+
+	TArray<FString> StageCacheKeys = {};
+	Enum_TerrainGeneratorState StageCacheState = Enum_TerrainGeneratorState::InitWorkflow;
+	Enum_TerrainStage RunningStage = Enum_TerrainStage::None;
+
+	int32 PreviewPassIndex = 0;
+
+	TFuture<void> BackgroundWorkflow;
+	bool IsRunningInBackground = false;
+	bool IsHeadless = false;
+	FThreadSafeBool StopBackgroundWorkflow = false;
+
 protected:
 	UPROPERTY(VisibleDefaultsOnly, BlueprintReadOnly)
 	class UProceduralMeshComponent* TerrainMesh;
@@ -161,11 +227,43 @@ protected:
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Timer")
 	float DefaultTimerRate = 0.01f;
 
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Timer")
+	float WaitCollisionTimerRate = 0.1f;
+
+	//Run the data stages on a worker thread, only the mesh commit stays on the game thread
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Timer")
+	bool UseBackgroundWorkflow = true;
+
+	//Reuse generated terrain from Saved/TerrainCache while all inputs stay the same
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Cache")
+	bool UseTerrainCache = true;
+	//Editor only, keep each stage output for the session and rerun only the stages whose inputs changed
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Cache")
+	bool UseStageCache = true;
+
+	//Show coarse terrain from every k-th vertex before the full resolution mesh is ready
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Preview")
+	bool UseProgressivePreview = true;
+	//Vertex step of each preview pass, coarse to fine, steps below 2 are skipped
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Preview")
+	TArray<int32> PreviewSteps = { 16, 4 };
+
+	//Free build-only arrays and mesh data copies once the terrain is done, runtime queries keep working
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Memory")
+	bool TrimAfterGeneration = true;
+	//Keep the land vertex streams through the trim so ModifyTerrain can rebuild chunks
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Memory")
+	bool AllowTerraform = false;
+
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Noise")
 	class ATerrainNoise* Noise;
 
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Tile", meta = (ClampMin = "0"))
 	int32 GridRange = 249;
+	//Store mesh points in Z-order instead of the grid's spiral order, neighbors end up close in memory.
+	//GridDataIndex maps each point back to the spiral, TerrainMeshPointsIndices maps coords to points.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Tile")
+	bool UseMortonPointOrder = false;
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Tile", meta = (ClampMin = "0.0"))
 	float TileAltitudeMax = 20000.0f;
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Tile", meta = (ClampMin = "0.0"))
@@ -176,34 +274,10 @@ protected:
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Loop")
 	FStructLoopData ReMappingZLoopData;
 
-	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Loop")
-	FStructLoopData SetBlockLevelLoopData;
-	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Loop")
-	FStructLoopData SetBlockLevelExLoopData;
-
-	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Loop")
-	FStructLoopData AddRiverEndPointsLoopData;
-	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Loop")
-	FStructLoopData UpperRiverDivideLoopData;
-	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Loop")
-	FStructLoopData LowerRiverDivideLoopData;
-	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Loop")
-	FStructLoopData FindRiverLinesLoopData;
-	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Loop")
-	FStructLoopData DigRiverLineLoopData;
-	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Loop")
-	FStructLoopData DigRiverPoolLoopData;
-
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Loop")
 	FStructLoopData CreateVertexColorsForAMTBLoopData;
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Loop")
 	FStructLoopData CreateTrianglesLoopData;
-	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Loop")
-	FStructLoopData CalNormalsInitLoopData;
-	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Loop")
-	FStructLoopData CalNormalsAccLoopData;
-	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Loop")
-	FStructLoopData NormalizeNormalsLoopData;
 
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Terrain", meta = (ClampMin = "0.0"))
 	float MoistureSampleScale = 0.5;
@@ -221,6 +295,11 @@ protected:
 	int32 BlockExTimes = 0;
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Terrain")
 	float WaterLandCombineRatio = 0.3;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Terrain")
+	bool UseAnalyticNormals = true;
+	//Smallest noise wavelength in tiles that GetTerrainType still evaluates, 0 keeps every octave
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Terrain", meta = (ClampMin = "0.0"))
+	float TerrainTypeDetailWavelength = 0.0;
 	
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Terrain|Land", meta = (ClampMin = "0.0", ClampMax = "1.0"))
 	float LandLayer0Level = 0.5;
@@ -267,8 +346,17 @@ protected:
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Terrain|Water", meta = (ClampMin = "1.0"))
 	float WaterBankSharpness = 50.0;
 
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Terrain|Lake")
+	bool HasLake = false;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Terrain|Lake", meta = (ClampMin = "1"))
+	int32 LakeMinPointNum = 50;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Terrain|Lake", meta = (ClampMin = "0.0", ClampMax = "1.0"))
+	float LakeMinDepthRatio = 0.005;
+
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Terrain|River")
 	bool HasRiver = false;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Terrain|River")
+	Enum_TerrainRiverMode RiverMode = Enum_TerrainRiverMode::EndPointPairs;
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Terrain|River", meta = (ClampMin = "0"))
 	int32 MaxRiverNum = 1;
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Terrain|River", meta = (ClampMin = "0.0", ClampMax = "1.0"))
@@ -277,6 +365,9 @@ protected:
 	float LowerRiverLimitZRatio = -0.1;
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Terrain|River", meta = (ClampMin = "0"))
 	int32 MinRiverLength = 100;
+	//Min distance between the upper points and between the lower points of two rivers, 0 means no limit
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Terrain|River", meta = (ClampMin = "0"))
+	int32 MinRiverSpacing = 0;
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Terrain|River", meta = (ClampMin = "0.0"))
 	float RiverDirectionSampleScale = 1.0;
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Terrain|River")
@@ -301,6 +392,16 @@ protected:
 	float RiverDepthRisingStep = 0.003;
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Terrain|River", meta = (ClampMin = "0.0"))
 	float RiverDepthSampleScale = 1.0;
+	//Cross section from bank (0) to center (1), default is a quintic ease in-out
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Terrain|River")
+	class UCurveFloat* RiverProfileCurve = nullptr;
+
+	//Points draining through a point before it becomes a river, FlowAccumulation mode only
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Terrain|River|Flow", meta = (ClampMin = "1"))
+	int32 RiverFlowAccumulationThreshold = 2000;
+	//Height ratio added per step when filling depressions, keeps filled flats draining
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Terrain|River|Flow", meta = (ClampMin = "0.0"))
+	float RiverFlowFillEpsilon = 0.00001;
 	
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Terrain|River|Pool")
 	bool HasRiverPool = false;
@@ -360,8 +461,35 @@ protected:
 	UMaterialInstance* WaterMaterialIns;
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Material")
 	UMaterialInstance* CausticsMaterialIns;
+
+	//Land mesh split into components of LandChunkSize tiles for per chunk culling and updates, 0 draws one section
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|LandMesh", meta = (ClampMin = "0"))
+	int32 LandChunkSize = 64;
+	//LOD levels per chunk, each one halves the point density, limited by the powers of 2 in LandChunkSize
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|LandMesh", meta = (ClampMin = "1"))
+	int32 LandLODNum = 4;
+	//View distance where LOD 1 starts, doubled for every next LOD
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|LandMesh", meta = (ClampMin = "1.0"))
+	float LandLODRange = 5000.0;
+	//Walls hung under the chunk outlines to hide cracks between LODs, 0 turns them off
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|LandMesh", meta = (ClampMin = "0.0"))
+	float LandSkirtDepth = 200.0;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|LandMesh", meta = (ClampMin = "0.01"))
+	float LandLODTimerRate = 0.1;
+	//Reorder land triangles for the GPU vertex cache, chunk vertices follow in order of first use
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|LandMesh")
+	bool OptimizeLandIndexOrder = true;
+	//Cook land and water collision on a worker thread, OnCollisionReady fires when it is in the physics scene
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|LandMesh")
+	bool UseAsyncCollisionCooking = true;
+	//Chunk LOD whose section carries the collision, each step cooks a quarter of the triangles
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|LandMesh", meta = (ClampMin = "0"))
+	int32 LandCollisionLOD = 0;
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Material")
 	UMaterialInstance* WaterfallMaterialIns;
+	//Falls back to WaterMaterialIns
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Material")
+	UMaterialInstance* LakeMaterialIns = nullptr;
 
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Progress", meta = (ClampMin = "0", ClampMax = "1.0"))
 	float ProgressWeight_CreateVertices = 0.05f;
@@ -369,12 +497,10 @@ protected:
 	float ProgressWeight_ReMappingZ = 0.04f;
 	
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Progress", meta = (ClampMin = "0", ClampMax = "1.0"))
-	float ProgressWeight_SetBlockLevel = 0.05f;
-	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Progress", meta = (ClampMin = "0", ClampMax = "1.0"))
-	float ProgressWeight_SetBlockLevelEx = 0.05f;
+	float ProgressWeight_SetBlockLevel = 0.1f;
 	
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Progress", meta = (ClampMin = "0", ClampMax = "1.0"))
-	float ProgressWeight_AddRiverEndPoints = 0.03f;
+	float ProgressWeight_DivideRiverEndPoints = 0.03f;
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Progress", meta = (ClampMin = "0", ClampMax = "1.0"))
 	float ProgressWeight_FindRiverLines = 0.05f;
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Progress", meta = (ClampMin = "0", ClampMax = "1.0"))
@@ -387,37 +513,19 @@ protected:
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Progress", meta = (ClampMin = "0", ClampMax = "1.0"))
 	float ProgressWeight_CreateTriangles = 0.05f;
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Progress", meta = (ClampMin = "0", ClampMax = "1.0"))
-	float ProgressWeight_CalNormalsInit = 0.02f;
-	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Progress", meta = (ClampMin = "0", ClampMax = "1.0"))
-	float ProgressWeight_CalNormalsAcc = 0.04f;
-	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Custom|Progress", meta = (ClampMin = "0", ClampMax = "1.0"))
-	float ProgressWeight_NormalizeNormals = 0.02f;
+	float ProgressWeight_CalNormals = 0.08f;
 
-	UPROPERTY(VisibleDefaultsOnly, BlueprintReadOnly, Category = "Custom|Render|Land")
-	TArray<FVector> Vertices;
-	UPROPERTY(VisibleDefaultsOnly, BlueprintReadOnly, Category = "Custom|Render|Land")
-	TArray<FVector2D> UVs;
+	//Compact land streams, one entry per mesh point. Normals live in the point data, UV0 comes from the
+	//axial coord and the tangent from the normal, GetLandVertex expands them when a section is written
+	UPROPERTY(VisibleDefaultsOnly, Category = "Custom|Render|Land")
+	TArray<FVector3f> Vertices;
 	UPROPERTY(VisibleDefaultsOnly, BlueprintReadOnly, Category = "Custom|Render|Land")
 	TArray<int32> Triangles;
 	UPROPERTY(VisibleDefaultsOnly, BlueprintReadOnly, Category = "Custom|Render|Land")
-	TArray<FVector> Normals;
-	UPROPERTY(VisibleDefaultsOnly, BlueprintReadOnly, Category = "Custom|Render|Land")
-	TArray<FLinearColor> VertexColors;
-	UPROPERTY(VisibleDefaultsOnly, BlueprintReadOnly, Category = "Custom|Render|Land")
-	TArray<FVector2D> UV1;
-	UPROPERTY(VisibleDefaultsOnly, BlueprintReadOnly, Category = "Custom|Render|Land")
-	TArray<FVector2D> UV2;
-	UPROPERTY(VisibleDefaultsOnly, BlueprintReadOnly, Category = "Custom|Render|Land")
-	TArray<FVector2D> UV3;
+	TArray<FColor> VertexColors;
 
-	UPROPERTY(VisibleDefaultsOnly, BlueprintReadOnly, Category = "Custom|Render|Water")
-	TArray<FVector> WaterVertices;
-	UPROPERTY(VisibleDefaultsOnly, BlueprintReadOnly, Category = "Custom|Render|Water")
-	TArray<FVector2D> WaterUVs;
 	UPROPERTY(VisibleDefaultsOnly, BlueprintReadOnly, Category = "Custom|Render|Water")
 	TArray<int32> WaterTriangles;
-	UPROPERTY(VisibleDefaultsOnly, BlueprintReadOnly, Category = "Custom|Render|Water")
-	TArray<FVector> WaterNormals;
 
 public:	
 	// Sets default values for this actor's properties
@@ -464,6 +572,7 @@ public:
 protected:
 	// Called when the game starts or when spawned
 	virtual void BeginPlay() override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
 
 private:
 	//Timer delegate
@@ -473,48 +582,84 @@ private:
 	void DoWorkFlow();
 
 	void InitWorkflow();
+	void SetWorkflowTimer(float Rate);
+	void StartBackgroundWorkflow();
+	void RunBackgroundWorkflow();
+	void CommitBackgroundWorkflow();
 	bool GetGameInstance();
 	bool InitNoise();
 	bool CheckMaterialSetting();
 	void InitTileParameter();
 	void InitLoopData();
-	void InitBlockLevelExLoopDatas();
 	void InitReceiveDecal();
 	void InitLandBlendParam();
 	void InitWater();
 	void SetWaterZ();
 	void InitProgress();
 
+	//Derived data cache
+	void InitTerrainCacheKey();
+	bool LoadTerrainCache();
+	void SaveTerrainCache();
+	void InitTerrainMeshPointsIndices();
+
+	//Session stage cache
+	void InitStageCacheKeys();
+	static Enum_TerrainStage GetPropertyStage(const FProperty* Property);
+	static Enum_TerrainStage GetUpstreamStage(Enum_TerrainStage Stage);
+	bool IsStageCacheEnabled();
+	bool GetStageByStartState(Enum_TerrainGeneratorState State, Enum_TerrainStage& OutStage);
+	Enum_TerrainGeneratorState GetStageEndState(Enum_TerrainStage Stage);
+	float GetStageProgressWeight(Enum_TerrainStage Stage);
+	FString GetStageCacheName(Enum_TerrainStage Stage);
+	void UpdateStageCache();
+	void SaveStageCache(Enum_TerrainStage Stage);
+	bool LoadStageCache(Enum_TerrainStage Stage);
+
+	//Progressive preview
+	void CreatePreview();
+	void CreatePreviewData(int32 Step, FStructTerrainPreviewData& OutData);
+	void CommitPreviewData(FStructTerrainPreviewData&& Data);
+	void CreatePreviewMesh(const FStructTerrainPreviewData& Data);
+
 	//Create vertices
 	void CreateVertices();
+	void InitMeshPointOrder();
 	bool CreateVertex(int32 X, int32 Y, float& OutRatioStd, float& OutRatio);
 	void AddVertex(FStructTerrainMeshPointData& Data, float& OutRatioStd, float& OutRatio);
 	void GetZRatioInfo(const FStructTerrainMeshPointData& Data);
 
 	float GetAltitude(float X, float Y, float& OutRatioStd, float& OutRatio);
-	float GetGradientRatioZ(class UFastNoiseWrapper* NWP, float X, float Y, 
-		TFunction<float(float X, float Y)> GetRatioFunc,
-		float BaseRatio, float k, const FVector2d& BaseSlope, FVector2d& OutSlope);
+	//DetailWavelength in tiles skips finer noise octaves, 0 is full quality
+	float GetAltitude(float X, float Y, float& OutRatioStd, float& OutRatio, FVector2D& OutGradient,
+		float DetailWavelength = 0.0);
+	float GetGradientRatioZ(float X, float Y, 
+		TFunctionRef<float(float X, float Y, FVector2D& OutGradient)> GetRatioFunc,
+		float BaseRatio, float k, const FVector2d& BaseSlope, FVector2d& OutSlope, FVector2D& OutGradient);
 
 	float CombineWaterLandRatio(float wRatio, float lRatio);
-	float GetLandLayer0Ratio(float X, float Y);
-	float GetLandLayer1Ratio(float X, float Y);
-	float GetWaterRatio(float X, float Y);
-	float CalWaterBank(float Ratio);
+	float CombineWaterLandRatio(float wRatio, float lRatio, const FVector2D& wGradient, FVector2D& InOutGradient);
+	float GetLandLayer0Ratio(float X, float Y, FVector2D& OutGradient, float DetailWavelength = 0.0);
+	float GetLandLayer1Ratio(float X, float Y, FVector2D& OutGradient, float DetailWavelength = 0.0);
+	float GetWaterRatio(float X, float Y, FVector2D& OutGradient, float DetailWavelength = 0.0);
+	float CalWaterBank(float Ratio, float& OutDerivative);
 
 	void MappingByLevel(float level, const FStructHeightMapping& InMapping, 
 		FStructHeightMapping& OutMapping);
-	float GetMappingHeightRatio(class UFastNoiseWrapper* NWP, 
-		const FStructHeightMapping& Mapping, float X, float Y, float SampleScale);
+	float GetMappingHeightRatio(const class TerrainGradientNoise& GN, 
+		const FStructHeightMapping& Mapping, float X, float Y, float SampleScale, FVector2D& OutGradient,
+		float DetailWavelength = 0.0);
 	float MappingFromRangeToRange(float InputValue, 
 		const FStructHeightMapping& Mapping);
 	float MappingFromRangeToRange(float InputValue, float RangeMax, float RangeMin, 
 		float MappingMax, float MappingMin);
 
-	void CreateUV(float X, float Y);
 
-	float GetNoise2DStd(UFastNoiseWrapper* NWP, float X, float Y, 
-		float SampleScale = 1.f, float ValueScale = 1.f);
+	float GetNoise2DStd(class UFastNoiseWrapper* NWP, const class TerrainGradientNoise& GN, float X, float Y, 
+		float SampleScale = 1.f, float ValueScale = 1.f, float DetailWavelength = 0.0);
+	//Full quality from the wrapper, budgeted from the gradient noise, X, Y and DetailWavelength in noise input units
+	float GetBudgetedNoise2D(class UFastNoiseWrapper* NWP, const class TerrainGradientNoise& GN, float X, float Y,
+		float DetailWavelength);
 
 	//Set block level
 	bool TerrainMeshPointsLoopFunction(TFunction<void()> InitFunc, 
@@ -525,55 +670,53 @@ private:
 
 	void ReMappingZ();
 	void InitReMappingZ();
+	void InitZRatioMapping(float InZRatioMax, FStructHeightMapping& OutMapping);
 	void ReMappingPointZ(int32 Index);
+	void ReMappingPointZ(FStructTerrainMeshPointData& Data, const FStructHeightMapping& Mapping);
 
 	void SetBlockLevel();
-	void InitSetBlockLevel();
-	bool SetBlock(FStructTerrainMeshPointData& OutData, 
-		const FStructTerrainMeshPointData& InData,
-		int32 BlockLevel);
-	void SetBlockLevelByNeighbors(int32 Index);
-	bool SetBlockLevelByNeighbor(FStructTerrainMeshPointData& Data, int32 Index);
-
-	void SetBlockLevelEx();
-	void InitSetBlockLevelEx();
-	void SetBlockLevelExByNeighbors(int32 Index);
+	bool IsBlock(const FStructTerrainMeshPointData& Data);
 
 	//Create River
 	void CreateRiver();
 
-	void AddRiverEndPoints();
-	void AddRiverEndPoint(int32 Index);
-
 	void DivideRiverEndPointsIntoChunks();
-	void DivideUpperRiverEndPointsIntoChunks();
-	void DivideLowerRiverEndPointsIntoChunks();
+	void CreateFlowRiverLines();
+	void CalTerrainFlow();
+	void ExtractFlowRiverLines();
+	bool TraceFlowRiverLine(int32 HeadIndex, const TArray<bool>& Claimed, TArray<int32>& OutLine);
+	bool NextPointD8(const int32& Current, int32& Next, int32& Index);
+	float GetD8Distance(int32 Current, int32 Next);
+	bool IsTerrainEdgePoint(int32 Index);
+	void ChunkToEndPoints(TFunctionRef<bool(int32)> InChunk, TArray<int32>& EndPoints);
 	bool NextPoint(const int32& Current, int32& Next, int32& Index);
-	void AddUpperRiverEndPointsChunk();
-	void AddLowerRiverEndPointsChunk();
-
-	void RiverChunkToOnePoint();
-	void ChunkToOnePoint(TArray<TSet<int32>>& Chunk, TArray<int32>& EndPoints);
 
 	void CreateRiverLine();
 	void CreateRiverLinePointDatas();
 
 	void FindRiverLines();
+	FVector2D GetRiverNoiseSampleRot(int32 Total, int32 Index);
 	void CalRiverNoiseSampleRotValue(int32 Total, int32 Index);
 	FVector2D GetRiverRotatedAxialCoord(FIntPoint AxialCoord);
-	float RiverDirectionCost(const int32& Current, const int32& Next);
+	FVector2D GetRiverRotatedAxialCoord(FIntPoint AxialCoord, const FVector2D& SampleRot);
+	float RiverDirectionCost(const int32& Next, const FVector2D& SampleRot);
 	float RiverDirectionNoiseCost(float X, float Y);
 	float RiverDirectionAltitudeCost(int32 Index);
 	float RiverDirectionHeuristic(const int32& Goal, const int32& Next);
 	void DigRiverLine();
-	int32 GetTotalRiverLinePointNum();
-	float FindRiverBlockZByNeighbor(int32 Index);
+	void SetRiverBlockZRatio();
+	void AddRiverLineCarveSources(const FStructRiverLinePointData& LinePointData);
+	void AddRiverPoolCarveSources(const FStructRiverLinePointData& LinePointData);
+	void AddRiverCarveSource(int32 PointIndex, float DepthRatio, float RisingStep);
+	float GetNextLineDepthRatio(float DepthRatio, int32 PointIndex, 
+		float DepthRatioMin, float DepthRatioMax);
+	void CalRiverCarveField(TFunctionRef<bool(int32 Index)> CanCarve,
+		TArray<int32>& OutDistances, TArray<int32>& OutBestSources);
+	float GetRiverProfileRatio(int32 Distance, float Radius);
 	void UpdateRiverPointZ(int32 Index, float ZRatio);
-	bool DigRiverNextPoint(const int32& Current, int32& Next, int32& Index, TSet<int32>& Reached);
 
 	void DigRiverPool();
 	void UpdateRiverPoolZ(int32 Index, float ZRatio);
-	bool DigRiverPoolNextPoint(const int32& Current, int32& Next, int32& Index, TSet<int32>& Reached);
 
 	void CombinePoolToTerrain();
 
@@ -585,25 +728,22 @@ private:
 	void CreateVertexColorsForAMTB();
 	void InitCreateVertexColorsForAMTB();
 	void AddAMTBToVertexColor(int32 Index);
+	FColor GetAMTBVertexColor(int32 Index);
 	float CalMoisture(int32 X, int32 Y);
-	float CalTemperature(int32 X, int32 Y);
+	float CalMoisture(int32 X, int32 Y, float ZRatio, float DetailWavelength = 0.0);
+	float CalTemperature(int32 X, int32 Y, float DetailWavelength = 0.0);
 
 	//Create Triangles
 	void CreateTriangles();
-	void FindTopRightSquareVertices(int32 Index, TArray<int32>& SqVArr, 
+	void FindTopRightSquareVertices(int32 Index, int32 GridDataIndex, TArray<int32>& SqVArr, 
 		const TMap<FIntPoint, int32>& Indices, int32 RangeLimit);
 	void CreatePairTriangles(TArray<int32>& SqVArr, TArray<int32>& TrianglesArr);
 
 	//Create Normals
-	void CreateNormals();
-	void CalNormalsWorkflow();
-	void CalNormalsInit();
-	void CalNormalsAcc();
-	void CalTriangleNormalForVertex(int32 TriangleIndex);
-	void NormalizeNormals();
-	void AddNormal(int32 Index);
+	void CalNormals();
+	void CalNormalAndTangent(int32 Index);
+	bool GetMeshPointZ(const FIntPoint& AxialCoord, float& OutZ) const;
 	float AngleBetweenVectors(const FVector& A, const FVector& B);
-	void CalAngleToUp(int32 Index);
 
 	void CreateWaterfall();
 	void CreateWaterfallAnim();
@@ -627,29 +767,126 @@ private:
 	//Create water face
 	void CreateWater();
 	void CreateWaterPlane();
-	void CreateWaterVerticesAndUVs();
+	void CreateWaterPoints();
 	void CreateWaterTriangles();
-	void CreateWaterNormals();
 	void CreateWaterMesh();
 	void SetWaterMaterial();
+	void CreateLakePlanes();
+	void CreateLakeVerticesAndTriangles(FStructLakeData& Data);
+	void CreateLakeMesh(int32 Index);
 	void CreateCaustics();
 
+	//Lakes
+	void FindLakes();
+	void AddLakes(const TArray<float>& Filled);
+	void FindLakeShore(FStructLakeData& Data, int32 LakeIndex);
+
+	//Heightfield queries
+	void BuildHeightfield();
+	void BuildWaterDistances();
+	void CreateWaterDistanceField(TFunctionRef<bool(int32 Index)> IsSeed, TArray<float>& OutDistances);
+
 	//Create material
 	void CreateTerrainMesh();
 	void SetTerrainMaterial();
 
+	//Land chunks
+	void CreateLandChunks();
+	void BuildLandChunkLOD(FStructTerrainChunkLODData& LODData);
+	void CreateLandChunkMesh(FStructTerrainChunkData& Data);
+	void UpdateLandChunkMeshes(FStructTerrainChunkData& Data);
+	void UpdateLandChunkMesh(FStructTerrainChunkData& Data, int32 LOD);
+	int32 GetLandCollisionLOD(const FStructTerrainChunkData& Data);
+	FProcMeshVertex GetLandVertex(int32 Index);
+	FIntPoint GetLandChunkCoord(const FIntPoint& AxialCoord);
+
+	UFUNCTION()
+	void UpdateLandLOD();
+
+	//Collision
+	void WaitCollision();
+	UFUNCTION()
+	void UpdateCollisionReady();
+	bool IsMeshCollisionReady(UProceduralMeshComponent* Mesh);
+
+	//Terraform
+	bool CanTerraform();
+	bool GetPointIndexAt(const FVector2D& Point, int32& OutIndex);
+	FVector2D GetPointWorldPosition2D(int32 Index);
+	void GetBrushPoints(const FBox2D& Bounds, TArray<int32>& OutPoints);
+	float GetBrushWeight(float Distance, float Radius);
+	bool SetPointZRatio(int32 Index, float ZRatio);
+	void ApplyTerraform(const TArray<int32>& PointIndices, const FBox2D& Bounds);
+	void UpdateBlockLevels(const TArray<int32>& PointIndices);
+	bool IsCoastPoint(const FStructTerrainMeshPointData& Data);
+	void GetPointsInRange(const TArray<int32>& Seeds, int32 Range, TArray<int32>& OutPoints,
+		TArray<int32>& OutDistances, TMap<int32, int32>& OutLocalIndices);
+
 	void DoWorkflowDone();
+	void TrimGenerationData();
+	void LogMemoryFootprint(const TCHAR* Label);
 
 public:	
 	// Called every frame
 	virtual void Tick(float DeltaTime) override;
 
 public:
+	//Terrain and water queries run on CPU data, safe from any thread once DrawLandMesh is done
+	FORCEINLINE const TerrainHeightfield& GetHeightfield() const
+	{
+		return Heightfield;
+	}
+
+	//Rebuilds only the chunks holding these points, Vertices and VertexColors must not be trimmed (see AllowTerraform)
+	void UpdateLandChunks(const TArray<int32>& PointIndices);
+
+	//Fired once land and water collision can be hit, physics queries before that miss the terrain
+	UPROPERTY(BlueprintAssignable)
+	FTerrainCollisionReadySignature OnCollisionReady;
+
+	UFUNCTION(BlueprintCallable)
+	FORCEINLINE bool IsCollisionReady()
+	{
+		return CollisionReady;
+	}
+
+	//Brush edits once generation is done, Center in world space like GetTerrainPointBy2DPos, Radius and Strength in world units.
+	//Only the touched points, their chunks and the grid tiles listening to OnTerrainModified are updated.
+	UFUNCTION(BlueprintCallable)
+	bool ModifyTerrain(Enum_TerrainBrushMode Mode, FVector2D Center, float Radius, float Strength);
+	//Cuts a bed Depth below the straight line between the heights at Start and End
+	UFUNCTION(BlueprintCallable)
+	bool DigTerrainChannel(FVector2D Start, FVector2D End, float Radius, float Depth);
+
+	UPROPERTY(BlueprintAssignable)
+	FTerrainModifiedSignature OnTerrainModified;
+
+	//Triangles of the land LODs drawn right now
+	UFUNCTION(BlueprintCallable)
+	int32 GetLandTriangleNum();
+
+	//Everything drawn once generation is done, for baking. Land chunks give their full detail section only
+	void GetBakeSources(TArray<UProceduralMeshComponent*>& OutMeshes, TArray<int32>& OutSectionNums,
+		TArray<AActor*>& OutEffects);
+
+	//Distance to the nearest river line, lake and sea point
+	UFUNCTION(BlueprintCallable)
+	bool GetPointWaterDistances(int32 Index, float& OutRiver, float& OutLake, float& OutCoast);
+	UFUNCTION(BlueprintCallable)
+	bool GetWaterDistancesAt(FVector2D Point, float& OutRiver, float& OutLake, float& OutCoast);
+
 	bool GetMeshPointByLineTrance(UProceduralMeshComponent* Mesh, FVector Start, FVector End, FVector& Loc);
 	bool GetTerrainPointByLineTrace(FVector Start, FVector End, FVector& Loc);
 	bool GetTerrainPointBy2DPos(FVector2D Start2D, FVector2D End2D, FVector& Loc);
 	bool GetWaterPointByLineTrance(FVector Start, FVector End, FVector& Loc);
 
+public:
+	//Batch seed sweep: own noise copy with shifted seeds, no rendering and no caches. Call before BeginPlay.
+	void SetupSweep(class ATerrainNoise* InNoise, int32 SeedOffset);
+	void GetSweepMetrics(float& OutLandRatio, int32& OutRiverNum, float& OutRiverLength,
+		int32& OutBlockLevelMax, float& OutBlockLevelMean);
+	void GetHeightThumbnail(int32 Size, TArray<FColor>& OutPixels);
+
 public:
 	Enum_TerrainType GetTerrainType(FVector2D Point, float& OutMoisture, float& OutTemperature);
 private:
@@ -660,7 +897,7 @@ public:
 	bool HasTreeAt(const FVector2D& Point);
 	float GetTreeDensity(Enum_TerrainType TT);
 private:
-	float CalTree(int32 X, int32 Y);
+	float CalTree(int32 X, int32 Y, float DetailWavelength = 0.0);
 
 public:
 	UFUNCTION(BlueprintCallable)
@@ -0,0 +1,82 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * CPU copy of the terrain heights on the axis aligned quad lattice.
+ * Each cell is split along its (0, 0)-(1, 1) diagonal, the same triangles as the terrain mesh.
+ * Queries are const and lock free, safe to call from any thread once built.
+ */
+class M_LOAW_TERRAIN_API TerrainHeightfield
+{
+private:
+	TArray<float> Heights = {};
+	TBitArray<> Valid = {};
+	FIntPoint CoordMin = FIntPoint::ZeroValue;
+	int32 SizeX = 0;
+	int32 SizeY = 0;
+	float CellSize = 1.0;
+	FVector Origin = FVector::ZeroVector;
+
+public:
+	TerrainHeightfield();
+	~TerrainHeightfield();
+
+	//Origin is the world location of axial coord (0, 0) at height 0
+	void Init(const FIntPoint& InCoordMin, const FIntPoint& InCoordMax, float InCellSize, const FVector& InOrigin);
+	void SetHeight(const FIntPoint& Coord, float Z);
+	void Reset();
+
+	FORCEINLINE bool IsBuilt() const
+	{
+		return SizeX > 1 && SizeY > 1;
+	}
+
+	FORCEINLINE SIZE_T GetAllocatedSize() const
+	{
+		return Heights.GetAllocatedSize() + Valid.GetAllocatedSize();
+	}
+
+	//Axial coord of the lattice point nearest to the world position Pos, rounded like Quad::PosToQuad
+	FORCEINLINE FIntPoint GetCoord(const FVector2D& Pos) const
+	{
+		return FIntPoint((int32)FMath::RoundHalfFromZero((Pos.X - Origin.X) / CellSize),
+			(int32)FMath::RoundHalfFromZero((Pos.Y - Origin.Y) / CellSize));
+	}
+
+	//World XY of the lattice point at Coord
+	FORCEINLINE FVector2D GetPosition(const FIntPoint& Coord) const
+	{
+		return FVector2D(Coord.X * CellSize + Origin.X, Coord.Y * CellSize + Origin.Y);
+	}
+
+	//World Z of the terrain surface under Pos, O(1)
+	bool SampleHeight(const FVector2D& Pos, float& OutZ) const;
+
+	//First hit of the segment with the terrain surface, world space
+	bool Raycast(const FVector& Start, const FVector& End, FVector& OutLoc) const;
+
+private:
+	FORCEINLINE int32 GetIndex(int32 X, int32 Y) const
+	{
+		return Y * SizeX + X;
+	}
+
+	FORCEINLINE FVector ToGrid(const FVector& Pos) const
+	{
+		return FVector((Pos.X - Origin.X) / CellSize - CoordMin.X, (Pos.Y - Origin.Y) / CellSize - CoordMin.Y, Pos.Z - Origin.Z);
+	}
+
+	FORCEINLINE FVector FromGrid(const FVector& Pos) const
+	{
+		return FVector((Pos.X + CoordMin.X) * CellSize + Origin.X, (Pos.Y + CoordMin.Y) * CellSize + Origin.Y, Pos.Z + Origin.Z);
+	}
+
+	bool SampleGridHeight(float X, float Y, float& OutZ) const;
+	bool IntersectCell(int32 CellX, int32 CellY, const FVector& Start, const FVector& Dir, float& OutT) const;
+	static bool IntersectTriangle(const FVector& Start, const FVector& Dir,
+		const FVector& A, const FVector& B, const FVector& C, float& OutT);
+	static bool ClipAxis(float Start, float Dir, float Min, float Max, float& InOutTMin, float& InOutTMax);
+};
@@ -0,0 +1,40 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * Flow routing over dense point indices: priority-flood depression filling,
+ * steepest descent flow directions and flow accumulation.
+ */
+class M_LOAW_TERRAIN_API TerrainHydrology
+{
+public:
+	TerrainHydrology();
+	~TerrainHydrology();
+
+	//Floods inward from the edge points. Filled heights rise by at least Epsilon per step away from the edge,
+	//so every point has a strictly descending path to an outlet.
+	//OutOrder is the flood order, lowest filled height first.
+	static void PriorityFloodFunction(int32 Num,
+		TFunctionRef<float(int32 Index)> GetHeight,
+		TFunctionRef<bool(int32 Index)> IsEdge,
+		TFunctionRef<bool(const int32& Current, int32& Next, int32& Index)> NextFunc,
+		float Epsilon,
+		TArray<float>& OutFilled,
+		TArray<int32>& OutOrder);
+
+	//Steepest descent on the filled heights, INDEX_NONE for outlets
+	static void FlowDirectionFunction(int32 Num,
+		const TArray<float>& Filled,
+		TFunctionRef<bool(const int32& Current, int32& Next, int32& Index)> NextFunc,
+		TFunctionRef<float(int32 Current, int32 Next)> GetDistance,
+		TArray<int32>& OutDownstream);
+
+	//Number of points draining through each point, itself included.
+	//Order must list every downstream point before its upstream points.
+	static void FlowAccumulationFunction(const TArray<int32>& Order,
+		const TArray<int32>& Downstream,
+		TArray<int32>& OutAccumulation);
+};
@@ -0,0 +1,56 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * Quadtree LOD selection over the land chunks, CDLOD style.
+ * A node of level L covers 2^L x 2^L chunks, it is drawn at LOD L when the view is farther
+ * than the range of LOD L - 1 from its bounds, otherwise its children are tested.
+ * Ranges double per level, with a base range above the chunk size neighbor chunks stay within one LOD.
+ * Pure CPU, no rendering involved.
+ */
+class M_LOAW_TERRAIN_API TerrainLODSelector
+{
+private:
+	struct FNode
+	{
+		FBox Bounds = FBox(ForceInit);
+		int32 Level = 0;
+		//Leaf only
+		FIntPoint ChunkCoord = FIntPoint::ZeroValue;
+		TArray<int32, TInlineAllocator<4>> Children = {};
+	};
+
+	TArray<FNode> Nodes = {};
+	int32 RootIndex = INDEX_NONE;
+	int32 LODNum = 1;
+	double BaseRange = 1.0;
+
+public:
+	TerrainLODSelector();
+	~TerrainLODSelector();
+
+	//Chunk coords must be non negative, BaseRange is where LOD 1 starts
+	void Init(const TMap<FIntPoint, FBox>& ChunkBounds, int32 InLODNum, double InBaseRange);
+	void Reset();
+
+	FORCEINLINE bool IsBuilt() const
+	{
+		return RootIndex != INDEX_NONE;
+	}
+
+	//Distance from the view beyond which LOD + 1 is allowed
+	FORCEINLINE double GetRange(int32 LOD) const
+	{
+		return BaseRange * (double)(1 << LOD);
+	}
+
+	//LOD of every chunk for a view position in the same space as the chunk bounds
+	void Select(const FVector& ViewPos, TMap<FIntPoint, int32>& OutLODs) const;
+
+private:
+	void SelectNode(int32 NodeIndex, const FVector& ViewPos, TMap<FIntPoint, int32>& OutLODs) const;
+	void AssignNode(int32 NodeIndex, int32 LOD, TMap<FIntPoint, int32>& OutLODs) const;
+};
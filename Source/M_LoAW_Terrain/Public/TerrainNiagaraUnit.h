@@ -21,6 +21,9 @@ public:
 
 	void SetActive(bool flag);
 
+	//Takes over the niagara asset and user parameters of Source, the copy plays on load if Source is playing
+	virtual void CopyEffectFrom(ATerrainNiagaraUnit* Source);
+
 protected:
 	// Called when the game starts or when spawned
 	virtual void BeginPlay() override;
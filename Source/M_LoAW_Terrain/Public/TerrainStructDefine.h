@@ -1,5 +1,6 @@
 #pragma once
 
+#include "ProceduralMeshComponent.h"
 #include "TerrainStructDefine.generated.h"
 
 USTRUCT(BlueprintType)
@@ -56,6 +57,17 @@ struct FStructTerrainMeshPointData
 	UPROPERTY(BlueprintReadOnly)
 	FVector Normal = FVector();
 
+	//d(PositionZRatio) per axial unit from the noise derivative
+	UPROPERTY(BlueprintReadOnly)
+	FVector2D ZRatioGradient = FVector2D();
+
+	//False once river or pool carving has changed the height
+	UPROPERTY(BlueprintReadOnly)
+	bool HasAnalyticGradient = false;
+
+	UPROPERTY(BlueprintReadOnly)
+	int32 LakeIndex = INDEX_NONE;
+
 };
 
 USTRUCT(BlueprintType)
@@ -105,6 +117,59 @@ struct FStructRiverLinePointData
 
 };
 
+USTRUCT(BlueprintType)
+struct FStructRiverCarveSource
+{
+	GENERATED_BODY()
+
+	UPROPERTY(BlueprintReadOnly)
+	int32 PointIndex = 0;
+
+	UPROPERTY(BlueprintReadOnly)
+	float DepthRatio = 0.0;
+
+	//Carve radius in grid steps
+	UPROPERTY(BlueprintReadOnly)
+	float Radius = 0.0;
+
+};
+
+USTRUCT(BlueprintType)
+struct FStructLakeData
+{
+	GENERATED_BODY()
+
+	//Spill height of the basin
+	UPROPERTY(BlueprintReadOnly)
+	float WaterZRatio = 0.0;
+
+	UPROPERTY(BlueprintReadOnly)
+	float WaterZ = 0.0;
+
+	UPROPERTY(BlueprintReadOnly)
+	float MaxDepthRatio = 0.0;
+
+	UPROPERTY(BlueprintReadOnly)
+	TArray<int32> PointIndices = {};
+
+	//Lake points next to dry land, the outline of the lake polygon
+	UPROPERTY(BlueprintReadOnly)
+	TArray<int32> ShorePointIndices = {};
+
+	UPROPERTY(BlueprintReadOnly)
+	TArray<FVector> LakeVertices = {};
+
+	UPROPERTY(BlueprintReadOnly)
+	TArray<FVector2D> LakeUVs = {};
+
+	UPROPERTY(BlueprintReadOnly)
+	TArray<int32> LakeTriangles = {};
+
+	UPROPERTY(BlueprintReadOnly)
+	TArray<FVector> LakeNormals = {};
+
+};
+
 USTRUCT(BlueprintType)
 struct FStructWaterfallRenderData
 {
@@ -124,4 +189,114 @@ struct FStructWaterfallRenderData
 
 	UPROPERTY(BlueprintReadOnly)
 	TArray<FVector> WaterfallNormals = {};
-};
\ No newline at end of file
+};
+
+USTRUCT(BlueprintType)
+struct FStructTerrainChunkLODData
+{
+	GENERATED_BODY()
+
+	//Terrain point of every chunk vertex, points on the border are shared with the neighbor chunk
+	UPROPERTY(BlueprintReadOnly)
+	TArray<int32> PointIndices = {};
+
+	//Vertices from here on are skirt copies, lowered by the skirt depth
+	UPROPERTY(BlueprintReadOnly)
+	int32 SkirtStart = 0;
+
+	//Into PointIndices
+	UPROPERTY(BlueprintReadOnly)
+	TArray<int32> Triangles = {};
+
+};
+
+USTRUCT(BlueprintType)
+struct FStructTerrainChunkData
+{
+	GENERATED_BODY()
+
+	UPROPERTY(BlueprintReadOnly)
+	FIntPoint ChunkCoord = FIntPoint();
+
+	UPROPERTY(BlueprintReadOnly)
+	class UProceduralMeshComponent* ChunkMesh = nullptr;
+
+	//One mesh section per LOD, LOD n uses every 2^n-th point
+	UPROPERTY(BlueprintReadOnly)
+	TArray<FStructTerrainChunkLODData> LODs = {};
+
+	UPROPERTY(BlueprintReadOnly)
+	int32 CurrentLOD = 0;
+
+};
+
+//Generated terrain saved by the derived data cache
+USTRUCT()
+struct FStructTerrainCacheData
+{
+	GENERATED_BODY()
+
+	UPROPERTY()
+	FString Key = FString();
+
+	UPROPERTY()
+	int32 GridRange = 0;
+
+	UPROPERTY()
+	TArray<FStructTerrainMeshPointData> TerrainMeshPointsData = {};
+
+	UPROPERTY()
+	TArray<FStructRiverLinePointData> RiverLinePointDatas = {};
+
+	UPROPERTY()
+	TArray<FStructLakeData> LakeDatas = {};
+
+	UPROPERTY()
+	int32 BlockLevelMax = 0;
+
+	UPROPERTY()
+	TArray<FVector3f> Vertices = {};
+
+	UPROPERTY()
+	TArray<int32> Triangles = {};
+
+	UPROPERTY()
+	TArray<FColor> VertexColors = {};
+
+	//Stage cache only, the full cache has them in TerrainMeshPointsData
+	UPROPERTY()
+	TArray<FVector> Normals = {};
+
+};
+
+//Coarse terrain shown while the full resolution mesh is generated
+USTRUCT()
+struct FStructTerrainPreviewData
+{
+	GENERATED_BODY()
+
+	UPROPERTY()
+	int32 Step = 1;
+
+	UPROPERTY()
+	TArray<FVector> Vertices = {};
+
+	UPROPERTY()
+	TArray<int32> Triangles = {};
+
+	UPROPERTY()
+	TArray<FVector> Normals = {};
+
+	UPROPERTY()
+	TArray<FVector2D> UVs = {};
+
+	UPROPERTY()
+	TArray<FVector2D> UV1 = {};
+
+	UPROPERTY()
+	TArray<FLinearColor> VertexColors = {};
+
+	UPROPERTY()
+	TArray<FProcMeshTangent> Tangents = {};
+
+};
@@ -33,4 +33,6 @@ public:
 
 	void SetParamLifeTimeScale(float Scale);
 	void SetParamVelocityScale(FVector VecScale);
+
+	virtual void CopyEffectFrom(ATerrainNiagaraUnit* Source) override;
 };
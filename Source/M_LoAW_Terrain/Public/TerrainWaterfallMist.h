@@ -24,5 +24,7 @@ public:
 	}
 
 	void SetParamWaterfallRadius(FVector2D Radius);
+
+	virtual void CopyEffectFrom(ATerrainNiagaraUnit* Source) override;
 	
 };
@@ -0,0 +1,16 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+using UnrealBuildTool;
+
+public class M_LoAW_TerrainEditor : ModuleRules
+{
+	public M_LoAW_TerrainEditor(ReadOnlyTargetRules Target) : base(Target)
+	{
+		PCHUsage = PCHUsageMode.UseExplicitOrSharedPCHs;
+	
+		PublicDependencyModuleNames.AddRange(new string[] { "Core", "CoreUObject", "Engine", "ProceduralMeshComponent" });
+
+		PrivateDependencyModuleNames.AddRange(new string[] { "M_LoAW_Terrain", "UnrealEd", "ToolMenus", "Slate", "SlateCore", 
+			"MeshDescription", "StaticMeshDescription", "AssetRegistry", "EngineSettings" });
+	}
+}
@@ -0,0 +1,69 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "M_LoAW_TerrainEditor.h"
+#include "TerrainBakeUtility.h"
+#include "M_LoAW_Terrain/Public/TerrainGenerator.h"
+#include "Editor.h"
+#include "EngineUtils.h"
+#include "ToolMenus.h"
+#include "Misc/MessageDialog.h"
+
+#define LOCTEXT_NAMESPACE "FM_LoAW_TerrainEditorModule"
+
+void FM_LoAW_TerrainEditorModule::StartupModule()
+{
+	UToolMenus::RegisterStartupCallback(FSimpleMulticastDelegate::FDelegate::CreateRaw(this, &FM_LoAW_TerrainEditorModule::RegisterMenus));
+}
+
+void FM_LoAW_TerrainEditorModule::ShutdownModule()
+{
+	UToolMenus::UnRegisterStartupCallback(this);
+
+	UToolMenus::UnregisterOwner(this);
+}
+
+void FM_LoAW_TerrainEditorModule::RegisterMenus()
+{
+	// Owner will be used for cleanup in call to UToolMenus::UnregisterOwner
+	FToolMenuOwnerScoped OwnerScoped(this);
+
+	UToolMenu* Menu = UToolMenus::Get()->ExtendMenu("LevelEditor.MainMenu.Tools");
+	FToolMenuSection& Section = Menu->FindOrAddSection("LoAW_Terrain", LOCTEXT("TerrainSection", "LoAW Terrain"));
+	Section.AddMenuEntry(
+		"BakeTerrain",
+		LOCTEXT("BakeTerrain", "Bake Terrain To Static Meshes"),
+		LOCTEXT("BakeTerrainTooltip", "Bake the terrain generated in the running PIE session into static mesh assets and place them in the edited level."),
+		FSlateIcon(),
+		FUIAction(FExecuteAction::CreateRaw(this, &FM_LoAW_TerrainEditorModule::BakeButtonClicked)));
+}
+
+void FM_LoAW_TerrainEditorModule::BakeButtonClicked()
+{
+	//The generator needs the grid data game instance, so it only runs in a play session
+	UWorld* PlayWorld = GEditor->PlayWorld;
+	ATerrainGenerator* Generator = nullptr;
+	if (PlayWorld) {
+		for (TActorIterator<ATerrainGenerator> It(PlayWorld); It; ++It)
+		{
+			Generator = *It;
+			break;
+		}
+	}
+	if (Generator == nullptr || !Generator->IsLoadingCompleted()) {
+		FMessageDialog::Open(EAppMsgType::Ok, LOCTEXT("BakeNotReady", "Start PIE and wait until the terrain is done before baking."));
+		return;
+	}
+
+	UWorld* EditorWorld = GEditor->GetEditorWorldContext().World();
+	FString PackageFolder = TerrainBakeUtility::GetDefaultPackageFolder(EditorWorld);
+	float MaxError = 0.0;
+	bool bMatch = TerrainBakeUtility::BakeTerrain(Generator, EditorWorld, PackageFolder, FTerrainBakeSettings(), MaxError);
+	FMessageDialog::Open(EAppMsgType::Ok, FText::Format(
+		LOCTEXT("BakeDone", "Terrain baked to {0}, max vertex error {1}{2}. Stop PIE and save the level to keep the placed actors."),
+		FText::FromString(PackageFolder), FText::AsNumber(MaxError),
+		bMatch ? FText::GetEmpty() : LOCTEXT("BakeMismatch", " (above tolerance!)")));
+}
+
+#undef LOCTEXT_NAMESPACE
+
+IMPLEMENT_MODULE(FM_LoAW_TerrainEditorModule, M_LoAW_TerrainEditor)
@@ -0,0 +1,124 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "TerrainBakeCommandlet.h"
+#include "TerrainBakeUtility.h"
+#include "M_LoAW_Terrain/Public/TerrainGenerator.h"
+#include "Engine/Engine.h"
+#include "Engine/GameInstance.h"
+#include "EngineUtils.h"
+#include "GameMapsSettings.h"
+#include "AssetRegistry/AssetRegistryModule.h"
+#include "Misc/PackageName.h"
+#include "Async/TaskGraphInterfaces.h"
+
+DEFINE_LOG_CATEGORY_STATIC(TerrainBakeCommandlet, Log, All);
+
+UTerrainBakeCommandlet::UTerrainBakeCommandlet()
+{
+	IsClient = false;
+	IsEditor = true;
+	IsServer = false;
+	LogToConsole = true;
+}
+
+int32 UTerrainBakeCommandlet::Main(const FString& Params)
+{
+	FString MapName;
+	if (!FParse::Value(*Params, TEXT("Map="), MapName)) {
+		UE_LOG(TerrainBakeCommandlet, Error, TEXT("Missing -Map=<long package name>!"));
+		return 1;
+	}
+	FTerrainBakeSettings Settings;
+	FParse::Value(*Params, TEXT("LODs="), Settings.LODNum);
+	FParse::Value(*Params, TEXT("Tolerance="), Settings.Tolerance);
+	Settings.bNanite = FParse::Param(*Params, TEXT("Nanite"));
+	double Timeout = 600.0;
+	FParse::Value(*Params, TEXT("Timeout="), Timeout);
+	FString PackageFolder = FString::Printf(TEXT("/Game/BakedTerrain/%s"), *FPackageName::GetShortName(MapName));
+	FParse::Value(*Params, TEXT("Out="), PackageFolder);
+
+	UWorld* World = PlayMap(MapName);
+	if (World == nullptr) {
+		return 1;
+	}
+	ATerrainGenerator* Generator = WaitTerrain(World, Timeout);
+	if (Generator == nullptr) {
+		return 1;
+	}
+
+	float MaxError = 0.0;
+	bool bMatch = SavePlacements(Generator, PackageFolder, MapName, Settings, MaxError);
+	UE_LOG(TerrainBakeCommandlet, Log, TEXT("Terrain bake %s, max vertex error %f."), bMatch ? TEXT("passed") : TEXT("failed"), MaxError);
+	return bMatch ? 0 : 1;
+}
+
+UWorld* UTerrainBakeCommandlet::PlayMap(const FString& MapName)
+{
+	UPackage* Package = LoadPackage(nullptr, *MapName, LOAD_None);
+	UWorld* World = Package ? UWorld::FindWorldInPackage(Package) : nullptr;
+	if (World == nullptr) {
+		UE_LOG(TerrainBakeCommandlet, Error, TEXT("Load map %s failed!"), *MapName);
+		return nullptr;
+	}
+
+	//Same setup as a game launch, the generator reads its grid data from the game instance
+	World->AddToRoot();
+	World->WorldType = EWorldType::Game;
+	FWorldContext& WorldContext = GEngine->CreateNewWorldContext(EWorldType::Game);
+	WorldContext.SetCurrentWorld(World);
+	if (!World->bIsWorldInitialized) {
+		World->InitWorld(UWorld::InitializationValues().AllowAudioPlayback(false).CreatePhysicsScene(true));
+	}
+	UClass* GameInstanceClass = GetDefault<UGameMapsSettings>()->GameInstanceClass.TryLoadClass<UGameInstance>();
+	UGameInstance* GameInstance = NewObject<UGameInstance>(GEngine, GameInstanceClass ? GameInstanceClass : UGameInstance::StaticClass());
+	WorldContext.OwningGameInstance = GameInstance;
+	World->SetGameInstance(GameInstance);
+	World->UpdateWorldComponents(true, true);
+	World->SetGameMode(FURL());
+	World->InitializeActorsForPlay(FURL());
+	World->BeginPlay();
+	return World;
+}
+
+ATerrainGenerator* UTerrainBakeCommandlet::WaitTerrain(UWorld* World, double Timeout)
+{
+	ATerrainGenerator* Generator = nullptr;
+	for (TActorIterator<ATerrainGenerator> It(World); It; ++It)
+	{
+		Generator = *It;
+		break;
+	}
+	if (Generator == nullptr) {
+		UE_LOG(TerrainBakeCommandlet, Error, TEXT("No terrain generator in %s!"), *World->GetName());
+		return nullptr;
+	}
+
+	//The workflow runs on world timers and game thread tasks, so both have to be pumped
+	double StartTime = FPlatformTime::Seconds();
+	while (!Generator->IsLoadingCompleted()) {
+		if (FPlatformTime::Seconds() - StartTime > Timeout) {
+			UE_LOG(TerrainBakeCommandlet, Error, TEXT("Terrain not done after %f seconds!"), Timeout);
+			return nullptr;
+		}
+		FTaskGraphInterface::Get().ProcessThreadUntilIdle(ENamedThreads::GameThread);
+		World->Tick(LEVELTICK_All, 1.0f / 30.0f);
+	}
+	UE_LOG(TerrainBakeCommandlet, Log, TEXT("Terrain done in %f seconds."), FPlatformTime::Seconds() - StartTime);
+	return Generator;
+}
+
+bool UTerrainBakeCommandlet::SavePlacements(ATerrainGenerator* Generator, const FString& PackageFolder, const FString& MapName,
+	const FTerrainBakeSettings& Settings, float& OutMaxError)
+{
+	FString LevelName = FString::Printf(TEXT("%s_BakedTerrain"), *FPackageName::GetShortName(MapName));
+	UPackage* Package = CreatePackage(*(PackageFolder / LevelName));
+	UWorld* BakedWorld = UWorld::CreateWorld(EWorldType::Inactive, false, FName(*LevelName), Package);
+	BakedWorld->SetFlags(RF_Public | RF_Standalone);
+
+	bool bMatch = TerrainBakeUtility::BakeTerrain(Generator, BakedWorld, PackageFolder, Settings, OutMaxError);
+	FAssetRegistryModule::AssetCreated(BakedWorld);
+	bMatch &= TerrainBakeUtility::SavePackage(BakedWorld, FPackageName::GetMapPackageExtension());
+	BakedWorld->DestroyWorld(false);
+	return bMatch;
+}
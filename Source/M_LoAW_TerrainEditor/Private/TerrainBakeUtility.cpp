@@ -0,0 +1,257 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "TerrainBakeUtility.h"
+#include "M_LoAW_Terrain/Public/TerrainGenerator.h"
+#include "M_LoAW_Terrain/Public/TerrainNiagaraUnit.h"
+#include "ProceduralMeshComponent.h"
+#include "Engine/StaticMesh.h"
+#include "Engine/StaticMeshActor.h"
+#include "Components/StaticMeshComponent.h"
+#include "PhysicsEngine/BodySetup.h"
+#include "StaticMeshAttributes.h"
+#include "StaticMeshResources.h"
+#include "AssetRegistry/AssetRegistryModule.h"
+#include "UObject/SavePackage.h"
+#include "Misc/PackageName.h"
+
+DEFINE_LOG_CATEGORY_STATIC(TerrainBake, Log, All);
+
+TerrainBakeUtility::TerrainBakeUtility()
+{
+}
+
+TerrainBakeUtility::~TerrainBakeUtility()
+{
+}
+
+FString TerrainBakeUtility::GetDefaultPackageFolder(UWorld* World)
+{
+	FString MapName = World ? FPackageName::GetShortName(World->GetOutermost()->GetName()) : TEXT("Terrain");
+	return FString::Printf(TEXT("/Game/BakedTerrain/%s"), *MapName);
+}
+
+bool TerrainBakeUtility::BakeTerrain(ATerrainGenerator* Generator, UWorld* TargetWorld, const FString& PackageFolder,
+	const FTerrainBakeSettings& Settings, float& OutMaxError)
+{
+	OutMaxError = 0.0;
+	TArray<UProceduralMeshComponent*> Meshes;
+	TArray<int32> SectionNums;
+	TArray<AActor*> Effects;
+	Generator->GetBakeSources(Meshes, SectionNums, Effects);
+
+	bool bMatch = true;
+	for (int32 i = 0; i < Meshes.Num(); i++)
+	{
+		FString AssetName = FString::Printf(TEXT("SM_%s"), *Meshes[i]->GetName());
+		UStaticMesh* StaticMesh = CreateStaticMesh(Meshes[i], SectionNums[i], PackageFolder / AssetName, Settings);
+		if (StaticMesh == nullptr) {
+			UE_LOG(TerrainBake, Warning, TEXT("Bake %s failed!"), *AssetName);
+			bMatch = false;
+			continue;
+		}
+
+		float Error = CompareVertices(Meshes[i], SectionNums[i], StaticMesh);
+		OutMaxError = FMath::Max(OutMaxError, Error);
+		if (Error > Settings.Tolerance) {
+			UE_LOG(TerrainBake, Warning, TEXT("Bake %s vertex error %f above tolerance %f!"), *AssetName, Error, Settings.Tolerance);
+			bMatch = false;
+		}
+
+		if (TargetWorld) {
+			AStaticMeshActor* Actor = TargetWorld->SpawnActor<AStaticMeshActor>(AStaticMeshActor::StaticClass(), Meshes[i]->GetComponentTransform());
+			Actor->GetStaticMeshComponent()->SetStaticMesh(StaticMesh);
+			Actor->GetStaticMeshComponent()->SetReceivesDecals(Meshes[i]->bReceivesDecals);
+			Actor->SetActorLabel(AssetName);
+			Actor->SetFolderPath(TEXT("BakedTerrain"));
+		}
+	}
+
+	//Fresh actors of the same class, a template would drag subobjects of the generation world into the saved level.
+	//Only the transform, niagara asset and the parameters set during generation carry over
+	if (TargetWorld) {
+		for (AActor* Effect : Effects)
+		{
+			AActor* Actor = TargetWorld->SpawnActor(Effect->GetClass(), &Effect->GetActorTransform());
+			if (Actor == nullptr) {
+				continue;
+			}
+			if (ATerrainNiagaraUnit* Unit = Cast<ATerrainNiagaraUnit>(Actor)) {
+				Unit->CopyEffectFrom(Cast<ATerrainNiagaraUnit>(Effect));
+			}
+			Actor->SetFolderPath(TEXT("BakedTerrain"));
+		}
+	}
+
+	UE_LOG(TerrainBake, Log, TEXT("Bake terrain to %s done, %d meshes, %d effects, max vertex error %f."),
+		*PackageFolder, Meshes.Num(), Effects.Num(), OutMaxError);
+	return bMatch;
+}
+
+UStaticMesh* TerrainBakeUtility::CreateStaticMesh(UProceduralMeshComponent* Mesh, int32 SectionNum,
+	const FString& PackageName, const FTerrainBakeSettings& Settings)
+{
+	FMeshDescription Description;
+	BuildMeshDescription(Mesh, SectionNum, Description);
+	if (Description.Triangles().Num() == 0) {
+		return nullptr;
+	}
+
+	UPackage* Package = CreatePackage(*PackageName);
+	UStaticMesh* StaticMesh = NewObject<UStaticMesh>(Package, *FPackageName::GetShortName(PackageName), RF_Public | RF_Standalone);
+	StaticMesh->InitResources();
+	StaticMesh->SetLightingGuid();
+
+	//Keep the generated normals and tangents, LOD 0 must stay the generated mesh
+	for (int32 LOD = 0; LOD < FMath::Max(1, Settings.LODNum); LOD++)
+	{
+		FStaticMeshSourceModel& SourceModel = StaticMesh->AddSourceModel();
+		SourceModel.BuildSettings.bRecomputeNormals = false;
+		SourceModel.BuildSettings.bRecomputeTangents = false;
+		SourceModel.BuildSettings.bRemoveDegenerates = false;
+		SourceModel.BuildSettings.bGenerateLightmapUVs = false;
+		SourceModel.BuildSettings.bUseFullPrecisionUVs = false;
+		if (LOD > 0) {
+			SourceModel.ReductionSettings.PercentTriangles = FMath::Pow(0.25f, (float)LOD);
+			SourceModel.ScreenSize.Default = FMath::Pow(0.5f, (float)LOD);
+		}
+	}
+	StaticMesh->CreateMeshDescription(0, MoveTemp(Description));
+	StaticMesh->CommitMeshDescription(0);
+
+	for (int32 i = 0; i < SectionNum; i++)
+	{
+		FName SlotName(*FString::Printf(TEXT("Section_%d"), i));
+		StaticMesh->GetStaticMaterials().Add(FStaticMaterial(Mesh->GetMaterial(i), SlotName, SlotName));
+	}
+
+	FMeshNaniteSettings NaniteSettings = StaticMesh->GetNaniteSettings();
+	NaniteSettings.bEnabled = Settings.bNanite;
+	//Full detail fallback, so the comparison and non nanite platforms see the generated mesh
+	NaniteSettings.FallbackPercentTriangles = 1.0f;
+	StaticMesh->SetNaniteSettings(NaniteSettings);
+
+	//Terrain is not convex, the cooked trimesh of LOD 0 serves as its simple collision
+	StaticMesh->CreateBodySetup();
+	StaticMesh->GetBodySetup()->CollisionTraceFlag = ECollisionTraceFlag::CTF_UseComplexAsSimple;
+
+	StaticMesh->SetImportVersion(EImportStaticMeshVersion::LastVersion);
+	StaticMesh->Build(true);
+	StaticMesh->PostEditChange();
+	FAssetRegistryModule::AssetCreated(StaticMesh);
+
+	if (!SavePackage(StaticMesh, FPackageName::GetAssetPackageExtension())) {
+		return nullptr;
+	}
+	return StaticMesh;
+}
+
+float TerrainBakeUtility::CompareVertices(UProceduralMeshComponent* Mesh, int32 SectionNum, UStaticMesh* StaticMesh)
+{
+	const FStaticMeshRenderData* RenderData = StaticMesh->GetRenderData();
+	if (RenderData == nullptr || RenderData->LODResources.IsEmpty()) {
+		return TNumericLimits<float>::Max();
+	}
+
+	//Baked positions bucketed by unit cell, each generated vertex only looks at its own cell and the neighbors
+	const FPositionVertexBuffer& Positions = RenderData->LODResources[0].VertexBuffers.PositionVertexBuffer;
+	TMultiMap<FIntVector, int32> Cells;
+	for (uint32 i = 0; i < Positions.GetNumVertices(); i++)
+	{
+		FVector3f Pos = Positions.VertexPosition(i);
+		Cells.Add(FIntVector(FMath::FloorToInt(Pos.X), FMath::FloorToInt(Pos.Y), FMath::FloorToInt(Pos.Z)), i);
+	}
+
+	float MaxError = 0.0;
+	TArray<int32> Candidates;
+	for (int32 Section = 0; Section < SectionNum; Section++)
+	{
+		const FProcMeshSection* ProcSection = Mesh->GetProcMeshSection(Section);
+		if (ProcSection == nullptr) {
+			continue;
+		}
+		for (const FProcMeshVertex& Vertex : ProcSection->ProcVertexBuffer)
+		{
+			FIntVector Cell(FMath::FloorToInt(Vertex.Position.X), FMath::FloorToInt(Vertex.Position.Y), FMath::FloorToInt(Vertex.Position.Z));
+			float Best = TNumericLimits<float>::Max();
+			for (int32 dx = -1; dx <= 1; dx++)
+			{
+				for (int32 dy = -1; dy <= 1; dy++)
+				{
+					for (int32 dz = -1; dz <= 1; dz++)
+					{
+						Candidates.Reset();
+						Cells.MultiFind(Cell + FIntVector(dx, dy, dz), Candidates);
+						for (int32 Index : Candidates)
+						{
+							Best = FMath::Min(Best, (float)FVector::Dist(Vertex.Position, FVector(Positions.VertexPosition(Index))));
+						}
+					}
+				}
+			}
+			MaxError = FMath::Max(MaxError, Best);
+		}
+	}
+	return MaxError;
+}
+
+bool TerrainBakeUtility::SavePackage(UObject* Asset, const FString& Extension)
+{
+	UPackage* Package = Asset->GetOutermost();
+	Package->MarkPackageDirty();
+	FString FileName = FPackageName::LongPackageNameToFilename(Package->GetName(), Extension);
+	FSavePackageArgs SaveArgs;
+	SaveArgs.TopLevelFlags = RF_Public | RF_Standalone;
+	if (!UPackage::SavePackage(Package, Asset, *FileName, SaveArgs)) {
+		UE_LOG(TerrainBake, Warning, TEXT("Save %s failed!"), *FileName);
+		return false;
+	}
+	return true;
+}
+
+void TerrainBakeUtility::BuildMeshDescription(UProceduralMeshComponent* Mesh, int32 SectionNum, FMeshDescription& OutDescription)
+{
+	FStaticMeshAttributes Attributes(OutDescription);
+	Attributes.Register();
+	TVertexAttributesRef<FVector3f> VertexPositions = Attributes.GetVertexPositions();
+	TVertexInstanceAttributesRef<FVector3f> Normals = Attributes.GetVertexInstanceNormals();
+	TVertexInstanceAttributesRef<FVector3f> Tangents = Attributes.GetVertexInstanceTangents();
+	TVertexInstanceAttributesRef<float> BinormalSigns = Attributes.GetVertexInstanceBinormalSigns();
+	TVertexInstanceAttributesRef<FVector4f> Colors = Attributes.GetVertexInstanceColors();
+	TVertexInstanceAttributesRef<FVector2f> UVs = Attributes.GetVertexInstanceUVs();
+	TPolygonGroupAttributesRef<FName> SlotNames = Attributes.GetPolygonGroupMaterialSlotNames();
+	UVs.SetNumChannels(2);
+
+	//One polygon group per section, every proc vertex becomes one vertex and one shared instance
+	TArray<FVertexInstanceID> Instances;
+	for (int32 Section = 0; Section < SectionNum; Section++)
+	{
+		const FProcMeshSection* ProcSection = Mesh->GetProcMeshSection(Section);
+		FPolygonGroupID GroupID = OutDescription.CreatePolygonGroup();
+		SlotNames[GroupID] = FName(*FString::Printf(TEXT("Section_%d"), Section));
+		if (ProcSection == nullptr) {
+			continue;
+		}
+
+		Instances.Reset();
+		for (const FProcMeshVertex& Vertex : ProcSection->ProcVertexBuffer)
+		{
+			FVertexID VertexID = OutDescription.CreateVertex();
+			VertexPositions[VertexID] = FVector3f(Vertex.Position);
+			FVertexInstanceID InstanceID = OutDescription.CreateVertexInstance(VertexID);
+			Normals[InstanceID] = FVector3f(Vertex.Normal);
+			Tangents[InstanceID] = FVector3f(Vertex.Tangent.TangentX);
+			BinormalSigns[InstanceID] = Vertex.Tangent.bFlipTangentY ? -1.0f : 1.0f;
+			Colors[InstanceID] = FVector4f(FLinearColor(Vertex.Color));
+			UVs.Set(InstanceID, 0, FVector2f(Vertex.UV0));
+			UVs.Set(InstanceID, 1, FVector2f(Vertex.UV1));
+			Instances.Add(InstanceID);
+		}
+
+		const TArray<uint32>& Indices = ProcSection->ProcIndexBuffer;
+		for (int32 i = 0; i + 2 < Indices.Num(); i += 3)
+		{
+			OutDescription.CreateTriangle(GroupID, { Instances[Indices[i]], Instances[Indices[i + 1]], Instances[Indices[i + 2]] });
+		}
+	}
+}
@@ -0,0 +1,31 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "TerrainBakeCommandlet.generated.h"
+
+/**
+ * Plays a map until its terrain generator is done, bakes the terrain to static meshes and
+ * saves the placements as a level to add as a sublevel in place of the generator.
+ * UnrealEditor-Cmd <project> -run=TerrainBake -Map=/Game/Maps/MyMap [-Out=/Game/BakedTerrain/MyMap]
+ *     [-LODs=4] [-Nanite] [-Tolerance=0.1] [-Timeout=600]
+ * Returns 1 when the bake fails or a baked mesh differs from the generated one above the tolerance.
+ */
+UCLASS()
+class M_LOAW_TERRAINEDITOR_API UTerrainBakeCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	UTerrainBakeCommandlet();
+
+	virtual int32 Main(const FString& Params) override;
+
+private:
+	UWorld* PlayMap(const FString& MapName);
+	class ATerrainGenerator* WaitTerrain(UWorld* World, double Timeout);
+	bool SavePlacements(class ATerrainGenerator* Generator, const FString& PackageFolder, const FString& MapName,
+		const struct FTerrainBakeSettings& Settings, float& OutMaxError);
+};
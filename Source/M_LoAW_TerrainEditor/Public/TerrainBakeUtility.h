@@ -0,0 +1,42 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+struct FTerrainBakeSettings
+{
+	//Static mesh LODs, each one keeps a quarter of the triangles of the previous one
+	int32 LODNum = 4;
+	bool bNanite = false;
+	//Largest allowed distance between a generated vertex and its baked copy
+	float Tolerance = 0.1f;
+};
+
+/**
+ * Turns the procedural meshes of a finished ATerrainGenerator into static mesh assets
+ * and places them, with the waterfall effects, into a target world.
+ */
+class M_LOAW_TERRAINEDITOR_API TerrainBakeUtility
+{
+public:
+	TerrainBakeUtility();
+	~TerrainBakeUtility();
+
+	static FString GetDefaultPackageFolder(UWorld* World);
+
+	//Assets go to PackageFolder, placement actors to TargetWorld when given. True when every baked mesh matches within tolerance
+	static bool BakeTerrain(class ATerrainGenerator* Generator, UWorld* TargetWorld, const FString& PackageFolder,
+		const FTerrainBakeSettings& Settings, float& OutMaxError);
+
+	static class UStaticMesh* CreateStaticMesh(class UProceduralMeshComponent* Mesh, int32 SectionNum,
+		const FString& PackageName, const FTerrainBakeSettings& Settings);
+
+	//Largest distance from a generated vertex to the nearest vertex of the baked LOD 0
+	static float CompareVertices(class UProceduralMeshComponent* Mesh, int32 SectionNum, class UStaticMesh* StaticMesh);
+
+	static bool SavePackage(UObject* Asset, const FString& Extension);
+
+private:
+	static void BuildMeshDescription(class UProceduralMeshComponent* Mesh, int32 SectionNum, struct FMeshDescription& OutDescription);
+};
@@ -15,5 +15,6 @@ public class M_LoAW_UnitEditorTarget : TargetRules
         ExtraModuleNames.Add("M_LoAW_GameGrid");
         ExtraModuleNames.Add("M_LoAW_GridData");
         ExtraModuleNames.Add("M_LoAW_Terrain");
+        ExtraModuleNames.Add("M_LoAW_TerrainEditor");
     }
 }